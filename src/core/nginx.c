@@ -23,6 +23,9 @@ static char *ngx_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_NUMA)
+static char *ngx_set_numa_affinity(ngx_conf_t *cf, ngx_core_conf_t *ccf);
+#endif
 static char *ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -124,6 +127,13 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, rlimit_core),
       NULL },
 
+    { ngx_string("huge_pages"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, huge_pages),
+      NULL },
+
     { ngx_string("worker_shutdown_timeout"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -1021,6 +1031,8 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *     ccf->oldpid = NULL;
      *     ccf->priority = 0;
      *     ccf->cpu_affinity_auto = 0;
+     *     ccf->cpu_affinity_numa = 0;
+     *     ccf->cpu_affinity_nodes = 0;
      *     ccf->cpu_affinity_n = 0;
      *     ccf->cpu_affinity = NULL;
      */
@@ -1036,6 +1048,8 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
     ccf->rlimit_nofile = NGX_CONF_UNSET;
     ccf->rlimit_core = NGX_CONF_UNSET;
 
+    ccf->huge_pages = NGX_CONF_UNSET;
+
     ccf->user = (ngx_uid_t) NGX_CONF_UNSET_UINT;
     ccf->group = (ngx_gid_t) NGX_CONF_UNSET_UINT;
 
@@ -1061,6 +1075,7 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
+    ngx_conf_init_value(ccf->huge_pages, 0);
 
 #if (NGX_HAVE_CPU_AFFINITY)
 
@@ -1336,7 +1351,21 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     value = cf->args->elts;
 
-    if (ngx_strcmp(value[1].data, "auto") == 0) {
+    if (ngx_strcmp(value[1].data, "numa") == 0) {
+#if (NGX_HAVE_NUMA)
+        ccf->cpu_affinity_numa = 1;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"worker_cpu_affinity numa\" is not supported "
+                           "on this platform");
+        return NGX_CONF_ERROR;
+#endif
+
+    } else if (ngx_strcmp(value[1].data, "auto") == 0) {
+        ccf->cpu_affinity_auto = 1;
+    }
+
+    if (ccf->cpu_affinity_auto || ccf->cpu_affinity_numa) {
 
         if (cf->args->nelts > 3) {
             ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -1345,8 +1374,6 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             return NGX_CONF_ERROR;
         }
 
-        ccf->cpu_affinity_auto = 1;
-
         CPU_ZERO(&mask[0]);
         for (i = 0; i < (ngx_uint_t) ngx_min(ngx_ncpu, CPU_SETSIZE); i++) {
             CPU_SET(i, &mask[0]);
@@ -1398,6 +1425,14 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         }
     }
 
+#if (NGX_HAVE_NUMA)
+
+    if (ccf->cpu_affinity_numa) {
+        return ngx_set_numa_affinity(cf, ccf);
+    }
+
+#endif
+
 #else
 
     ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
@@ -1409,8 +1444,75 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (NGX_HAVE_NUMA)
+
+static char *
+ngx_set_numa_affinity(ngx_conf_t *cf, ngx_core_conf_t *ccf)
+{
+    ngx_int_t      rc;
+    ngx_uint_t     node, n;
+    ngx_cpuset_t  *mask, *allowed;
+
+    /*
+     * workers are spread over the nodes which have CPUs allowed
+     * by the mask, each worker may run on any CPU of its node
+     */
+
+    allowed = &ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
+
+    mask = ngx_palloc(cf->pool, NGX_NUMA_MAX_NODES * sizeof(ngx_cpuset_t));
+    if (mask == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    n = 0;
+
+    for (node = 0; node < NGX_NUMA_MAX_NODES; node++) {
+
+        rc = ngx_numa_node_cpus(node, &mask[n], cf->log);
+
+        if (rc == NGX_ERROR) {
+            return NGX_CONF_ERROR;
+        }
+
+        if (rc == NGX_DECLINED) {
+            continue;
+        }
+
+        CPU_AND(&mask[n], &mask[n], allowed);
+
+        if (CPU_COUNT(&mask[n]) == 0) {
+            continue;
+        }
+
+        ccf->cpu_affinity_nodes |= (ngx_uint_t) 1 << node;
+        n++;
+    }
+
+    if (n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no NUMA nodes found for \"worker_cpu_affinity\"");
+        return NGX_CONF_ERROR;
+    }
+
+    ccf->cpu_affinity_n = n;
+    ccf->cpu_affinity = mask;
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 ngx_cpuset_t *
 ngx_get_cpu_affinity(ngx_uint_t n)
+{
+    return ngx_get_cycle_cpu_affinity((ngx_cycle_t *) ngx_cycle, n);
+}
+
+
+ngx_cpuset_t *
+ngx_get_cycle_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n)
 {
 #if (NGX_HAVE_CPU_AFFINITY)
     ngx_uint_t        i, j;
@@ -1419,13 +1521,16 @@ ngx_get_cpu_affinity(ngx_uint_t n)
 
     static ngx_cpuset_t  result;
 
-    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
-                                           ngx_core_module);
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
     if (ccf->cpu_affinity == NULL) {
         return NULL;
     }
 
+    if (ccf->cpu_affinity_numa) {
+        return &ccf->cpu_affinity[n % ccf->cpu_affinity_n];
+    }
+
     if (ccf->cpu_affinity_auto) {
         mask = &ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
 
@@ -1463,6 +1568,35 @@ ngx_get_cpu_affinity(ngx_uint_t n)
 }
 
 
+ngx_int_t
+ngx_get_numa_node(ngx_uint_t n)
+{
+#if (NGX_HAVE_NUMA)
+    ngx_uint_t        node;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (!ccf->cpu_affinity_numa) {
+        return NGX_DECLINED;
+    }
+
+    n %= ccf->cpu_affinity_n;
+
+    for (node = 0; node < NGX_NUMA_MAX_NODES; node++) {
+
+        if ((ccf->cpu_affinity_nodes & ((ngx_uint_t) 1 << node)) && n-- == 0) {
+            return node;
+        }
+    }
+
+#endif
+
+    return NGX_DECLINED;
+}
+
+
 static char *
 ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -14,6 +14,9 @@ ngx_os_io_t  ngx_io;
 
 
 static void ngx_drain_connections(ngx_cycle_t *cycle);
+#if (NGX_HAVE_REUSEPORT_CBPF)
+static void ngx_attach_reuseport_cbpf(ngx_cycle_t *cycle, ngx_listening_t *ls);
+#endif
 
 
 ngx_listening_t *
@@ -835,6 +838,14 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
         }
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+        if ((ls[i].reuseport_cpu || ls[i].delete_reuseport_cpu)
+            && ls[i].worker == 0)
+        {
+            ngx_attach_reuseport_cbpf(cycle, &ls[i]);
+        }
+#endif
+
 #if 0
         if (1) {
             int tcp_nodelay = 1;
@@ -1017,6 +1028,197 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+
+static void
+ngx_attach_reuseport_cbpf(ngx_cycle_t *cycle, ngx_listening_t *ls)
+{
+    ngx_int_t           *owner;
+    ngx_uint_t           cpu, prev, worker, nworkers, n, k;
+    ngx_cpuset_t        *mask, *masks;
+    ngx_core_conf_t     *ccf;
+    struct sock_fprog    prog;
+    struct sock_filter  *code, *f;
+
+    /*
+     * the program returns an index of a socket in the reuseport group,
+     * sockets of a group are bound in order of worker numbers;
+     * an index out of the group makes the kernel fall back to hashing
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    nworkers = ccf->worker_processes;
+
+    code = ngx_calloc((2 * CPU_SETSIZE + 3) * sizeof(struct sock_filter)
+                      + CPU_SETSIZE * sizeof(ngx_int_t)
+                      + nworkers * sizeof(ngx_cpuset_t), cycle->log);
+    if (code == NULL) {
+        return;
+    }
+
+    owner = (ngx_int_t *) &code[2 * CPU_SETSIZE + 3];
+    masks = (ngx_cpuset_t *) &owner[CPU_SETSIZE];
+    f = code;
+
+    if (!ls->reuseport_cpu) {
+        /* steering was switched off on reload */
+        goto fallback;
+    }
+
+    f->code = BPF_LD|BPF_W|BPF_ABS;
+    f->k = SKF_AD_OFF + SKF_AD_CPU;
+    f++;
+
+    if (ngx_get_cycle_cpu_affinity(cycle, 0) == NULL) {
+
+        /* workers are not bound to CPUs, keep each CPU to a worker */
+
+        if (ccf->worker_processes > ngx_ncpu) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "reuseport=cpu of %V is not used, as there are "
+                          "more worker processes than CPUs", &ls->addr_text);
+            goto fallback;
+        }
+
+        f->code = BPF_ALU|BPF_MOD|BPF_K;
+        f->k = ccf->worker_processes;
+        f++;
+
+        f->code = BPF_RET|BPF_A;
+        f++;
+
+        goto attach;
+    }
+
+    /* the mask may be returned in a static buffer */
+
+    for (worker = 0; worker < nworkers; worker++) {
+
+        mask = ngx_get_cycle_cpu_affinity(cycle, worker);
+
+        if (mask) {
+            masks[worker] = *mask;
+        }
+    }
+
+    /*
+     * CPUs shared by the same set of workers, e.g., CPUs of a node
+     * with "worker_cpu_affinity numa", are spread over these workers:
+     * the k-th such CPU goes to the (k mod n)-th worker of the set
+     */
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+
+        owner[cpu] = -1;
+
+        n = 0;
+
+        for (worker = 0; worker < nworkers; worker++) {
+            if (CPU_ISSET(cpu, &masks[worker])) {
+                n++;
+            }
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        k = 0;
+
+        for (prev = 0; prev < cpu; prev++) {
+
+            if (owner[prev] == -1) {
+                continue;
+            }
+
+            for (worker = 0; worker < nworkers; worker++) {
+                if (!CPU_ISSET(cpu, &masks[worker])
+                    != !CPU_ISSET(prev, &masks[worker]))
+                {
+                    break;
+                }
+            }
+
+            if (worker == nworkers) {
+                k++;
+            }
+        }
+
+        k %= n;
+
+        for (worker = 0; /* void */ ; worker++) {
+            if (CPU_ISSET(cpu, &masks[worker]) && k-- == 0) {
+                break;
+            }
+        }
+
+        owner[cpu] = worker;
+    }
+
+    for (worker = 0; worker < nworkers; worker++) {
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (owner[cpu] == (ngx_int_t) worker) {
+                break;
+            }
+        }
+
+        if (cpu == CPU_SETSIZE) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "reuseport=cpu of %V is not used, as worker "
+                          "process %ui would not get connections",
+                          &ls->addr_text, worker);
+            goto fallback;
+        }
+    }
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+
+        if (owner[cpu] == -1) {
+            continue;
+        }
+
+        f->code = BPF_JMP|BPF_JEQ|BPF_K;
+        f->k = cpu;
+        f->jf = 1;
+        f++;
+
+        f->code = BPF_RET|BPF_K;
+        f->k = owner[cpu];
+        f++;
+    }
+
+fallback:
+
+    f->code = BPF_RET|BPF_K;
+    f->k = 0xffffffff;
+    f++;
+
+attach:
+
+    prog.len = f - code;
+    prog.filter = code;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "reuseport cbpf program of %ud instructions for %V",
+                   prog.len, &ls->addr_text);
+
+    if (setsockopt(ls->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   (const void *) &prog, sizeof(struct sock_fprog))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      "setsockopt(SO_ATTACH_REUSEPORT_CBPF) %V failed, "
+                      "ignored", &ls->addr_text);
+    }
+
+    ngx_free(code);
+}
+
+#endif
+
+
 void
 ngx_close_listening_sockets(ngx_cycle_t *cycle)
 {
@@ -74,6 +74,8 @@ struct ngx_listening_s {
 #endif
     unsigned            reuseport:1;
     unsigned            add_reuseport:1;
+    unsigned            reuseport_cpu:1;
+    unsigned            delete_reuseport_cpu:1;
     unsigned            keepalive:2;
 
     unsigned            deferred_accept:1;
@@ -426,6 +426,14 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
         shm_zone[i].shm.log = cycle->log;
 
+#if (NGX_HAVE_MAP_HUGETLB)
+        shm_zone[i].shm.huge = ccf->huge_pages;
+#endif
+#if (NGX_HAVE_NUMA)
+        shm_zone[i].shm.numa = ccf->cpu_affinity_numa ? ccf->cpu_affinity_nodes
+                                                      : 0;
+#endif
+
         opart = &old_cycle->shared_memory.part;
         oshm_zone = opart->elts;
 
@@ -460,6 +468,9 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
+#if (NGX_HAVE_MAP_HUGETLB)
+                shm_zone[i].shm.huge = oshm_zone[n].shm.huge;
+#endif
 
                 if (shm_zone[i].init(&shm_zone[i], oshm_zone[n].data)
                     != NGX_OK)
@@ -569,6 +580,12 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                     }
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+                    if (ls[i].reuseport_cpu && !nls[n].reuseport_cpu) {
+                        nls[n].delete_reuseport_cpu = 1;
+                    }
+#endif
+
                     break;
                 }
             }
@@ -97,9 +97,13 @@ typedef struct {
     ngx_int_t                 rlimit_nofile;
     off_t                     rlimit_core;
 
+    ngx_flag_t                huge_pages;
+
     int                       priority;
 
     ngx_uint_t                cpu_affinity_auto;
+    ngx_uint_t                cpu_affinity_numa;
+    ngx_uint_t                cpu_affinity_nodes;
     ngx_uint_t                cpu_affinity_n;
     ngx_cpuset_t             *cpu_affinity;
 
@@ -131,6 +135,8 @@ void ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user);
 char **ngx_set_environment(ngx_cycle_t *cycle, ngx_uint_t *last);
 ngx_pid_t ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv);
 ngx_cpuset_t *ngx_get_cpu_affinity(ngx_uint_t n);
+ngx_cpuset_t *ngx_get_cycle_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n);
+ngx_int_t ngx_get_numa_node(ngx_uint_t n);
 ngx_shm_zone_t *ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name,
     size_t size, void *tag);
 void ngx_set_shutdown_timer(ngx_cycle_t *cycle);
@@ -8,6 +8,121 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+
+
+#if (NGX_PERFECT_HASH)
+
+/*
+ * keys are split into small buckets, and each bucket is assigned
+ * a displacement which places all its keys into groups of NGX_HASH_GROUP
+ * slots with free space left; a lookup thus inspects a single group,
+ * comparing one byte fingerprints of all its slots at once; a group
+ * occupies one cache line, and its slots refer to elements by offsets
+ */
+
+#define NGX_HASH_GROUP          12
+#define NGX_HASH_GROUP_LOAD     9
+#define NGX_HASH_BUCKET_LOAD    4
+#define NGX_HASH_DISPLACEMENTS  65536
+#define NGX_HASH_ATTEMPTS       8
+
+#define ngx_hash_range(h, n)    (ngx_uint_t) (((uint64_t) (h) * (n)) >> 32)
+#define ngx_hash_displace(h, d)                                               \
+    ((uint32_t) ((h) >> 32) ^ (uint32_t) (d) * 0x9e3779b9)
+#define ngx_hash_fingerprint(h) (u_char) (0x80 | ((h) >> 32))
+
+
+typedef struct {
+    u_char                    fingerprints[16];
+    uint32_t                  offsets[NGX_HASH_GROUP];
+} ngx_hash_group_t;
+
+
+static ngx_inline uint64_t
+ngx_hash_mix(ngx_uint_t key)
+{
+    uint64_t  h;
+
+    h = key;
+
+    h = (h ^ (h >> 32)) * 0x9e3779b97f4a7c15;
+
+    return h ^ (h >> 32);
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_hash_match(u_char *group, u_char fp)
+{
+#if (NGX_HAVE_SSE2)
+
+    __m128i  v;
+
+    v = _mm_load_si128((__m128i *) group);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char) fp)));
+
+#else
+
+    ngx_uint_t  i, mask;
+
+    mask = 0;
+
+    /* slots are filled in order */
+
+    for (i = 0; i < NGX_HASH_GROUP && group[i]; i++) {
+        if (group[i] == fp) {
+            mask |= (ngx_uint_t) 1 << i;
+        }
+    }
+
+    return mask;
+
+#endif
+}
+
+
+void *
+ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
+{
+    uint64_t           h;
+    ngx_uint_t         i, mask;
+    ngx_hash_elt_t    *elt;
+    ngx_hash_group_t  *group;
+
+    h = ngx_hash_mix(key);
+
+    i = ngx_hash_range((uint32_t) h, hash->ndisplacements);
+
+    group = (ngx_hash_group_t *) hash->buckets
+            + ngx_hash_range(ngx_hash_displace(h, hash->displacements[i]),
+                             hash->size);
+
+    mask = ngx_hash_match(group->fingerprints, ngx_hash_fingerprint(h));
+
+    for (i = 0; mask; i++, mask >>= 1) {
+
+        if ((mask & 1) == 0) {
+            continue;
+        }
+
+        elt = (ngx_hash_elt_t *) ((u_char *) hash->buckets
+                                  + group->offsets[i]);
+
+        if (len == (size_t) elt->len
+            && ngx_memcmp(name, elt->name, len) == 0)
+        {
+            return elt->value;
+        }
+    }
+
+    return NULL;
+}
+
+#else
 
 void *
 ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
@@ -48,6 +163,8 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     return NULL;
 }
 
+#endif
+
 
 void *
 ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
@@ -248,6 +365,236 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 #define NGX_HASH_ELT_SIZE(name)                                               \
     (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
 
+
+#if (NGX_PERFECT_HASH)
+
+ngx_int_t
+ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
+{
+    u_char            *elts, *load;
+    size_t             len;
+    uint16_t          *displacements;
+    uint32_t          *keys, *groups, *start, *order, *sizes;
+    uint64_t          *hashes;
+    ngx_uint_t         i, j, k, n, b, d, g, size, nbuckets, attempt;
+    ngx_hash_elt_t    *elt;
+    ngx_hash_group_t  *group;
+
+    n = 0;
+    len = 0;
+
+    for (j = 0; j < nelts; j++) {
+        if (names[j].key.data == NULL) {
+            continue;
+        }
+
+        n++;
+        len += NGX_HASH_ELT_SIZE(&names[j]);
+    }
+
+    size = n / NGX_HASH_GROUP_LOAD + 1;
+    nbuckets = n / NGX_HASH_BUCKET_LOAD + 1;
+
+    hashes = ngx_alloc(nelts * sizeof(uint64_t)
+                       + (2 * nelts + 2 * nbuckets + n + 3) * sizeof(uint32_t),
+                       hinit->pool->log);
+    if (hashes == NULL) {
+        return NGX_ERROR;
+    }
+
+    keys = (uint32_t *) &hashes[nelts];
+    groups = &keys[nelts];
+    start = &groups[nelts];
+    order = &start[nbuckets + 1];
+    sizes = &order[nbuckets];
+
+    load = NULL;
+
+    displacements = ngx_pcalloc(hinit->pool, nbuckets * sizeof(uint16_t));
+    if (displacements == NULL) {
+        goto failed;
+    }
+
+    /* split keys into buckets */
+
+    ngx_memzero(start, (nbuckets + 1) * sizeof(uint32_t));
+
+    for (j = 0; j < nelts; j++) {
+        if (names[j].key.data == NULL) {
+            continue;
+        }
+
+        hashes[j] = ngx_hash_mix(names[j].key_hash);
+
+        b = ngx_hash_range((uint32_t) hashes[j], nbuckets);
+        start[b + 1]++;
+    }
+
+    /* larger buckets are placed first */
+
+    ngx_memzero(sizes, (n + 2) * sizeof(uint32_t));
+
+    for (b = 0; b < nbuckets; b++) {
+        sizes[n + 1 - start[b + 1]]++;
+    }
+
+    for (i = 1; i < n + 2; i++) {
+        sizes[i] += sizes[i - 1];
+    }
+
+    for (b = nbuckets; b; b--) {
+        order[--sizes[n + 1 - start[b]]] = b - 1;
+    }
+
+    for (b = 0; b < nbuckets; b++) {
+        start[b + 1] += start[b];
+    }
+
+    for (j = 0; j < nelts; j++) {
+        if (names[j].key.data == NULL) {
+            continue;
+        }
+
+        b = ngx_hash_range((uint32_t) hashes[j], nbuckets);
+        keys[start[b]++] = j;
+    }
+
+    for (b = nbuckets; b; b--) {
+        start[b] = start[b - 1];
+    }
+
+    start[0] = 0;
+
+    /* find displacements, adding groups if needed */
+
+    for (attempt = 0; attempt < NGX_HASH_ATTEMPTS; attempt++) {
+
+        load = ngx_calloc(size, hinit->pool->log);
+        if (load == NULL) {
+            goto failed;
+        }
+
+        for (i = 0; i < nbuckets; i++) {
+            b = order[i];
+
+            if (start[b] == start[b + 1]) {
+                goto found;
+            }
+
+            for (d = 0; d < NGX_HASH_DISPLACEMENTS; d++) {
+
+                for (k = start[b]; k < start[b + 1]; k++) {
+                    j = keys[k];
+                    g = ngx_hash_range(ngx_hash_displace(hashes[j], d), size);
+
+                    if (load[g] == NGX_HASH_GROUP) {
+                        break;
+                    }
+
+                    load[g]++;
+                    groups[j] = g;
+                }
+
+                if (k == start[b + 1]) {
+                    break;
+                }
+
+                while (k-- > start[b]) {
+                    load[groups[keys[k]]]--;
+                }
+            }
+
+            if (d == NGX_HASH_DISPLACEMENTS) {
+                break;
+            }
+
+            displacements[b] = (uint16_t) d;
+        }
+
+        if (i == nbuckets) {
+            goto found;
+        }
+
+        ngx_free(load);
+        load = NULL;
+
+        size += size / 4 + 1;
+    }
+
+    ngx_log_error(NGX_LOG_EMERG, hinit->pool->log, 0,
+                  "could not build %s", hinit->name);
+
+    goto failed;
+
+found:
+
+    if (hinit->hash == NULL) {
+        hinit->hash = ngx_pcalloc(hinit->pool, sizeof(ngx_hash_wildcard_t));
+        if (hinit->hash == NULL) {
+            goto failed;
+        }
+    }
+
+    /* groups are followed by elements */
+
+    elts = ngx_palloc(hinit->pool, (size + 1) * sizeof(ngx_hash_group_t) + len);
+    if (elts == NULL) {
+        goto failed;
+    }
+
+    elts = ngx_align_ptr(elts, sizeof(ngx_hash_group_t));
+
+    group = (ngx_hash_group_t *) elts;
+    ngx_memzero(group, size * sizeof(ngx_hash_group_t));
+
+    elts += size * sizeof(ngx_hash_group_t);
+
+    ngx_memzero(load, size);
+
+    for (j = 0; j < nelts; j++) {
+        if (names[j].key.data == NULL) {
+            continue;
+        }
+
+        g = groups[j];
+        k = load[g]++;
+
+        elt = (ngx_hash_elt_t *) elts;
+
+        elt->value = names[j].value;
+        elt->len = (u_short) names[j].key.len;
+
+        ngx_strlow(elt->name, names[j].key.data, names[j].key.len);
+
+        group[g].fingerprints[k] = ngx_hash_fingerprint(hashes[j]);
+        group[g].offsets[k] = (uint32_t) (elts - (u_char *) group);
+
+        elts += NGX_HASH_ELT_SIZE(&names[j]);
+    }
+
+    ngx_free(load);
+    ngx_free(hashes);
+
+    hinit->hash->buckets = (ngx_hash_elt_t **) group;
+    hinit->hash->size = size;
+    hinit->hash->displacements = displacements;
+    hinit->hash->ndisplacements = nbuckets;
+
+    return NGX_OK;
+
+failed:
+
+    if (load) {
+        ngx_free(load);
+    }
+
+    ngx_free(hashes);
+
+    return NGX_ERROR;
+}
+
+#else
+
 ngx_int_t
 ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 {
@@ -460,6 +807,8 @@ found:
     return NGX_OK;
 }
 
+#endif
+
 
 ngx_int_t
 ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
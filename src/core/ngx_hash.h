@@ -23,6 +23,11 @@ typedef struct {
 typedef struct {
     ngx_hash_elt_t  **buckets;
     ngx_uint_t        size;
+#if (NGX_PERFECT_HASH)
+    /* buckets point to groups of slots followed by elements */
+    uint16_t         *displacements;
+    ngx_uint_t        ndisplacements;
+#endif
 } ngx_hash_t;
 
 
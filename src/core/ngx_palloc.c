@@ -9,10 +9,47 @@
 #include <ngx_core.h>
 
 
+#define NGX_POOL_CACHE_SLOTS       8
+#define NGX_POOL_CACHE_SLOT_SIZE   (256 * 1024)
+
+
+typedef struct ngx_pool_cached_s  ngx_pool_cached_t;
+
+struct ngx_pool_cached_s {
+    ngx_pool_cached_t    *next;
+};
+
+
+typedef struct {
+    size_t                size;
+    ngx_uint_t            number;
+    ngx_pool_cached_t    *block;
+} ngx_pool_cache_slot_t;
+
+
 static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_get_cached(size_t size);
+static void ngx_pool_free_block(void *p, size_t size);
+
+
+/*
+ * blocks and large allocations freed by pools are kept in a per-process
+ * cache to be reused by pools created later, e.g., for the next request
+ */
+
+#if !(NGX_DEBUG_PALLOC)
+
+static ngx_pool_cache_slot_t  ngx_pool_cache[NGX_POOL_CACHE_SLOTS];
+
+#if (NGX_THREADS)
+static pthread_t              ngx_pool_cache_thread;
+static ngx_uint_t             ngx_pool_cache_thread_set;
+#endif
+
+#endif
 
 
 ngx_pool_t *
@@ -20,9 +57,13 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_get_cached(size);
+
     if (p == NULL) {
-        return NULL;
+        p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+        if (p == NULL) {
+            return NULL;
+        }
     }
 
     p->d.last = (u_char *) p + sizeof(ngx_pool_t);
@@ -46,6 +87,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 void
 ngx_destroy_pool(ngx_pool_t *pool)
 {
+    size_t               size;
     ngx_pool_t          *p, *n;
     ngx_pool_large_t    *l;
     ngx_pool_cleanup_t  *c;
@@ -82,12 +124,16 @@ ngx_destroy_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free_block(l->alloc, l->size);
         }
     }
 
+    /* all blocks of a pool are of the same size */
+
+    size = pool->d.end - (u_char *) pool;
+
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_free_block(p, size);
 
         if (n == NULL) {
             break;
@@ -104,7 +150,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free_block(l->alloc, l->size);
         }
     }
 
@@ -183,9 +229,13 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_get_cached(psize);
+
     if (m == NULL) {
-        return NULL;
+        m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+        if (m == NULL) {
+            return NULL;
+        }
     }
 
     new = (ngx_pool_t *) m;
@@ -217,9 +267,13 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    p = ngx_pool_get_cached(size);
+
     if (p == NULL) {
-        return NULL;
+        p = ngx_alloc(size, pool->log);
+        if (p == NULL) {
+            return NULL;
+        }
     }
 
     n = 0;
@@ -227,6 +281,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = size;
             return p;
         }
 
@@ -237,11 +292,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_free_block(p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -262,11 +318,12 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_free_block(p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -283,7 +340,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_free_block(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -294,6 +351,29 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+void
+ngx_pool_stat(ngx_pool_t *pool, ngx_pool_stat_t *stat)
+{
+    ngx_pool_t        *p;
+    ngx_pool_large_t  *l;
+
+    ngx_memzero(stat, sizeof(ngx_pool_stat_t));
+
+    for (p = pool; p; p = p->d.next) {
+        stat->size += p->d.end - (u_char *) p;
+        stat->used += p->d.last - (u_char *) p;
+        stat->blocks++;
+    }
+
+    for (l = pool->large; l; l = l->next) {
+        if (l->alloc) {
+            stat->large_size += l->size;
+            stat->large++;
+        }
+    }
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
@@ -401,30 +481,123 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+#if (NGX_THREADS && !NGX_DEBUG_PALLOC)
+
+static ngx_inline ngx_uint_t
+ngx_pool_cache_thread_check(void)
+{
+    /*
+     * pools may also be used in thread pools, while the cache is
+     * only used by the thread which used it first, that is, the main one
+     */
+
+    if (!ngx_pool_cache_thread_set) {
+        ngx_pool_cache_thread = pthread_self();
+        ngx_pool_cache_thread_set = 1;
+    }
+
+    return pthread_equal(pthread_self(), ngx_pool_cache_thread);
+}
+
+#else
+
+#define ngx_pool_cache_thread_check()  1
+
+#endif
+
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_pool_get_cached(size_t size)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+#if !(NGX_DEBUG_PALLOC)
+    ngx_uint_t              i;
+    ngx_pool_cached_t      *block;
+    ngx_pool_cache_slot_t  *slot;
 
-    if (ngx_cycle->cache == NULL) {
+    if (size > NGX_POOL_CACHE_MAX_SIZE || !ngx_pool_cache_thread_check()) {
         return NULL;
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &ngx_pool_cache[i];
 
-    slot->tries++;
+        if (slot->size != size) {
+            continue;
+        }
+
+        block = slot->block;
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
+        if (block == NULL) {
+            return NULL;
+        }
+
+        slot->block = block->next;
         slot->number--;
-        return p;
+
+        return block;
     }
 
+#endif
+
     return NULL;
 }
 
+
+static void
+ngx_pool_free_block(void *p, size_t size)
+{
+#if !(NGX_DEBUG_PALLOC)
+    ngx_uint_t              i;
+    ngx_pool_cached_t      *block;
+    ngx_pool_cache_slot_t  *slot, *empty;
+
+    /* blocks of the cache may be reused for any allocation, so aligned */
+
+    if (size > NGX_POOL_CACHE_MAX_SIZE
+        || size < sizeof(ngx_pool_cached_t)
+        || ((uintptr_t) p & (NGX_POOL_ALIGNMENT - 1))
+        || !ngx_pool_cache_thread_check())
+    {
+        goto free;
+    }
+
+    empty = NULL;
+
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &ngx_pool_cache[i];
+
+        if (slot->size == size) {
+            goto found;
+        }
+
+        if (empty == NULL && slot->number == 0) {
+            empty = slot;
+        }
+    }
+
+    if (empty == NULL) {
+        goto free;
+    }
+
+    slot = empty;
+    slot->size = size;
+
+found:
+
+    if ((slot->number + 1) * size > NGX_POOL_CACHE_SLOT_SIZE) {
+        goto free;
+    }
+
+    block = p;
+    block->next = slot->block;
+    slot->block = block;
+    slot->number++;
+
+    return;
+
+free:
+
 #endif
+
+    ngx_free(p);
+}
@@ -26,6 +26,9 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/* freed blocks up to this size are kept for reuse */
+#define NGX_POOL_CACHE_MAX_SIZE  (64 * 1024)
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,6 +46,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;
 };
 
 
@@ -72,6 +76,16 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+typedef struct {
+    size_t                size;
+    size_t                used;
+    ngx_uint_t            blocks;
+
+    size_t                large_size;
+    ngx_uint_t            large;
+} ngx_pool_stat_t;
+
+
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 void ngx_reset_pool(ngx_pool_t *pool);
@@ -82,6 +96,8 @@ void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
 
+void ngx_pool_stat(ngx_pool_t *pool, ngx_pool_stat_t *stat);
+
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
 void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);
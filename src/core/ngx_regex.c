@@ -20,6 +20,20 @@ static void ngx_libc_cdecl ngx_regex_free(void *p);
 static void ngx_pcre_free_studies(void *data);
 #endif
 
+static ngx_int_t ngx_regex_literal(ngx_regex_compile_t *rc);
+static u_char *ngx_regex_skip_escape(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_class(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_group(u_char *p, u_char *last);
+static u_char *ngx_regex_skip_quantifier(u_char *p, u_char *last,
+    ngx_uint_t *min);
+static ngx_regex_prefilter_t *ngx_regex_prefilter_create(ngx_pool_t *pool,
+    ngx_uint_t n);
+static ngx_int_t ngx_regex_prefilter_add(ngx_regex_prefilter_t *pf,
+    ngx_regex_t *re);
+static ngx_int_t ngx_regex_prefilter_compile(ngx_regex_prefilter_t *pf);
+static uint32_t ngx_regex_prefilter_goto(ngx_regex_prefilter_node_t *nodes,
+    uint32_t state, u_char ch);
+
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
@@ -132,6 +146,10 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
 
     rc->regex->code = re;
 
+    if (ngx_regex_literal(rc) != NGX_OK) {
+        goto nomem;
+    }
+
     /* do not study at runtime */
 
     if (ngx_pcre_studies != NULL) {
@@ -227,6 +245,683 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+/*
+ * the longest literal which must be present in any matching string
+ * is used to prefilter regular expressions; patterns are parsed
+ * conservatively, any construct which is not understood ends a literal,
+ * and alternatives at the top level disable the literal
+ */
+
+#define NGX_REGEX_LITERAL_MIN   3
+#define NGX_REGEX_PREFILTER_MIN 4
+
+
+static ngx_int_t
+ngx_regex_literal(ngx_regex_compile_t *rc)
+{
+    u_char      c, *p, *last, *run, *best;
+    size_t      len, best_len;
+    ngx_uint_t  literal, min;
+
+    if (rc->options & ~NGX_REGEX_CASELESS) {
+        return NGX_OK;
+    }
+
+    p = rc->pattern.data;
+    last = p + rc->pattern.len;
+
+    run = ngx_pnalloc(rc->pool, rc->pattern.len);
+    if (run == NULL) {
+        return NGX_ERROR;
+    }
+
+    len = 0;
+    best = NULL;
+    best_len = 0;
+    literal = 0;
+
+    while (p < last) {
+        c = *p;
+
+        switch (c) {
+
+        case '\\':
+
+            if (p + 1 < last && p[1] < 0x80 && !isalnum(p[1])) {
+
+                /* an escaped character */
+
+                c = p[1];
+                p += 2;
+                break;
+            }
+
+            p = ngx_regex_skip_escape(p, last);
+            goto end;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            goto end;
+
+        case '(':
+            p = ngx_regex_skip_group(p, last);
+            goto end;
+
+        case '.':
+        case '^':
+        case '$':
+            p++;
+            goto end;
+
+        case '?':
+        case '*':
+        case '+':
+
+            /* the last character is optional, or may be repeated */
+
+            if (literal && c != '+') {
+                len--;
+            }
+
+            p = ngx_regex_skip_quantifier(p, last, &min);
+            goto end;
+
+        case '{':
+            if (ngx_regex_skip_quantifier(p, last, &min) == p) {
+                p++;
+                break;
+            }
+
+            if (literal && min == 0) {
+                len--;
+            }
+
+            p = ngx_regex_skip_quantifier(p, last, &min);
+            goto end;
+
+        case ')':
+        case '|':
+            return NGX_OK;
+
+        default:
+            p++;
+
+            if (c >= 0x80) {
+                goto end;
+            }
+
+            break;
+        }
+
+        /* a literal character */
+
+        run[len++] = ngx_tolower(c);
+        literal = 1;
+
+        continue;
+
+    end:
+
+        if (p == NULL) {
+            return NGX_OK;
+        }
+
+        if (len > best_len) {
+            best = run;
+            best_len = len;
+        }
+
+        run += len;
+        len = 0;
+        literal = 0;
+    }
+
+    if (len > best_len) {
+        best = run;
+        best_len = len;
+    }
+
+    if (best_len >= NGX_REGEX_LITERAL_MIN) {
+        rc->regex->literal.len = best_len;
+        rc->regex->literal.data = best;
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_regex_skip_escape(u_char *p, u_char *last)
+{
+    u_char  c, close;
+
+    /* p points to a backslash followed by a letter or a digit */
+
+    if (p + 1 == last) {
+        return NULL;
+    }
+
+    c = p[1];
+    p += 2;
+
+    switch (c) {
+
+    case 'Q':
+
+        /* quoted characters are not used */
+
+        while (p + 1 < last) {
+            if (p[0] == '\\' && p[1] == 'E') {
+                return p + 2;
+            }
+
+            p++;
+        }
+
+        return last;
+
+    case 'c':
+        return (p < last) ? p + 1 : NULL;
+
+    case 'x':
+    case 'o':
+    case 'p':
+    case 'P':
+    case 'N':
+    case 'k':
+    case 'g':
+        break;
+
+    default:
+
+        if (c >= '0' && c <= '9') {
+            while (p < last && *p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+
+        return p;
+    }
+
+    if (p == last) {
+        return p;
+    }
+
+    switch (*p) {
+    case '{':
+        close = '}';
+        break;
+    case '<':
+        close = '>';
+        break;
+    case '\'':
+        close = '\'';
+        break;
+    default:
+
+        /* \xhh, \pL, \g1 */
+
+        while (p < last && isalnum(*p)) {
+            p++;
+        }
+
+        return p;
+    }
+
+    p = ngx_strlchr(p, last, close);
+
+    return p ? p + 1 : NULL;
+}
+
+
+static u_char *
+ngx_regex_skip_class(u_char *p, u_char *last)
+{
+    p++;
+
+    if (p < last && *p == '^') {
+        p++;
+    }
+
+    if (p < last && *p == ']') {
+        p++;
+    }
+
+    while (p < last) {
+
+        if (*p == '\\') {
+            p += 2;
+            continue;
+        }
+
+        if (*p == '[' && p + 1 < last && p[1] == ':') {
+
+            /* [:alpha:] */
+
+            p = ngx_strlchr(p + 2, last, ']');
+            if (p == NULL) {
+                return NULL;
+            }
+
+            p++;
+            continue;
+        }
+
+        if (*p == ']') {
+            return p + 1;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static u_char *
+ngx_regex_skip_group(u_char *p, u_char *last)
+{
+    u_char      *q;
+    ngx_uint_t   depth;
+
+    depth = 0;
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '\\':
+            if (p + 1 < last && p[1] == 'Q') {
+                p = ngx_regex_skip_escape(p, last);
+
+            } else {
+                p += 2;
+            }
+
+            continue;
+
+        case '[':
+            p = ngx_regex_skip_class(p, last);
+            if (p == NULL) {
+                return NULL;
+            }
+
+            continue;
+
+        case '(':
+
+            if (p + 1 < last && (p[1] == '*' || p[1] == '?')) {
+
+                /* verbs, comments, and extended mode are not parsed */
+
+                if (p[1] == '*' || (p + 2 < last && p[2] == '#')) {
+                    return NULL;
+                }
+
+                for (q = p + 2; q < last && (isalpha(*q) || *q == '-'); q++) {
+                    if (*q == 'x') {
+                        return NULL;
+                    }
+                }
+            }
+
+            depth++;
+            break;
+
+        case ')':
+            if (--depth == 0) {
+                return p + 1;
+            }
+
+            break;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static u_char *
+ngx_regex_skip_quantifier(u_char *p, u_char *last, ngx_uint_t *min)
+{
+    u_char  *q;
+
+    /* returns p if there is no quantifier */
+
+    *min = 1;
+
+    if (*p == '?' || *p == '*') {
+        *min = 0;
+        q = p + 1;
+
+    } else if (*p == '+') {
+        q = p + 1;
+
+    } else {
+
+        /* {n}, {n,}, {n,m} */
+
+        q = p + 1;
+        *min = 0;
+
+        if (q == last || *q < '0' || *q > '9') {
+            return p;
+        }
+
+        while (q < last && *q >= '0' && *q <= '9') {
+            *min = *min * 10 + (*q++ - '0');
+
+            if (*min > 65535) {
+                return p;
+            }
+        }
+
+        if (q < last && *q == ',') {
+            q++;
+
+            while (q < last && *q >= '0' && *q <= '9') {
+                q++;
+            }
+        }
+
+        if (q == last || *q != '}') {
+            return p;
+        }
+
+        q++;
+    }
+
+    /* lazy and possessive quantifiers */
+
+    if (q < last && (*q == '?' || *q == '+')) {
+        q++;
+    }
+
+    return q;
+}
+
+
+/*
+ * the prefilter is an Aho-Corasick automaton of the literals of
+ * regular expressions, one pass over a string marks the expressions
+ * which may match, others are not executed
+ */
+
+ngx_int_t
+ngx_regex_prefilter_init(ngx_pool_t *pool, ngx_regex_t **regex, ngx_uint_t n,
+    ngx_regex_prefilter_t **prefilter)
+{
+    ngx_int_t               rc;
+    ngx_uint_t              i;
+    ngx_regex_prefilter_t  *pf;
+
+    *prefilter = NULL;
+
+    pf = ngx_regex_prefilter_create(pool, n);
+    if (pf == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ngx_regex_prefilter_add(pf, regex[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    rc = ngx_regex_prefilter_compile(pf);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        *prefilter = pf;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_regex_prefilter_t *
+ngx_regex_prefilter_create(ngx_pool_t *pool, ngx_uint_t n)
+{
+    ngx_regex_prefilter_t         *pf;
+    ngx_regex_prefilter_node_t    *node;
+    ngx_regex_prefilter_output_t  *out;
+
+    pf = ngx_pcalloc(pool, sizeof(ngx_regex_prefilter_t));
+    if (pf == NULL) {
+        return NULL;
+    }
+
+    pf->pool = pool;
+    pf->size = (n + 7) / 8;
+
+    pf->always = ngx_pcalloc(pool, pf->size);
+    if (pf->always == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&pf->nodes, pool, 64,
+                       sizeof(ngx_regex_prefilter_node_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&pf->outputs, pool, n + 1,
+                       sizeof(ngx_regex_prefilter_output_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    /* the root node and an empty output */
+
+    node = ngx_array_push(&pf->nodes);
+    out = ngx_array_push(&pf->outputs);
+
+    ngx_memzero(node, sizeof(ngx_regex_prefilter_node_t));
+    ngx_memzero(out, sizeof(ngx_regex_prefilter_output_t));
+
+    return pf;
+}
+
+
+static ngx_int_t
+ngx_regex_prefilter_add(ngx_regex_prefilter_t *pf, ngx_regex_t *re)
+{
+    u_char                        *p, *last;
+    uint32_t                       state, next;
+    ngx_uint_t                     i;
+    ngx_regex_prefilter_node_t    *node;
+    ngx_regex_prefilter_output_t  *out;
+
+    i = pf->n++;
+
+    if (re->literal.len == 0) {
+        pf->always[i >> 3] |= 1 << (i & 7);
+        return NGX_OK;
+    }
+
+    state = 0;
+
+    p = re->literal.data;
+    last = p + re->literal.len;
+
+    for ( /* void */ ; p < last; p++) {
+
+        if (state == 0) {
+            next = pf->root[*p];
+
+        } else {
+            next = ngx_regex_prefilter_goto(pf->nodes.elts, state, *p);
+        }
+
+        if (next == 0) {
+            node = ngx_array_push(&pf->nodes);
+            if (node == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memzero(node, sizeof(ngx_regex_prefilter_node_t));
+
+            node->ch = *p;
+            next = pf->nodes.nelts - 1;
+
+            if (state == 0) {
+                pf->root[*p] = next;
+
+            } else {
+                node->next = ((ngx_regex_prefilter_node_t *)
+                                 pf->nodes.elts)[state].child;
+                ((ngx_regex_prefilter_node_t *)
+                    pf->nodes.elts)[state].child = next;
+            }
+        }
+
+        state = next;
+    }
+
+    out = ngx_array_push(&pf->outputs);
+    if (out == NULL) {
+        return NGX_ERROR;
+    }
+
+    node = pf->nodes.elts;
+
+    out->index = i;
+    out->next = node[state].output;
+    node[state].output = pf->outputs.nelts - 1;
+
+    pf->nliterals++;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_regex_prefilter_compile(ngx_regex_prefilter_t *pf)
+{
+    uint32_t                    *queue, head, tail, u, v, f, t;
+    ngx_uint_t                   c;
+    ngx_regex_prefilter_node_t  *node;
+
+    if (pf->nliterals < NGX_REGEX_PREFILTER_MIN) {
+        return NGX_DECLINED;
+    }
+
+    queue = ngx_alloc(pf->nodes.nelts * sizeof(uint32_t), ngx_cycle->log);
+    if (queue == NULL) {
+        return NGX_ERROR;
+    }
+
+    node = pf->nodes.elts;
+
+    head = 0;
+    tail = 0;
+
+    for (c = 0; c < 256; c++) {
+        if (pf->root[c]) {
+            queue[tail++] = pf->root[c];
+        }
+    }
+
+    /* breadth-first, failure links point to shorter nodes */
+
+    while (head < tail) {
+        u = queue[head++];
+
+        for (v = node[u].child; v; v = node[v].next) {
+
+            for (f = node[u].fail; /* void */; f = node[f].fail) {
+
+                t = (f == 0) ? pf->root[node[v].ch]
+                             : ngx_regex_prefilter_goto(node, f, node[v].ch);
+
+                if (t || f == 0) {
+                    break;
+                }
+            }
+
+            node[v].fail = t;
+            node[v].dict = node[t].output ? t : node[t].dict;
+
+            queue[tail++] = v;
+        }
+    }
+
+    ngx_free(queue);
+
+    return NGX_OK;
+}
+
+
+void
+ngx_regex_prefilter_exec(ngx_regex_prefilter_t *pf, ngx_str_t *s,
+    u_char *candidates)
+{
+    u_char                        *p, *last, ch;
+    uint32_t                       state, next, o, i;
+    ngx_regex_prefilter_node_t    *node;
+    ngx_regex_prefilter_output_t  *out;
+
+    ngx_memcpy(candidates, pf->always, pf->size);
+
+    node = pf->nodes.elts;
+    out = pf->outputs.elts;
+
+    state = 0;
+    next = 0;
+
+    p = s->data;
+    last = p + s->len;
+
+    for ( /* void */ ; p < last; p++) {
+        ch = ngx_tolower(*p);
+
+        while (state) {
+            next = ngx_regex_prefilter_goto(node, state, ch);
+
+            if (next) {
+                break;
+            }
+
+            state = node[state].fail;
+        }
+
+        state = state ? next : pf->root[ch];
+
+        for (o = node[state].output ? state : node[state].dict;
+             o;
+             o = node[o].dict)
+        {
+            for (i = node[o].output; i; i = out[i].next) {
+                candidates[out[i].index >> 3] |= 1 << (out[i].index & 7);
+            }
+        }
+    }
+}
+
+
+static uint32_t
+ngx_regex_prefilter_goto(ngx_regex_prefilter_node_t *nodes, uint32_t state,
+    u_char ch)
+{
+    uint32_t  v;
+
+    for (v = nodes[state].child; v; v = nodes[v].next) {
+        if (nodes[v].ch == ch) {
+            return v;
+        }
+    }
+
+    return 0;
+}
+
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
@@ -23,6 +23,9 @@
 typedef struct {
     pcre        *code;
     pcre_extra  *extra;
+
+    /* a lowercased substring of any matching string */
+    ngx_str_t    literal;
 } ngx_regex_t;
 
 
@@ -46,6 +49,37 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+typedef struct {
+    uint32_t      child;
+    uint32_t      next;
+    uint32_t      fail;
+    uint32_t      output;
+    uint32_t      dict;
+    u_char        ch;
+} ngx_regex_prefilter_node_t;
+
+
+typedef struct {
+    uint32_t      index;
+    uint32_t      next;
+} ngx_regex_prefilter_output_t;
+
+
+typedef struct {
+    ngx_pool_t   *pool;
+    ngx_uint_t    n;
+    ngx_uint_t    nliterals;
+    size_t        size;
+
+    /* patterns without literals */
+    u_char       *always;
+
+    ngx_array_t   nodes;
+    ngx_array_t   outputs;
+    uint32_t      root[256];
+} ngx_regex_prefilter_t;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
@@ -56,5 +90,16 @@ ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+ngx_int_t ngx_regex_prefilter_init(ngx_pool_t *pool, ngx_regex_t **regex,
+    ngx_uint_t n, ngx_regex_prefilter_t **prefilter);
+void ngx_regex_prefilter_exec(ngx_regex_prefilter_t *pf, ngx_str_t *s,
+    u_char *candidates);
+
+/* candidates of up to 128 patterns are kept on stack */
+#define NGX_REGEX_PREFILTER_STACK  16
+
+#define ngx_regex_prefilter_candidate(candidates, i)                         \
+    ((candidates)[(i) >> 3] & (1 << ((i) & 7)))
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
@@ -51,6 +51,35 @@ typedef struct {
 } ngx_resolver_an_t;
 
 
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+} ngx_resolver_shctx_t;
+
+
+typedef struct {
+    ngx_resolver_shctx_t     *sh;
+    ngx_slab_pool_t          *shpool;
+#if (NGX_HAVE_INET6)
+    ngx_int_t                 ipv6;
+#endif
+} ngx_resolver_cache_t;
+
+
+typedef struct {
+    ngx_str_node_t            sn;
+    ngx_queue_t               queue;
+    time_t                    valid;
+    time_t                    updating;
+    u_short                   naddrs;
+    u_short                   naddrs6;
+    u_char                    code;
+    /* addresses and name */
+    u_char                    data[1];
+} ngx_resolver_cache_node_t;
+
+
 #define ngx_resolver_node(n)                                                 \
     (ngx_resolver_node_t *)                                                  \
         ((u_char *) (n) - offsetof(ngx_resolver_node_t, node))
@@ -62,6 +91,8 @@ static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
 
 static void ngx_resolver_cleanup(void *data);
 static void ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree);
+static ngx_int_t ngx_resolver_init_cache(ngx_shm_zone_t *shm_zone,
+    void *data);
 static ngx_int_t ngx_resolve_name_locked(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx, ngx_str_t *name);
 static void ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree,
@@ -109,6 +140,8 @@ static ngx_int_t ngx_resolver_set_timeout(ngx_resolver_t *r,
     ngx_resolver_ctx_t *ctx);
 static void ngx_resolver_timeout_handler(ngx_event_t *ev);
 static void ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn);
+static void ngx_resolver_free_node_data(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
 static void *ngx_resolver_alloc(ngx_resolver_t *r, size_t size);
 static void *ngx_resolver_calloc(ngx_resolver_t *r, size_t size);
 static void ngx_resolver_free(ngx_resolver_t *r, void *p);
@@ -116,6 +149,22 @@ static void ngx_resolver_free_locked(ngx_resolver_t *r, void *p);
 static void *ngx_resolver_dup(ngx_resolver_t *r, void *src, size_t size);
 static ngx_resolver_addr_t *ngx_resolver_export(ngx_resolver_t *r,
     ngx_resolver_node_t *rn, ngx_uint_t rotate);
+static void ngx_resolver_free_stale(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_int_t ngx_resolver_serve_stale(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *ctx, ngx_resolver_node_t *rn);
+static ngx_int_t ngx_resolver_refresh(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_uint_t prefetch);
+static ngx_int_t ngx_resolver_cache_lookup(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn, ngx_uint_t prefetch);
+static ngx_int_t ngx_resolver_cache_copy(ngx_resolver_t *r,
+    ngx_resolver_cache_node_t *cn, ngx_resolver_node_t *rn);
+static void ngx_resolver_cache_update(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_resolver_cache_node_t *ngx_resolver_cache_alloc(
+    ngx_resolver_cache_t *cache, size_t size);
+static void ngx_resolver_cache_free(ngx_resolver_cache_t *cache,
+    ngx_resolver_cache_node_t *cn);
 static void ngx_resolver_report_srv(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx);
 static u_char *ngx_resolver_log_error(ngx_log_t *log, u_char *buf, size_t len);
 static void ngx_resolver_resolve_srv_names(ngx_resolver_ctx_t *ctx,
@@ -134,10 +183,13 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t                   s;
+    u_char                     *p;
+    ssize_t                     zsize;
+    ngx_str_t                   s, size;
     ngx_url_t                   u;
     ngx_uint_t                  i, j;
     ngx_resolver_t             *r;
+    ngx_resolver_cache_t       *cache;
     ngx_pool_cleanup_t         *cln;
     ngx_resolver_connection_t  *rec;
 
@@ -226,6 +278,106 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "negative_valid=", 15) == 0) {
+            s.len = names[i].len - 15;
+            s.data = names[i].data + 15;
+
+            r->negative_valid = ngx_parse_time(&s, 1);
+
+            if (r->negative_valid == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "prefetch=", 9) == 0) {
+            s.len = names[i].len - 9;
+            s.data = names[i].data + 9;
+
+            r->prefetch = ngx_parse_time(&s, 1);
+
+            if (r->prefetch == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "stale=", 6) == 0) {
+            s.len = names[i].len - 6;
+            s.data = names[i].data + 6;
+
+            r->stale = ngx_parse_time(&s, 1);
+
+            if (r->stale == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "zone=", 5) == 0) {
+            s.data = names[i].data + 5;
+
+            p = (u_char *) ngx_strchr(s.data, ':');
+
+            if (p == NULL || p == s.data) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            s.len = p - s.data;
+
+            size.data = p + 1;
+            size.len = names[i].data + names[i].len - size.data;
+
+            zsize = ngx_parse_size(&size);
+
+            if (zsize == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &size);
+                return NULL;
+            }
+
+            if (zsize < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &s);
+                return NULL;
+            }
+
+            r->shm_zone = ngx_shared_memory_add(cf, &s, zsize,
+                                                &ngx_core_module);
+            if (r->shm_zone == NULL) {
+                return NULL;
+            }
+
+            /* a zone can be shared by several resolvers */
+
+            if (r->shm_zone->data == NULL) {
+                cache = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_cache_t));
+                if (cache == NULL) {
+                    return NULL;
+                }
+
+#if (NGX_HAVE_INET6)
+                cache->ipv6 = NGX_CONF_UNSET;
+#endif
+
+                r->shm_zone->init = ngx_resolver_init_cache;
+                r->shm_zone->data = cache;
+            }
+
+            continue;
+        }
+
 #if (NGX_HAVE_INET6)
         if (ngx_strncmp(names[i].data, "ipv6=", 5) == 0) {
 
@@ -280,10 +432,84 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
         return NULL;
     }
 
+#if (NGX_HAVE_INET6)
+
+    /* shared answers include IPv6 addresses only if they were requested */
+
+    if (r->shm_zone) {
+        cache = r->shm_zone->data;
+
+        if (cache->ipv6 == NGX_CONF_UNSET) {
+            cache->ipv6 = r->ipv6;
+
+        } else if ((ngx_uint_t) cache->ipv6 != r->ipv6) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "resolver zone \"%V\" is already used "
+                               "with another \"ipv6\" value",
+                               &r->shm_zone->shm.name);
+            return NULL;
+        }
+    }
+
+#endif
+
     return r;
 }
 
 
+static ngx_int_t
+ngx_resolver_init_cache(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_resolver_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_resolver_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in resolver zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in resolver zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the least recently used names are evicted when the zone is full */
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_resolver_cleanup(void *data)
 {
@@ -584,7 +810,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     uint32_t              hash;
     ngx_int_t             rc;
     ngx_str_t             cname;
-    ngx_uint_t            i, naddrs;
+    ngx_uint_t            naddrs;
     ngx_queue_t          *resend_queue, *expire_queue;
     ngx_rbtree_t         *tree;
     ngx_resolver_ctx_t   *next, *last;
@@ -615,6 +841,14 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         /* ctx can be a list after NGX_RESOLVE_CNAME */
         for (last = ctx; last->next; last = last->next);
 
+        if (rn->valid < ngx_time() && ctx->service.len == 0) {
+            rc = ngx_resolver_serve_stale(r, ctx, rn);
+
+            if (rc != NGX_DECLINED) {
+                return rc;
+            }
+        }
+
         if (rn->valid >= ngx_time()) {
 
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
@@ -676,6 +910,13 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
                     ngx_resolver_free(r, addrs);
                 }
 
+                if (r->prefetch
+                    && tree == &r->name_rbtree
+                    && rn->valid - ngx_time() < r->prefetch)
+                {
+                    (void) ngx_resolver_refresh(r, rn, 1);
+                }
+
                 return NGX_OK;
             }
 
@@ -696,6 +937,28 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
                 return NGX_OK;
             }
 
+            if (rn->cnlen == 0) {
+
+                /* negative answer */
+
+                last->next = rn->waiting;
+                rn->waiting = NULL;
+
+                /* unlock name mutex */
+
+                do {
+                    ctx->state = rn->code ? rn->code : NGX_RESOLVE_NXDOMAIN;
+                    ctx->valid = rn->valid;
+                    next = ctx->next;
+
+                    ctx->handler(ctx);
+
+                    ctx = next;
+                } while (ctx);
+
+                return NGX_OK;
+            }
+
             /* NGX_RESOLVE_CNAME */
 
             if (ctx->recursion++ < NGX_RESOLVER_MAX_RECURSION) {
@@ -724,7 +987,9 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
             return NGX_OK;
         }
 
-        if (rn->waiting) {
+        /* a node with stale addresses is being resolved */
+
+        if (rn->waiting || rn->stale) {
             if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
                 return NGX_ERROR;
             }
@@ -744,41 +1009,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 
         ngx_queue_remove(&rn->queue);
 
-        /* lock alloc mutex */
-
-        if (rn->query) {
-            ngx_resolver_free_locked(r, rn->query);
-            rn->query = NULL;
-#if (NGX_HAVE_INET6)
-            rn->query6 = NULL;
-#endif
-        }
-
-        if (rn->cnlen) {
-            ngx_resolver_free_locked(r, rn->u.cname);
-        }
-
-        if (rn->naddrs > 1 && rn->naddrs != (u_short) -1) {
-            ngx_resolver_free_locked(r, rn->u.addrs);
-        }
-
-#if (NGX_HAVE_INET6)
-        if (rn->naddrs6 > 1 && rn->naddrs6 != (u_short) -1) {
-            ngx_resolver_free_locked(r, rn->u6.addrs6);
-        }
-#endif
-
-        if (rn->nsrvs) {
-            for (i = 0; i < (ngx_uint_t) rn->nsrvs; i++) {
-                if (rn->u.srvs[i].name.data) {
-                    ngx_resolver_free_locked(r, rn->u.srvs[i].name.data);
-                }
-            }
-
-            ngx_resolver_free_locked(r, rn->u.srvs);
-        }
-
-        /* unlock alloc mutex */
+        ngx_resolver_free_node_data(r, rn);
 
     } else {
 
@@ -798,11 +1029,32 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         rn->query = NULL;
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
+        rn->naddrs6 = 0;
 #endif
+        rn->naddrs = 0;
+        rn->nsrvs = 0;
+        rn->cnlen = 0;
+        rn->waiting = NULL;
+        rn->stale = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
 
+    if (r->shm_zone && ctx->service.len == 0) {
+        rc = ngx_resolver_cache_lookup(r, rn, 0);
+
+        if (rc == NGX_OK) {
+
+            /* resolved by another worker */
+
+            rn->expire = ngx_time() + r->expire;
+
+            ngx_queue_insert_head(expire_queue, &rn->queue);
+
+            return ngx_resolve_name_locked(r, ctx, name);
+        }
+    }
+
     if (ctx->service.len) {
         rc = ngx_resolver_create_srv_query(r, rn, name);
 
@@ -1037,6 +1289,7 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->stale = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
@@ -1514,7 +1767,9 @@ ngx_resolver_resend(ngx_resolver_t *r, ngx_rbtree_t *tree, ngx_queue_t *queue)
 
         ngx_queue_remove(q);
 
-        if (rn->waiting) {
+        if (rn->waiting
+            || (rn->stale && rn->stale_valid + r->stale >= now))
+        {
 
             if (++rn->last_connection == r->connections.nelts) {
                 rn->last_connection = 0;
@@ -1975,7 +2230,7 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_remove(&rn->queue);
 
-        if (rn->waiting == NULL) {
+        if (rn->waiting == NULL && rn->stale == NULL) {
             ngx_rbtree_delete(&r->name_rbtree, &rn->node);
             ngx_resolver_free_node(r, rn);
             goto next;
@@ -2082,8 +2337,38 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_remove(&rn->queue);
 
+        if (r->negative_valid
+            && (code == NGX_RESOLVE_NXDOMAIN || code == NGX_RESOLVE_SERVFAIL))
+        {
+            ngx_resolver_free_node_data(r, rn);
+            ngx_resolver_free_stale(r, rn);
+
+            rn->code = (u_char) code;
+            rn->valid = ngx_time() + r->negative_valid;
+            rn->expire = ngx_time() + r->expire;
+
+            ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+            ngx_resolver_cache_update(r, rn);
+
+            /* unlock name mutex */
+
+            while (next) {
+                ctx = next;
+                ctx->state = code;
+                ctx->valid = rn->valid;
+                next = ctx->next;
+
+                ctx->handler(ctx);
+            }
+
+            return;
+        }
+
         ngx_rbtree_delete(&r->name_rbtree, &rn->node);
 
+        ngx_resolver_cache_update(r, rn);
+
         /* unlock name mutex */
 
         while (next) {
@@ -2396,6 +2681,9 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        ngx_resolver_free_stale(r, rn);
+        ngx_resolver_cache_update(r, rn);
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -2468,6 +2756,9 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        ngx_resolver_free_stale(r, rn);
+        ngx_resolver_cache_update(r, rn);
+
         ngx_resolver_free(r, rn->query);
         rn->query = NULL;
 #if (NGX_HAVE_INET6)
@@ -4050,6 +4341,24 @@ ngx_resolver_timeout_handler(ngx_event_t *ev)
 
 static void
 ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_resolver_free_node_data(r, rn);
+    ngx_resolver_free_stale(r, rn);
+
+    /* lock alloc mutex */
+
+    if (rn->name) {
+        ngx_resolver_free_locked(r, rn->name);
+    }
+
+    ngx_resolver_free_locked(r, rn);
+
+    /* unlock alloc mutex */
+}
+
+
+static void
+ngx_resolver_free_node_data(ngx_resolver_t *r, ngx_resolver_node_t *rn)
 {
     ngx_uint_t  i;
 
@@ -4057,24 +4366,29 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
 
     if (rn->query) {
         ngx_resolver_free_locked(r, rn->query);
-    }
-
-    if (rn->name) {
-        ngx_resolver_free_locked(r, rn->name);
+        rn->query = NULL;
+#if (NGX_HAVE_INET6)
+        rn->query6 = NULL;
+#endif
     }
 
     if (rn->cnlen) {
         ngx_resolver_free_locked(r, rn->u.cname);
+        rn->cnlen = 0;
     }
 
     if (rn->naddrs > 1 && rn->naddrs != (u_short) -1) {
         ngx_resolver_free_locked(r, rn->u.addrs);
     }
 
+    rn->naddrs = 0;
+
 #if (NGX_HAVE_INET6)
     if (rn->naddrs6 > 1 && rn->naddrs6 != (u_short) -1) {
         ngx_resolver_free_locked(r, rn->u6.addrs6);
     }
+
+    rn->naddrs6 = 0;
 #endif
 
     if (rn->nsrvs) {
@@ -4085,14 +4399,486 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
         }
 
         ngx_resolver_free_locked(r, rn->u.srvs);
+        rn->nsrvs = 0;
     }
 
-    ngx_resolver_free_locked(r, rn);
-
     /* unlock alloc mutex */
 }
 
 
+static void
+ngx_resolver_free_stale(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    if (rn->stale) {
+        ngx_resolver_free(r, rn->stale->sockaddr);
+        ngx_resolver_free(r, rn->stale);
+        rn->stale = NULL;
+    }
+}
+
+
+static ngx_int_t
+ngx_resolver_serve_stale(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
+    ngx_resolver_node_t *rn)
+{
+    time_t               now;
+    ngx_uint_t           naddrs;
+    ngx_resolver_ctx_t  *next;
+
+    now = ngx_time();
+
+    if (rn->stale == NULL) {
+
+        naddrs = (rn->naddrs == (u_short) -1) ? 0 : rn->naddrs;
+#if (NGX_HAVE_INET6)
+        naddrs += (rn->naddrs6 == (u_short) -1) ? 0 : rn->naddrs6;
+#endif
+
+        if (naddrs == 0 || rn->waiting || rn->valid + r->stale < now) {
+            return NGX_DECLINED;
+        }
+
+        /*
+         * NGX_OK means that the node was updated from the shared cache
+         * and can be used as is
+         */
+
+        if (ngx_resolver_refresh(r, rn, 0) != NGX_AGAIN) {
+            return NGX_DECLINED;
+        }
+
+    } else if (rn->stale_valid + r->stale < now) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve stale");
+
+    /* unlock name mutex */
+
+    do {
+        ctx->state = NGX_OK;
+        ctx->valid = ngx_max(rn->stale_valid, now);
+        ctx->naddrs = rn->nstale;
+
+        /* the handlers copy the addresses */
+        ctx->addrs = rn->stale;
+
+        next = ctx->next;
+
+        ctx->handler(ctx);
+
+        ctx = next;
+    } while (ctx);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_resolver_refresh(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_uint_t prefetch)
+{
+    ngx_int_t   rc;
+    ngx_str_t   name;
+    ngx_uint_t  naddrs;
+
+    if (r->shm_zone) {
+        rc = ngx_resolver_cache_lookup(r, rn, prefetch);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+    /* the addresses are kept to answer while the name is resolved again */
+
+    naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+    naddrs += rn->naddrs6;
+#endif
+
+    rn->stale = ngx_resolver_export(r, rn, 0);
+    if (rn->stale == NULL) {
+        return NGX_ERROR;
+    }
+
+    rn->nstale = naddrs;
+    rn->stale_valid = rn->valid;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolver refresh \"%*s\" %T",
+                   (size_t) rn->nlen, rn->name, rn->valid - ngx_time());
+
+    ngx_queue_remove(&rn->queue);
+
+    ngx_resolver_free_node_data(r, rn);
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    if (ngx_resolver_create_name_query(r, rn, &name) != NGX_OK) {
+        goto failed;
+    }
+
+    rn->last_connection = r->last_connection++;
+    if (r->last_connection == r->connections.nelts) {
+        r->last_connection = 0;
+    }
+
+    rn->naddrs = (u_short) -1;
+    rn->tcp = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = r->ipv6 ? (u_short) -1 : 0;
+    rn->tcp6 = 0;
+#endif
+
+    if (ngx_resolver_send_query(r, rn) != NGX_OK) {
+
+        /* immediately retry once on failure */
+
+        rn->last_connection++;
+        if (rn->last_connection == r->connections.nelts) {
+            rn->last_connection = 0;
+        }
+
+        (void) ngx_resolver_send_query(r, rn);
+    }
+
+    if (ngx_resolver_resend_empty(r)) {
+        ngx_add_timer(r->event, (ngx_msec_t) (r->resend_timeout * 1000));
+    }
+
+    rn->expire = ngx_time() + r->resend_timeout;
+
+    ngx_queue_insert_head(&r->name_resend_queue, &rn->queue);
+
+    rn->code = 0;
+    rn->valid = 0;
+    rn->ttl = NGX_MAX_UINT32_VALUE;
+    rn->waiting = NULL;
+
+    return NGX_AGAIN;
+
+failed:
+
+    /* the node is resolved again on the next request */
+
+    ngx_resolver_free_stale(r, rn);
+
+    rn->valid = 0;
+    rn->expire = ngx_time() + r->expire;
+
+    ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_resolver_cache_lookup(ngx_resolver_t *r, ngx_resolver_node_t *rn,
+    ngx_uint_t prefetch)
+{
+    time_t                      now;
+    ngx_int_t                   rc;
+    ngx_str_t                   name;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+
+    cache = r->shm_zone->data;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, &name, rn->node.key);
+
+    if (cn) {
+        ngx_queue_remove(&cn->queue);
+        ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+        if (prefetch ? cn->valid > rn->valid : cn->valid >= now) {
+            rc = ngx_resolver_cache_copy(r, cn, rn);
+
+            if (rc == NGX_OK) {
+                goto done;
+            }
+        }
+
+        if (cn->updating && now - cn->updating < r->resend_timeout) {
+
+            /*
+             * another worker is resolving the name: a prefetch is
+             * not needed as the name is still valid here, and an
+             * expired answer is used till the end of the second;
+             * without an answer to serve the name is resolved here
+             * as well to not delay requests
+             */
+
+            if (prefetch) {
+                rc = NGX_BUSY;
+                goto done;
+            }
+
+            if (cn->valid
+                && cn->valid + r->stale >= now
+                && ngx_resolver_cache_copy(r, cn, rn) == NGX_OK)
+            {
+                rn->valid = now;
+                rc = NGX_OK;
+                goto done;
+            }
+        }
+
+    } else {
+        cn = ngx_resolver_cache_alloc(cache,
+                                      offsetof(ngx_resolver_cache_node_t, data)
+                                      + name.len);
+        if (cn == NULL) {
+            rc = NGX_DECLINED;
+            goto done;
+        }
+
+        cn->sn.node.key = rn->node.key;
+        cn->sn.str.len = name.len;
+        cn->sn.str.data = cn->data;
+        ngx_memcpy(cn->data, name.data, name.len);
+
+        cn->valid = 0;
+        cn->naddrs = 0;
+        cn->naddrs6 = 0;
+        cn->code = 0;
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &cn->sn.node);
+        ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+    }
+
+    cn->updating = now;
+    rc = NGX_DECLINED;
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_resolver_cache_copy(ngx_resolver_t *r, ngx_resolver_cache_node_t *cn,
+    ngx_resolver_node_t *rn)
+{
+    u_char           *p;
+    in_addr_t        *addrs;
+    ngx_uint_t        naddrs, naddrs6;
+#if (NGX_HAVE_INET6)
+    struct in6_addr  *addrs6;
+#endif
+
+    /* IPv6 addresses are followed by IPv4 addresses */
+
+    naddrs = cn->naddrs;
+    naddrs6 = 0;
+
+#if (NGX_HAVE_INET6)
+    if (r->ipv6) {
+        naddrs6 = cn->naddrs6;
+    }
+#endif
+
+    if (naddrs + naddrs6 == 0 && cn->code == 0) {
+        return NGX_DECLINED;
+    }
+
+    p = cn->data + cn->naddrs6 * 16;
+
+    addrs = NULL;
+
+    if (naddrs > 1) {
+        addrs = ngx_resolver_alloc(r, naddrs * sizeof(in_addr_t));
+        if (addrs == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(addrs, p, naddrs * sizeof(in_addr_t));
+    }
+
+#if (NGX_HAVE_INET6)
+
+    addrs6 = NULL;
+
+    if (naddrs6 > 1) {
+        addrs6 = ngx_resolver_alloc(r, naddrs6 * sizeof(struct in6_addr));
+        if (addrs6 == NULL) {
+            if (addrs) {
+                ngx_resolver_free(r, addrs);
+            }
+
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(addrs6, cn->data, naddrs6 * sizeof(struct in6_addr));
+    }
+
+#endif
+
+    ngx_resolver_free_node_data(r, rn);
+
+    if (naddrs == 1) {
+        ngx_memcpy(&rn->u.addr, p, sizeof(in_addr_t));
+
+    } else if (naddrs > 1) {
+        rn->u.addrs = addrs;
+    }
+
+    rn->naddrs = (u_short) naddrs;
+
+#if (NGX_HAVE_INET6)
+
+    if (naddrs6 == 1) {
+        ngx_memcpy(&rn->u6.addr6, cn->data, sizeof(struct in6_addr));
+
+    } else if (naddrs6 > 1) {
+        rn->u6.addrs6 = addrs6;
+    }
+
+    rn->naddrs6 = (u_short) naddrs6;
+
+#endif
+
+    rn->code = cn->code;
+    rn->valid = cn->valid;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_resolver_cache_update(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    u_char                     *p;
+    size_t                      size;
+    ngx_str_t                   name;
+    ngx_uint_t                  naddrs, naddrs6;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+
+    if (r->shm_zone == NULL) {
+        return;
+    }
+
+    cache = r->shm_zone->data;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+    naddrs = (rn->naddrs == (u_short) -1) ? 0 : rn->naddrs;
+    naddrs6 = 0;
+#if (NGX_HAVE_INET6)
+    naddrs6 = (rn->naddrs6 == (u_short) -1) ? 0 : rn->naddrs6;
+#endif
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = (ngx_resolver_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, &name, rn->node.key);
+
+    /* only addresses and negative answers are shared */
+
+    if (rn->valid == 0 || rn->cnlen || (naddrs + naddrs6 == 0 && !rn->code)) {
+
+        if (cn) {
+            cn->updating = 0;
+        }
+
+        goto done;
+    }
+
+    if (cn) {
+        ngx_resolver_cache_free(cache, cn);
+    }
+
+    size = offsetof(ngx_resolver_cache_node_t, data)
+           + naddrs6 * 16 + naddrs * sizeof(in_addr_t) + name.len;
+
+    cn = ngx_resolver_cache_alloc(cache, size);
+    if (cn == NULL) {
+        goto done;
+    }
+
+    p = cn->data;
+
+#if (NGX_HAVE_INET6)
+    if (naddrs6 == 1) {
+        p = ngx_cpymem(p, &rn->u6.addr6, sizeof(struct in6_addr));
+
+    } else if (naddrs6 > 1) {
+        p = ngx_cpymem(p, rn->u6.addrs6, naddrs6 * sizeof(struct in6_addr));
+    }
+#endif
+
+    if (naddrs == 1) {
+        p = ngx_cpymem(p, &rn->u.addr, sizeof(in_addr_t));
+
+    } else if (naddrs > 1) {
+        p = ngx_cpymem(p, rn->u.addrs, naddrs * sizeof(in_addr_t));
+    }
+
+    ngx_memcpy(p, name.data, name.len);
+
+    cn->sn.node.key = rn->node.key;
+    cn->sn.str.len = name.len;
+    cn->sn.str.data = p;
+
+    cn->valid = rn->valid;
+    cn->updating = 0;
+    cn->naddrs = (u_short) naddrs;
+    cn->naddrs6 = (u_short) naddrs6;
+    cn->code = rn->code;
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->sn.node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+done:
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+static ngx_resolver_cache_node_t *
+ngx_resolver_cache_alloc(ngx_resolver_cache_t *cache, size_t size)
+{
+    ngx_queue_t                *q;
+    ngx_resolver_cache_node_t  *cn;
+
+    for ( ;; ) {
+        cn = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (cn || ngx_queue_empty(&cache->sh->queue)) {
+            return cn;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        ngx_resolver_cache_free(cache,
+                          ngx_queue_data(q, ngx_resolver_cache_node_t, queue));
+    }
+}
+
+
+static void
+ngx_resolver_cache_free(ngx_resolver_cache_t *cache,
+    ngx_resolver_cache_node_t *cn)
+{
+    ngx_rbtree_delete(&cache->sh->rbtree, &cn->sn.node);
+    ngx_queue_remove(&cn->queue);
+    ngx_slab_free_locked(cache->shpool, cn);
+}
+
+
 static void *
 ngx_resolver_alloc(ngx_resolver_t *r, size_t size)
 {
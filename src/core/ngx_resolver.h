@@ -142,6 +142,11 @@ typedef struct {
     ngx_uint_t                last_connection;
 
     ngx_resolver_ctx_t       *waiting;
+
+    /* addresses used while the name is being resolved again */
+    ngx_resolver_addr_t      *stale;
+    ngx_uint_t                nstale;
+    time_t                    stale_valid;
 } ngx_resolver_node_t;
 
 
@@ -187,6 +192,11 @@ struct ngx_resolver_s {
     time_t                    tcp_timeout;
     time_t                    expire;
     time_t                    valid;
+    time_t                    negative_valid;
+    time_t                    prefetch;
+    time_t                    stale;
+
+    ngx_shm_zone_t           *shm_zone;
 
     ngx_uint_t                log_level;
 };
@@ -12,13 +12,38 @@
 #if (NGX_HAVE_ATOMIC_OPS)
 
 
+#define NGX_SHMTX_SPIN_MIN  64
+
+
+static void ngx_shmtx_acquired(ngx_shmtx_t *mtx, ngx_uint_t spin,
+    ngx_uint_t sleeps, struct timeval *start);
 static void ngx_shmtx_wakeup(ngx_shmtx_t *mtx);
 
 
+#if (NGX_HAVE_FUTEX)
+
+/* a futex is the lower 32 bits of the counter */
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+#define ngx_shmtx_futex(mtx)  ((uint32_t *) (mtx)->futex)
+#else
+#define ngx_shmtx_futex(mtx)  ((uint32_t *) ((mtx)->futex + 1) - 1)
+#endif
+
+#endif
+
+
 ngx_int_t
 ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
     mtx->lock = &addr->lock;
+    mtx->adaptive = &addr->adaptive;
+    mtx->stat = &addr->stat;
+
+#if (NGX_HAVE_FUTEX)
+    mtx->wait = &addr->wait;
+    mtx->futex = &addr->futex;
+#endif
 
     if (mtx->spin == (ngx_uint_t) -1) {
         return NGX_OK;
@@ -26,7 +51,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 
     mtx->spin = 2048;
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !NGX_HAVE_FUTEX)
 
     mtx->wait = &addr->wait;
 
@@ -46,7 +71,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 void
 ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !NGX_HAVE_FUTEX)
 
     if (mtx->semaphore) {
         if (sem_destroy(&mtx->sem) == -1) {
@@ -62,46 +87,119 @@ ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 ngx_uint_t
 ngx_shmtx_trylock(ngx_shmtx_t *mtx)
 {
-    return (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid));
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        mtx->stat->acquired++;
+        return 1;
+    }
+
+    return 0;
 }
 
 
 void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
-    ngx_uint_t         i, n;
+    ngx_uint_t          i, n, spin, limit, sleeps;
+    struct timeval      start;
+    ngx_atomic_uint_t   owner, lock;
+#if (NGX_HAVE_FUTEX)
+    ngx_err_t           err;
+    ngx_atomic_uint_t   futex;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 
-    for ( ;; ) {
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        mtx->stat->acquired++;
+        return;
+    }
 
-        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
-            return;
-        }
+    ngx_gettimeofday(&start);
+
+    spin = 0;
+    sleeps = 0;
+
+    for ( ;; ) {
 
         if (ngx_ncpu > 1) {
 
-            for (n = 1; n < mtx->spin; n <<= 1) {
+            /*
+             * spinning is limited by twice the spinning recently needed
+             * to acquire the lock, and is extended up to mtx->spin while
+             * the lock changes owners, that is, while they are running
+             */
+
+            limit = ngx_min(2 * *mtx->adaptive + NGX_SHMTX_SPIN_MIN,
+                            mtx->spin);
+
+            owner = *mtx->lock;
+
+            for (n = 1; n < limit; n <<= 1) {
 
                 for (i = 0; i < n; i++) {
                     ngx_cpu_pause();
                 }
 
-                if (*mtx->lock == 0
-                    && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid))
-                {
+                spin += n;
+
+                lock = *mtx->lock;
+
+                if (lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+                    ngx_shmtx_acquired(mtx, spin, sleeps, &start);
                     return;
                 }
+
+                if (lock != owner) {
+                    owner = lock;
+                    limit = mtx->spin;
+                }
             }
         }
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+        (void) ngx_atomic_fetch_add(mtx->wait, 1);
+
+        futex = *mtx->futex;
+
+        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+            (void) ngx_atomic_fetch_add(mtx->wait, -1);
+            ngx_shmtx_acquired(mtx, spin, sleeps, &start);
+            return;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "shmtx wait %uA", *mtx->wait);
+
+        if (syscall(SYS_futex, ngx_shmtx_futex(mtx), FUTEX_WAIT,
+                    (uint32_t) futex, NULL, NULL, 0)
+            == -1)
+        {
+            err = ngx_errno;
+
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                              "futex() failed while waiting on shmtx");
+            }
+        }
+
+        (void) ngx_atomic_fetch_add(mtx->wait, -1);
+
+        sleeps++;
+
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "shmtx awoke");
+
+        continue;
+
+#elif (NGX_HAVE_POSIX_SEM)
 
         if (mtx->semaphore) {
             (void) ngx_atomic_fetch_add(mtx->wait, 1);
 
             if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
                 (void) ngx_atomic_fetch_add(mtx->wait, -1);
+                ngx_shmtx_acquired(mtx, spin, sleeps, &start);
                 return;
             }
 
@@ -120,6 +218,8 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
                 }
             }
 
+            sleeps++;
+
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
                            "shmtx awoke");
 
@@ -129,10 +229,52 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
 #endif
 
         ngx_sched_yield();
+
+        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+            ngx_shmtx_acquired(mtx, spin, sleeps, &start);
+            return;
+        }
     }
 }
 
 
+static void
+ngx_shmtx_acquired(ngx_shmtx_t *mtx, ngx_uint_t spin, ngx_uint_t sleeps,
+    struct timeval *start)
+{
+    struct timeval     tv;
+    ngx_atomic_int_t   usec;
+    ngx_shmtx_stat_t  *stat;
+
+    /* the lock is held, so statistics are updated without atomic ops */
+
+    ngx_gettimeofday(&tv);
+
+    usec = (tv.tv_sec - start->tv_sec) * 1000000
+           + (tv.tv_usec - start->tv_usec);
+
+    stat = mtx->stat;
+
+    stat->acquired++;
+    stat->contended++;
+    stat->sleeps += sleeps;
+
+    if (usec > 0) {
+        stat->wait_time += usec;
+    }
+
+    if (sleeps) {
+        *mtx->adaptive -= *mtx->adaptive / 8;
+        return;
+    }
+
+    stat->spins++;
+
+    *mtx->adaptive += ((ngx_atomic_int_t) spin
+                       - (ngx_atomic_int_t) *mtx->adaptive) / 8;
+}
+
+
 void
 ngx_shmtx_unlock(ngx_shmtx_t *mtx)
 {
@@ -164,7 +306,28 @@ ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
 static void
 ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+    if (*mtx->wait == 0) {
+        return;
+    }
+
+    /* changes the futex value for waiters which are yet to sleep */
+
+    (void) ngx_atomic_fetch_add(mtx->futex, 1);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shmtx wake %uA", *mtx->wait);
+
+    if (syscall(SYS_futex, ngx_shmtx_futex(mtx), FUTEX_WAKE, 1,
+                NULL, NULL, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "futex() failed while wake shmtx");
+    }
+
+#elif (NGX_HAVE_POSIX_SEM)
     ngx_atomic_uint_t  wait;
 
     if (!mtx->semaphore) {
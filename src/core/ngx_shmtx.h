@@ -14,26 +14,45 @@
 
 
 typedef struct {
-    ngx_atomic_t   lock;
-#if (NGX_HAVE_POSIX_SEM)
-    ngx_atomic_t   wait;
+    ngx_atomic_t   acquired;
+    ngx_atomic_t   contended;
+    ngx_atomic_t   spins;
+    ngx_atomic_t   sleeps;
+    ngx_atomic_t   wait_time;         /* in microseconds */
+} ngx_shmtx_stat_t;
+
+
+typedef struct {
+    ngx_atomic_t       lock;
+#if (NGX_HAVE_POSIX_SEM || NGX_HAVE_FUTEX)
+    ngx_atomic_t       wait;
+#endif
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_t       futex;
 #endif
+    ngx_atomic_t       adaptive;
+    ngx_shmtx_stat_t   stat;
 } ngx_shmtx_sh_t;
 
 
 typedef struct {
 #if (NGX_HAVE_ATOMIC_OPS)
-    ngx_atomic_t  *lock;
-#if (NGX_HAVE_POSIX_SEM)
-    ngx_atomic_t  *wait;
-    ngx_uint_t     semaphore;
-    sem_t          sem;
+    ngx_atomic_t      *lock;
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_t      *wait;
+    ngx_atomic_t      *futex;
+#elif (NGX_HAVE_POSIX_SEM)
+    ngx_atomic_t      *wait;
+    ngx_uint_t         semaphore;
+    sem_t              sem;
 #endif
+    ngx_atomic_t      *adaptive;
+    ngx_shmtx_stat_t  *stat;
 #else
-    ngx_fd_t       fd;
-    u_char        *name;
+    ngx_fd_t           fd;
+    u_char            *name;
 #endif
-    ngx_uint_t     spin;
+    ngx_uint_t         spin;
 } ngx_shmtx_t;
 
 
@@ -332,6 +332,8 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     page = ngx_slab_alloc_pages(pool, 1);
 
     if (page) {
+        pool->stats[slot].pages++;
+
         if (shift < ngx_slab_exact_shift) {
             bitmap = (uintptr_t *) ngx_slab_page_addr(pool, page);
 
@@ -533,6 +535,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             ngx_slab_free_pages(pool, page, 1);
 
             pool->stats[slot].total -= (ngx_pagesize >> shift) - n;
+            pool->stats[slot].pages--;
 
             goto done;
         }
@@ -571,6 +574,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             ngx_slab_free_pages(pool, page, 1);
 
             pool->stats[slot].total -= 8 * sizeof(uintptr_t);
+            pool->stats[slot].pages--;
 
             goto done;
         }
@@ -611,6 +615,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             ngx_slab_free_pages(pool, page, 1);
 
             pool->stats[slot].total -= ngx_pagesize >> shift;
+            pool->stats[slot].pages--;
 
             goto done;
         }
@@ -675,6 +680,54 @@ fail:
 }
 
 
+void
+ngx_slab_stat(ngx_slab_pool_t *pool, ngx_slab_pool_stat_t *stat)
+{
+    ngx_shmtx_lock(&pool->mutex);
+
+    ngx_slab_stat_locked(pool, stat);
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+void
+ngx_slab_stat_locked(ngx_slab_pool_t *pool, ngx_slab_pool_stat_t *stat)
+{
+    ngx_uint_t        i, n;
+    ngx_slab_page_t  *page, *slots;
+
+    stat->pages = pool->last - pool->pages;
+    stat->free = pool->pfree;
+    stat->runs = 0;
+    stat->largest = 0;
+    stat->partial = 0;
+
+    /*
+     * free pages scattered over many short runs cannot satisfy
+     * multi-page allocations, while many partially used pages of
+     * slots are not returned to the pool as long as a slot is used
+     */
+
+    for (page = pool->free.next; page != &pool->free; page = page->next) {
+        stat->runs++;
+
+        if (page->slab > stat->largest) {
+            stat->largest = page->slab;
+        }
+    }
+
+    slots = ngx_slab_slots(pool);
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < n; i++) {
+        for (page = slots[i].next; page != &slots[i]; page = page->next) {
+            stat->partial++;
+        }
+    }
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
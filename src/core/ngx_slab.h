@@ -28,9 +28,22 @@ typedef struct {
 
     ngx_uint_t        reqs;
     ngx_uint_t        fails;
+
+    ngx_uint_t        pages;
 } ngx_slab_stat_t;
 
 
+typedef struct {
+    ngx_uint_t        pages;
+    ngx_uint_t        free;
+
+    ngx_uint_t        runs;      /* runs of free pages */
+    ngx_uint_t        largest;   /* the largest run of free pages */
+
+    ngx_uint_t        partial;   /* pages of slots with free slots */
+} ngx_slab_pool_stat_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -67,6 +80,8 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_stat(ngx_slab_pool_t *pool, ngx_slab_pool_stat_t *stat);
+void ngx_slab_stat_locked(ngx_slab_pool_t *pool, ngx_slab_pool_stat_t *stat);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
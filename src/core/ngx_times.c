@@ -19,12 +19,18 @@ static ngx_msec_t ngx_monotonic_time(time_t sec, ngx_uint_t msec);
  * values and strings from the current slot.  Thus thread may get the corrupted
  * values only if it is preempted while copying and then it is not scheduled
  * to run more than NGX_TIME_SLOTS seconds.
+ *
+ * The error log and syslog strings are formatted as soon as the second
+ * changes since they may be needed in a signal handler.  The HTTP strings
+ * are formatted on demand by ngx_time_strings_update(), so an idle or a non
+ * HTTP process does not format them at all.
  */
 
 #define NGX_TIME_SLOTS   64
 
 static ngx_uint_t        slot;
 static ngx_atomic_t      ngx_time_lock;
+static time_t            strings_sec = -1;
 
 volatile ngx_msec_t      ngx_current_msec;
 volatile ngx_time_t     *ngx_cached_time;
@@ -74,14 +80,15 @@ ngx_time_init(void)
     ngx_cached_time = &cached_time[0];
 
     ngx_time_update();
+    ngx_time_strings_update();
 }
 
 
 void
 ngx_time_update(void)
 {
-    u_char          *p0, *p1, *p2, *p3, *p4;
-    ngx_tm_t         tm, gmt;
+    u_char          *p1, *p4;
+    ngx_tm_t         tm;
     time_t           sec;
     ngx_uint_t       msec;
     ngx_time_t      *tp;
@@ -117,16 +124,6 @@ ngx_time_update(void)
     tp->sec = sec;
     tp->msec = msec;
 
-    ngx_gmtime(sec, &gmt);
-
-
-    p0 = &cached_http_time[slot][0];
-
-    (void) ngx_sprintf(p0, "%s, %02d %s %4d %02d:%02d:%02d GMT",
-                       week[gmt.ngx_tm_wday], gmt.ngx_tm_mday,
-                       months[gmt.ngx_tm_mon - 1], gmt.ngx_tm_year,
-                       gmt.ngx_tm_hour, gmt.ngx_tm_min, gmt.ngx_tm_sec);
-
 #if (NGX_HAVE_GETTIMEZONE)
 
     tp->gmtoff = ngx_gettimezone();
@@ -154,6 +151,61 @@ ngx_time_update(void)
                        tm.ngx_tm_mday, tm.ngx_tm_hour,
                        tm.ngx_tm_min, tm.ngx_tm_sec);
 
+    p4 = &cached_syslog_time[slot][0];
+
+    (void) ngx_sprintf(p4, "%s %2d %02d:%02d:%02d",
+                       months[tm.ngx_tm_mon - 1], tm.ngx_tm_mday,
+                       tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec);
+
+    ngx_memory_barrier();
+
+    ngx_cached_time = tp;
+    ngx_cached_err_log_time.data = p1;
+    ngx_cached_syslog_time.data = p4;
+
+    ngx_unlock(&ngx_time_lock);
+}
+
+
+void
+ngx_time_strings_update(void)
+{
+    u_char      *p0, *p2, *p3;
+    ngx_tm_t     tm, gmt;
+    ngx_time_t  *tp;
+
+    if (ngx_cached_time->sec == strings_sec) {
+        return;
+    }
+
+    /*
+     * the callers use the strings right away, so wait for the lock
+     * rather than return stale ones; the function is not called
+     * from signal handlers, so the holder always releases the lock
+     */
+
+    ngx_spinlock(&ngx_time_lock, 1, 1024);
+
+    tp = &cached_time[slot];
+
+    if (tp->sec == strings_sec || tp->sec == 0) {
+
+        /* the slot was taken by ngx_time_sigsafe_update() */
+
+        ngx_unlock(&ngx_time_lock);
+        return;
+    }
+
+    ngx_gmtime(tp->sec, &gmt);
+
+    p0 = &cached_http_time[slot][0];
+
+    (void) ngx_sprintf(p0, "%s, %02d %s %4d %02d:%02d:%02d GMT",
+                       week[gmt.ngx_tm_wday], gmt.ngx_tm_mday,
+                       months[gmt.ngx_tm_mon - 1], gmt.ngx_tm_year,
+                       gmt.ngx_tm_hour, gmt.ngx_tm_min, gmt.ngx_tm_sec);
+
+    ngx_gmtime(tp->sec + tp->gmtoff * 60, &tm);
 
     p2 = &cached_http_log_time[slot][0];
 
@@ -173,20 +225,13 @@ ngx_time_update(void)
                        tp->gmtoff < 0 ? '-' : '+',
                        ngx_abs(tp->gmtoff / 60), ngx_abs(tp->gmtoff % 60));
 
-    p4 = &cached_syslog_time[slot][0];
-
-    (void) ngx_sprintf(p4, "%s %2d %02d:%02d:%02d",
-                       months[tm.ngx_tm_mon - 1], tm.ngx_tm_mday,
-                       tm.ngx_tm_hour, tm.ngx_tm_min, tm.ngx_tm_sec);
-
     ngx_memory_barrier();
 
-    ngx_cached_time = tp;
     ngx_cached_http_time.data = p0;
-    ngx_cached_err_log_time.data = p1;
     ngx_cached_http_log_time.data = p2;
     ngx_cached_http_log_iso8601.data = p3;
-    ngx_cached_syslog_time.data = p4;
+
+    strings_sec = tp->sec;
 
     ngx_unlock(&ngx_time_lock);
 }
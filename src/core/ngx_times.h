@@ -23,6 +23,7 @@ typedef struct {
 void ngx_time_init(void);
 void ngx_time_update(void);
 void ngx_time_sigsafe_update(void);
+void ngx_time_strings_update(void);
 u_char *ngx_http_time(u_char *buf, time_t t);
 u_char *ngx_http_cookie_time(u_char *buf, time_t t);
 void ngx_gmtime(time_t t, ngx_tm_t *tp);
@@ -37,6 +38,8 @@ extern volatile ngx_time_t  *ngx_cached_time;
 #define ngx_timeofday()      (ngx_time_t *) ngx_cached_time
 
 extern volatile ngx_str_t    ngx_cached_err_log_time;
+
+/* ngx_time_strings_update() should be called before the HTTP strings use */
 extern volatile ngx_str_t    ngx_cached_http_time;
 extern volatile ngx_str_t    ngx_cached_http_log_time;
 extern volatile ngx_str_t    ngx_cached_http_log_iso8601;
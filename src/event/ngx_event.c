@@ -154,6 +154,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -537,11 +544,21 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_writing */
            + cl;         /* ngx_stat_waiting */
 
+#if (NGX_SSL)
+    size += ngx_align(sizeof(ngx_ssl_stat_t), cl);   /* ngx_ssl_stat */
+#endif
+
 #endif
 
     shm.size = size;
     ngx_str_set(&shm.name, "nginx_shared_zone");
     shm.log = cycle->log;
+#if (NGX_HAVE_MAP_HUGETLB)
+    shm.huge = 0;
+#endif
+#if (NGX_HAVE_NUMA)
+    shm.numa = 0;
+#endif
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -583,6 +600,10 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
 
+#if (NGX_SSL)
+    ngx_ssl_stat = (ngx_ssl_stat_t *) (shared + 10 * cl);
+#endif
+
 #endif
 
     return NGX_OK;
@@ -607,6 +628,7 @@ ngx_timer_signal_handler(int signo)
 static ngx_int_t
 ngx_event_process_init(ngx_cycle_t *cycle)
 {
+    u_char              *p;
     ngx_uint_t           m, i;
     ngx_event_t         *rev, *wev;
     ngx_listening_t     *ls;
@@ -641,6 +663,8 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_queue_init(&ngx_posted_accept_events);
     ngx_queue_init(&ngx_posted_events);
 
+    ngx_event_timer_wheel = ecf->timer_wheel;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
@@ -720,32 +744,49 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
 #endif
 
-    cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
-    if (cycle->connections == NULL) {
-        return NGX_ERROR;
-    }
+    if (ccf->huge_pages) {
 
-    c = cycle->connections;
+        /* a single allocation to use as few huge pages as possible */
 
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
-    if (cycle->read_events == NULL) {
-        return NGX_ERROR;
+        p = ngx_alloc_huge((sizeof(ngx_connection_t) + 2 * sizeof(ngx_event_t))
+                           * cycle->connection_n, cycle->log);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        cycle->connections = (ngx_connection_t *) p;
+        cycle->read_events = (ngx_event_t *)
+                          (p + sizeof(ngx_connection_t) * cycle->connection_n);
+        cycle->write_events = cycle->read_events + cycle->connection_n;
+
+    } else {
+        cycle->connections = ngx_alloc(sizeof(ngx_connection_t)
+                                       * cycle->connection_n, cycle->log);
+        if (cycle->connections == NULL) {
+            return NGX_ERROR;
+        }
+
+        cycle->read_events = ngx_alloc(sizeof(ngx_event_t)
+                                       * cycle->connection_n, cycle->log);
+        if (cycle->read_events == NULL) {
+            return NGX_ERROR;
+        }
+
+        cycle->write_events = ngx_alloc(sizeof(ngx_event_t)
+                                        * cycle->connection_n, cycle->log);
+        if (cycle->write_events == NULL) {
+            return NGX_ERROR;
+        }
     }
 
+    c = cycle->connections;
+
     rev = cycle->read_events;
     for (i = 0; i < cycle->connection_n; i++) {
         rev[i].closed = 1;
         rev[i].instance = 1;
     }
 
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
-    if (cycle->write_events == NULL) {
-        return NGX_ERROR;
-    }
-
     wev = cycle->write_events;
     for (i = 0; i < cycle->connection_n; i++) {
         wev[i].closed = 1;
@@ -1226,6 +1267,7 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1325,6 +1367,7 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_value(ecf->timer_wheel, 0);
 
     return NGX_CONF_OK;
 }
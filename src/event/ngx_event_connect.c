@@ -145,6 +145,40 @@ ngx_event_connect_peer(ngx_peer_connection_t *pc)
         }
     }
 
+#if (NGX_HAVE_TCP_FASTOPEN_CONNECT)
+
+    if (pc->fastopen
+        && type == SOCK_STREAM
+        && pc->sockaddr->sa_family != AF_UNIX)
+    {
+        static int  fastopen_connect = 1;
+
+        /*
+         * connect() returns immediately if a cookie for the peer
+         * is known, and the SYN is sent along with the first write
+         */
+
+        if (fastopen_connect) {
+            if (setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                           (const void *) &fastopen_connect, sizeof(int))
+                == -1)
+            {
+                err = ngx_socket_errno;
+
+                if (err != NGX_EOPNOTSUPP && err != NGX_ENOPROTOOPT) {
+                    ngx_log_error(NGX_LOG_ALERT, pc->log, err,
+                                  "setsockopt(TCP_FASTOPEN_CONNECT) "
+                                  "failed, ignored");
+
+                } else {
+                    fastopen_connect = 0;
+                }
+            }
+        }
+    }
+
+#endif
+
     if (type == SOCK_STREAM) {
         c->recv = ngx_recv;
         c->send = ngx_send;
@@ -9,26 +9,79 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
 
 
 typedef struct {
     ngx_uint_t  engine;   /* unsigned  engine:1; */
+    ngx_flag_t  memory_accounting;
 } ngx_openssl_conf_t;
 
 
+static X509 *ngx_ssl_load_certificate(char **err, ngx_str_t *cert,
+    STACK_OF(X509) **chain);
+static EVP_PKEY *ngx_ssl_load_certificate_key(char **err, ngx_str_t *key,
+    ngx_array_t *passwords);
+#ifdef SSL_R_CERT_CB_ERROR
+static X509 *ngx_ssl_cache_certificate(ngx_ssl_cache_t *cache,
+    ngx_str_t *name, STACK_OF(X509) **chain);
+static void ngx_ssl_cache_store_certificate(ngx_ssl_cache_t *cache,
+    ngx_str_t *name, X509 *x509, STACK_OF(X509) *chain, ngx_log_t *log);
+static EVP_PKEY *ngx_ssl_cache_certificate_key(ngx_ssl_cache_t *cache,
+    ngx_str_t *name);
+static void ngx_ssl_cache_store_certificate_key(ngx_ssl_cache_t *cache,
+    ngx_str_t *name, EVP_PKEY *pkey, ngx_log_t *log);
+static ngx_ssl_cache_node_t *ngx_ssl_cache_lookup(ngx_ssl_cache_t *cache,
+    ngx_str_t *name);
+static ngx_ssl_cache_node_t *ngx_ssl_cache_add(ngx_ssl_cache_t *cache,
+    ngx_str_t *name, ngx_log_t *log);
+static void ngx_ssl_cache_expire(ngx_ssl_cache_t *cache, ngx_uint_t n);
+static void ngx_ssl_cache_delete(ngx_ssl_cache_t *cache,
+    ngx_ssl_cache_node_t *cn);
+static void ngx_ssl_cache_cleanup(void *data);
+#endif
 static int ngx_ssl_password_callback(char *buf, int size, int rwflag,
     void *userdata);
 static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
 static void ngx_ssl_passwords_cleanup(void *data);
+static void ngx_ssl_client_session_tag(ngx_ssl_t *ssl);
 static int ngx_ssl_new_client_session(ngx_ssl_conn_t *ssl_conn,
     ngx_ssl_session_t *sess);
+static u_char *ngx_ssl_alloc_client_session(
+    ngx_ssl_client_session_cache_t *cache, ngx_ssl_client_session_node_t *sn,
+    size_t size);
+static void ngx_ssl_free_client_session(ngx_ssl_client_session_cache_t *cache,
+    ngx_ssl_client_session_node_t *sn, ngx_uint_t i);
+static void ngx_ssl_expire_client_sessions(
+    ngx_ssl_client_session_cache_t *cache, ngx_ssl_client_session_node_t *sn);
+#if OPENSSL_VERSION_NUMBER >= 0x10100003L && !defined LIBRESSL_VERSION_NUMBER
+static void *ngx_ssl_malloc(size_t size, const char *file, int line);
+static void *ngx_ssl_realloc(void *p, size_t size, const char *file, int line);
+static void ngx_ssl_free(void *p, const char *file, int line);
+static void ngx_ssl_memory_update(ngx_atomic_int_t size);
+#endif
+static ngx_int_t ngx_ssl_handshake_done(ngx_connection_t *c);
+#if (NGX_STAT_STUB)
+static void ngx_ssl_handshake_stat(ngx_connection_t *c);
+static void ngx_ssl_stat_slot(ngx_ssl_stat_slot_t *slot, ngx_atomic_uint_t id,
+    const char *name);
+#endif
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+#if (NGX_THREADS)
+static ngx_int_t ngx_ssl_handshake_thread(ngx_connection_t *c);
+static void ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log);
+static void ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
+static size_t ngx_ssl_record_size(ngx_connection_t *c);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
@@ -45,8 +98,12 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+static ngx_ssl_session_shard_t *ngx_ssl_session_shard(
+    ngx_shm_zone_t *shm_zone, uint32_t hash);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
+    ngx_uint_t n);
+static ngx_int_t ngx_ssl_get_session_cache_stat(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_str_t *s, size_t offset);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
@@ -54,6 +111,8 @@ static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
+static ngx_int_t ngx_ssl_rotate_ticket_keys(SSL_CTX *ssl_ctx, ngx_log_t *log,
+    ngx_ssl_session_ticket_key_t *out);
 #endif
 
 #ifndef X509_CHECK_FLAG_ALWAYS_CHECK_SUBJECT
@@ -67,7 +126,9 @@ static time_t ngx_ssl_parse_time(
     ASN1_TIME *asn1time);
 
 static void *ngx_openssl_create_conf(ngx_cycle_t *cycle);
+static char *ngx_openssl_init_conf(ngx_cycle_t *cycle, void *conf);
 static char *ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_openssl_init_module(ngx_cycle_t *cycle);
 static void ngx_openssl_exit(ngx_cycle_t *cycle);
 
 
@@ -80,6 +141,13 @@ static ngx_command_t  ngx_openssl_commands[] = {
       0,
       NULL },
 
+    { ngx_string("ssl_memory_accounting"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_openssl_conf_t, memory_accounting),
+      NULL },
+
       ngx_null_command
 };
 
@@ -87,7 +155,7 @@ static ngx_command_t  ngx_openssl_commands[] = {
 static ngx_core_module_t  ngx_openssl_module_ctx = {
     ngx_string("openssl"),
     ngx_openssl_create_conf,
-    NULL
+    ngx_openssl_init_conf
 };
 
 
@@ -97,7 +165,7 @@ ngx_module_t  ngx_openssl_module = {
     ngx_openssl_commands,                  /* module directives */
     NGX_CORE_MODULE,                       /* module type */
     NULL,                                  /* init master */
-    NULL,                                  /* init module */
+    ngx_openssl_init_module,               /* init module */
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
@@ -117,11 +185,82 @@ int  ngx_ssl_certificate_name_index;
 int  ngx_ssl_stapling_index;
 
 
+#if (NGX_STAT_STUB)
+
+/*
+ * handshake counters of server connections, the structure is moved
+ * to the shared memory by the event module
+ */
+
+static ngx_ssl_stat_t   ngx_ssl_stat0;
+ngx_ssl_stat_t         *ngx_ssl_stat = &ngx_ssl_stat0;
+
+/* upper bounds of the handshake time histogram buckets */
+
+ngx_msec_t  ngx_ssl_stat_times[NGX_SSL_STAT_TIMES] = {
+    1, 5, 10, 25, 50, 100, 250, 500, 1000, NGX_MAX_INT32_VALUE
+};
+
+#endif
+
+
+/*
+ * with "ssl_memory_accounting on", the number of bytes allocated by OpenSSL
+ * in the process since the configuration was loaded; the header of each
+ * allocation keeps its counted size, which is 0 for allocations done while
+ * the accounting was disabled
+ */
+
+static ngx_uint_t    ngx_ssl_memory_accounting;
+static ngx_atomic_t  ngx_ssl_memory;
+
+#define NGX_SSL_MEMORY_HEADER  16
+
+
+/*
+ * allocations done within SSL calls of a connection are charged to it
+ * through a per-thread pointer, as handshakes may run in thread pools;
+ * without thread local variables such accounting is disabled
+ */
+
+#if (NGX_THREADS && !NGX_HAVE_THREAD_LOCAL)
+
+#define NGX_SSL_MEMORY_OWNER  0
+#define ngx_ssl_memory_owner_set(sc)
+
+#else
+
+#define NGX_SSL_MEMORY_OWNER  1
+
+#if (NGX_THREADS)
+static __thread ngx_ssl_connection_t  *ngx_ssl_memory_owner;
+#else
+static ngx_ssl_connection_t           *ngx_ssl_memory_owner;
+#endif
+
+#define ngx_ssl_memory_owner_set(sc)  ngx_ssl_memory_owner = sc
+
+#endif
+
+
 ngx_int_t
 ngx_ssl_init(ngx_log_t *log)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x10100003L
 
+#ifndef LIBRESSL_VERSION_NUMBER
+
+    /*
+     * OpenSSL only allows to set the functions before the first allocation,
+     * so they are always installed; with "ssl_memory_accounting off"
+     * they only maintain the allocation header
+     */
+
+    (void) CRYPTO_set_mem_functions(ngx_ssl_malloc, ngx_ssl_realloc,
+                                    ngx_ssl_free);
+
+#endif
+
     if (OPENSSL_init_ssl(OPENSSL_INIT_LOAD_CONFIG, NULL) == 0) {
         ngx_ssl_error(NGX_LOG_ALERT, log, 0, "OPENSSL_init_ssl() failed");
         return NGX_ERROR;
@@ -230,6 +369,107 @@ ngx_ssl_init(ngx_log_t *log)
 }
 
 
+#if OPENSSL_VERSION_NUMBER >= 0x10100003L && !defined LIBRESSL_VERSION_NUMBER
+
+static void *
+ngx_ssl_malloc(size_t size, const char *file, int line)
+{
+    u_char  *p;
+
+    p = malloc(size + NGX_SSL_MEMORY_HEADER);
+    if (p == NULL) {
+        return NULL;
+    }
+
+    if (ngx_ssl_memory_accounting) {
+        *(size_t *) p = size;
+        ngx_ssl_memory_update(size);
+
+    } else {
+        *(size_t *) p = 0;
+    }
+
+    return p + NGX_SSL_MEMORY_HEADER;
+}
+
+
+static void *
+ngx_ssl_realloc(void *p, size_t size, const char *file, int line)
+{
+    u_char  *m;
+    size_t   old;
+
+    if (p == NULL) {
+        return ngx_ssl_malloc(size, file, line);
+    }
+
+    if (size == 0) {
+        ngx_ssl_free(p, file, line);
+        return NULL;
+    }
+
+    m = (u_char *) p - NGX_SSL_MEMORY_HEADER;
+    old = *(size_t *) m;
+
+    m = realloc(m, size + NGX_SSL_MEMORY_HEADER);
+    if (m == NULL) {
+        return NULL;
+    }
+
+    if (ngx_ssl_memory_accounting) {
+        *(size_t *) m = size;
+        ngx_ssl_memory_update((ngx_atomic_int_t) (size - old));
+
+    } else {
+        *(size_t *) m = 0;
+
+        if (old) {
+            ngx_ssl_memory_update(- (ngx_atomic_int_t) old);
+        }
+    }
+
+    return m + NGX_SSL_MEMORY_HEADER;
+}
+
+
+static void
+ngx_ssl_free(void *p, const char *file, int line)
+{
+    u_char  *m;
+
+    if (p == NULL) {
+        return;
+    }
+
+    m = (u_char *) p - NGX_SSL_MEMORY_HEADER;
+
+    if (*(size_t *) m) {
+        ngx_ssl_memory_update(- (ngx_atomic_int_t) *(size_t *) m);
+    }
+
+    free(m);
+}
+
+
+static void
+ngx_ssl_memory_update(ngx_atomic_int_t size)
+{
+    (void) ngx_atomic_fetch_add(&ngx_ssl_memory, size);
+
+#if (NGX_SSL_MEMORY_OWNER)
+    if (ngx_ssl_memory_owner) {
+        ngx_ssl_memory_owner->memory += size;
+    }
+#endif
+}
+
+#else
+
+#define ngx_ssl_memory_owner_set(sc)
+
+#endif
+
+
 ngx_int_t
 ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
 {
@@ -340,6 +580,14 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
     SSL_CTX_set_options(ssl->ctx, SSL_OP_NO_COMPRESSION);
 #endif
 
+#ifdef SSL_OP_NO_TX_CERTIFICATE_COMPRESSION
+    /*
+     * OpenSSL 3.2+ compresses certificates on each handshake unless
+     * they are compressed in advance, see ngx_ssl_certificate_compression()
+     */
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_NO_TX_CERTIFICATE_COMPRESSION);
+#endif
+
 #ifdef SSL_MODE_RELEASE_BUFFERS
     SSL_CTX_set_mode(ssl->ctx, SSL_MODE_RELEASE_BUFFERS);
 #endif
@@ -383,34 +631,23 @@ ngx_int_t
 ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
     ngx_str_t *key, ngx_array_t *passwords)
 {
-    BIO         *bio;
-    X509        *x509;
-    u_long       n;
-    ngx_str_t   *pwd;
-    ngx_uint_t   tries;
+    char            *err;
+    X509            *x509;
+    EVP_PKEY        *pkey;
+    STACK_OF(X509)  *chain;
 
     if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
         return NGX_ERROR;
     }
 
-    /*
-     * we can't use SSL_CTX_use_certificate_chain_file() as it doesn't
-     * allow to access certificate later from SSL_CTX, so we reimplement
-     * it here
-     */
-
-    bio = BIO_new_file((char *) cert->data, "r");
-    if (bio == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "BIO_new_file(\"%s\") failed", cert->data);
-        return NGX_ERROR;
-    }
-
-    x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+    x509 = ngx_ssl_load_certificate(&err, cert, &chain);
     if (x509 == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "PEM_read_bio_X509_AUX(\"%s\") failed", cert->data);
-        BIO_free(bio);
+        if (err != NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "cannot load certificate \"%s\": %s",
+                          cert->data, err);
+        }
+
         return NGX_ERROR;
     }
 
@@ -418,7 +655,7 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                       "SSL_CTX_use_certificate(\"%s\") failed", cert->data);
         X509_free(x509);
-        BIO_free(bio);
+        sk_X509_pop_free(chain, X509_free);
         return NGX_ERROR;
     }
 
@@ -427,7 +664,7 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
     {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "X509_set_ex_data() failed");
         X509_free(x509);
-        BIO_free(bio);
+        sk_X509_pop_free(chain, X509_free);
         return NGX_ERROR;
     }
 
@@ -437,7 +674,7 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
     {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "X509_set_ex_data() failed");
         X509_free(x509);
-        BIO_free(bio);
+        sk_X509_pop_free(chain, X509_free);
         return NGX_ERROR;
     }
 
@@ -447,16 +684,120 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
                       "SSL_CTX_set_ex_data() failed");
         X509_free(x509);
-        BIO_free(bio);
+        sk_X509_pop_free(chain, X509_free);
+        return NGX_ERROR;
+    }
+
+#ifdef SSL_CTX_set0_chain
+
+    /*
+     * SSL_CTX_set0_chain() is needed to add chain to
+     * a particular certificate when multiple certificates are used;
+     * only available in OpenSSL 1.0.2+
+     */
+
+    if (SSL_CTX_set0_chain(ssl->ctx, chain) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_set0_chain(\"%s\") failed", cert->data);
+        sk_X509_pop_free(chain, X509_free);
+        return NGX_ERROR;
+    }
+
+#else
+    {
+    int  n;
+
+    n = sk_X509_num(chain);
+
+    while (n--) {
+        x509 = sk_X509_shift(chain);
+
+        if (SSL_CTX_add_extra_chain_cert(ssl->ctx, x509) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "SSL_CTX_add_extra_chain_cert(\"%s\") failed",
+                          cert->data);
+            X509_free(x509);
+            sk_X509_pop_free(chain, X509_free);
+            return NGX_ERROR;
+        }
+    }
+
+    sk_X509_free(chain);
+    }
+#endif
+
+    if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) != 0
+        && ngx_conf_full_name(cf->cycle, key, 1) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    pkey = ngx_ssl_load_certificate_key(&err, key, passwords);
+    if (pkey == NULL) {
+        if (err != NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "cannot load certificate key \"%s\": %s",
+                          key->data, err);
+        }
+
+        return NGX_ERROR;
+    }
+
+    if (SSL_CTX_use_PrivateKey(ssl->ctx, pkey) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_use_PrivateKey(\"%s\") failed", key->data);
+        EVP_PKEY_free(pkey);
         return NGX_ERROR;
     }
 
-    /* read rest of the chain */
+    EVP_PKEY_free(pkey);
+
+    return NGX_OK;
+}
+
+
+static X509 *
+ngx_ssl_load_certificate(char **err, ngx_str_t *cert, STACK_OF(X509) **chain)
+{
+    BIO     *bio;
+    X509    *x509, *temp;
+    u_long   n;
+
+    /*
+     * we can't use SSL_CTX_use_certificate_chain_file() as it doesn't
+     * allow to access certificate later from SSL_CTX, so we reimplement
+     * it here
+     */
+
+    bio = BIO_new_file((char *) cert->data, "r");
+    if (bio == NULL) {
+        *err = "BIO_new_file() failed";
+        return NULL;
+    }
+
+    /* certificate itself */
+
+    x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+    if (x509 == NULL) {
+        *err = "PEM_read_bio_X509_AUX() failed";
+        BIO_free(bio);
+        return NULL;
+    }
+
+    /* rest of the chain */
+
+    *chain = sk_X509_new_null();
+    if (*chain == NULL) {
+        *err = "sk_X509_new_null() failed";
+        X509_free(x509);
+        BIO_free(bio);
+        return NULL;
+    }
 
     for ( ;; ) {
 
-        x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL);
-        if (x509 == NULL) {
+        temp = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        if (temp == NULL) {
             n = ERR_peek_last_error();
 
             if (ERR_GET_LIB(n) == ERR_LIB_PEM
@@ -469,153 +810,509 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
 
             /* some real error */
 
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "PEM_read_bio_X509(\"%s\") failed", cert->data);
+            *err = "PEM_read_bio_X509() failed";
             BIO_free(bio);
-            return NGX_ERROR;
-        }
-
-#ifdef SSL_CTRL_CHAIN_CERT
-
-        /*
-         * SSL_CTX_add0_chain_cert() is needed to add chain to
-         * a particular certificate when multiple certificates are used;
-         * only available in OpenSSL 1.0.2+
-         */
-
-        if (SSL_CTX_add0_chain_cert(ssl->ctx, x509) == 0) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "SSL_CTX_add0_chain_cert(\"%s\") failed",
-                          cert->data);
             X509_free(x509);
-            BIO_free(bio);
-            return NGX_ERROR;
+            sk_X509_pop_free(*chain, X509_free);
+            return NULL;
         }
 
-#else
-        if (SSL_CTX_add_extra_chain_cert(ssl->ctx, x509) == 0) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "SSL_CTX_add_extra_chain_cert(\"%s\") failed",
-                          cert->data);
-            X509_free(x509);
+        if (sk_X509_push(*chain, temp) == 0) {
+            *err = "sk_X509_push() failed";
             BIO_free(bio);
-            return NGX_ERROR;
+            X509_free(x509);
+            X509_free(temp);
+            sk_X509_pop_free(*chain, X509_free);
+            return NULL;
         }
-#endif
     }
 
     BIO_free(bio);
 
+    return x509;
+}
+
+
+static EVP_PKEY *
+ngx_ssl_load_certificate_key(char **err, ngx_str_t *key,
+    ngx_array_t *passwords)
+{
+    BIO              *bio;
+    EVP_PKEY         *pkey;
+    ngx_str_t        *pwd;
+    ngx_uint_t        tries;
+    pem_password_cb  *cb;
+
     if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) == 0) {
 
 #ifndef OPENSSL_NO_ENGINE
 
-        u_char      *p, *last;
-        ENGINE      *engine;
-        EVP_PKEY    *pkey;
+        u_char  *p, *last;
+        ENGINE  *engine;
 
         p = key->data + sizeof("engine:") - 1;
         last = (u_char *) ngx_strchr(p, ':');
 
         if (last == NULL) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "invalid syntax in \"%V\"", key);
-            return NGX_ERROR;
+            *err = "invalid syntax";
+            return NULL;
         }
 
         *last = '\0';
 
         engine = ENGINE_by_id((char *) p);
 
+        *last++ = ':';
+
         if (engine == NULL) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "ENGINE_by_id(\"%s\") failed", p);
-            return NGX_ERROR;
+            *err = "ENGINE_by_id() failed";
+            return NULL;
         }
 
-        *last++ = ':';
-
         pkey = ENGINE_load_private_key(engine, (char *) last, 0, 0);
 
         if (pkey == NULL) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "ENGINE_load_private_key(\"%s\") failed", last);
+            *err = "ENGINE_load_private_key() failed";
             ENGINE_free(engine);
-            return NGX_ERROR;
+            return NULL;
         }
 
         ENGINE_free(engine);
 
-        if (SSL_CTX_use_PrivateKey(ssl->ctx, pkey) == 0) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "SSL_CTX_use_PrivateKey(\"%s\") failed", last);
-            EVP_PKEY_free(pkey);
-            return NGX_ERROR;
-        }
-
-        EVP_PKEY_free(pkey);
-
-        return NGX_OK;
+        return pkey;
 
 #else
 
-        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                           "loading \"engine:...\" certificate keys "
-                           "is not supported");
-        return NGX_ERROR;
+        *err = "loading \"engine:...\" certificate keys is not supported";
+        return NULL;
 
 #endif
     }
 
-    if (ngx_conf_full_name(cf->cycle, key, 1) != NGX_OK) {
-        return NGX_ERROR;
+    bio = BIO_new_file((char *) key->data, "r");
+    if (bio == NULL) {
+        *err = "BIO_new_file() failed";
+        return NULL;
     }
 
     if (passwords) {
         tries = passwords->nelts;
         pwd = passwords->elts;
-
-        SSL_CTX_set_default_passwd_cb(ssl->ctx, ngx_ssl_password_callback);
-        SSL_CTX_set_default_passwd_cb_userdata(ssl->ctx, pwd);
+        cb = ngx_ssl_password_callback;
 
     } else {
         tries = 1;
-#if (NGX_SUPPRESS_WARN)
         pwd = NULL;
-#endif
+        cb = NULL;
     }
 
     for ( ;; ) {
 
-        if (SSL_CTX_use_PrivateKey_file(ssl->ctx, (char *) key->data,
-                                        SSL_FILETYPE_PEM)
-            != 0)
-        {
+        pkey = PEM_read_bio_PrivateKey(bio, NULL, cb, pwd);
+        if (pkey != NULL) {
             break;
         }
 
-        if (--tries) {
+        if (tries-- > 1) {
             ERR_clear_error();
-            SSL_CTX_set_default_passwd_cb_userdata(ssl->ctx, ++pwd);
+            (void) BIO_reset(bio);
+            pwd++;
             continue;
         }
 
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "SSL_CTX_use_PrivateKey_file(\"%s\") failed", key->data);
+        *err = "PEM_read_bio_PrivateKey() failed";
+        BIO_free(bio);
+        return NULL;
+    }
+
+    BIO_free(bio);
+
+    return pkey;
+}
+
+
+#ifdef SSL_R_CERT_CB_ERROR
+
+ngx_int_t
+ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_ssl_cache_t *cache,
+    ngx_array_t *passwords)
+{
+    char            *err;
+    X509            *x509;
+    EVP_PKEY        *pkey;
+    STACK_OF(X509)  *chain;
+
+    if (ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, cert)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    x509 = ngx_ssl_cache_certificate(cache, cert, &chain);
+
+    if (x509 == NULL) {
+        x509 = ngx_ssl_load_certificate(&err, cert, &chain);
+        if (x509 == NULL) {
+            if (err != NULL) {
+                ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                              "cannot load certificate \"%s\": %s",
+                              cert->data, err);
+            }
+
+            return NGX_ERROR;
+        }
+
+        ngx_ssl_cache_store_certificate(cache, cert, x509, chain, c->log);
+    }
+
+    if (SSL_use_certificate(c->ssl->connection, x509) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_certificate(\"%s\") failed", cert->data);
+        X509_free(x509);
+        sk_X509_pop_free(chain, X509_free);
+        return NGX_ERROR;
+    }
+
+    X509_free(x509);
+
+    /*
+     * SSL_set0_chain() is only available in OpenSSL 1.0.2+,
+     * but this function is only called via certificate callback,
+     * which is only available in OpenSSL 1.0.2+ as well
+     */
+
+    if (SSL_set0_chain(c->ssl->connection, chain) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_set0_chain(\"%s\") failed", cert->data);
+        sk_X509_pop_free(chain, X509_free);
+        return NGX_ERROR;
+    }
+
+    if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) != 0
+        && ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, key)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    pkey = ngx_ssl_cache_certificate_key(cache, key);
+
+    if (pkey == NULL) {
+        pkey = ngx_ssl_load_certificate_key(&err, key, passwords);
+        if (pkey == NULL) {
+            if (err != NULL) {
+                ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                              "cannot load certificate key \"%s\": %s",
+                              key->data, err);
+            }
+
+            return NGX_ERROR;
+        }
+
+        ngx_ssl_cache_store_certificate_key(cache, key, pkey, c->log);
+    }
+
+    if (SSL_use_PrivateKey(c->ssl->connection, pkey) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_PrivateKey(\"%s\") failed", key->data);
+        EVP_PKEY_free(pkey);
         return NGX_ERROR;
     }
 
-    SSL_CTX_set_default_passwd_cb(ssl->ctx, NULL);
+    EVP_PKEY_free(pkey);
 
     return NGX_OK;
 }
 
 
+ngx_ssl_cache_t *
+ngx_ssl_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t valid,
+    time_t inactive)
+{
+    ngx_ssl_cache_t     *cache;
+    ngx_pool_cleanup_t  *cln;
+
+    cache = ngx_pcalloc(pool, sizeof(ngx_ssl_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->expire_queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->valid = valid;
+    cache->inactive = inactive;
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_ssl_cache_cleanup;
+    cln->data = cache;
+
+    return cache;
+}
+
+
+static X509 *
+ngx_ssl_cache_certificate(ngx_ssl_cache_t *cache, ngx_str_t *name,
+    STACK_OF(X509) **chain)
+{
+    X509                  *x509;
+    ngx_ssl_cache_node_t  *cn;
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    x509 = NULL;
+
+    cn = ngx_ssl_cache_lookup(cache, name);
+
+    if (cn && cn->x509) {
+        *chain = X509_chain_up_ref(cn->chain);
+
+        if (*chain) {
+            x509 = cn->x509;
+            X509_up_ref(x509);
+        }
+    }
+
+    return x509;
+}
+
+
+static void
+ngx_ssl_cache_store_certificate(ngx_ssl_cache_t *cache, ngx_str_t *name,
+    X509 *x509, STACK_OF(X509) *chain, ngx_log_t *log)
+{
+    ngx_ssl_cache_node_t  *cn;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    cn = ngx_ssl_cache_add(cache, name, log);
+
+    if (cn && cn->x509 == NULL) {
+        cn->chain = X509_chain_up_ref(chain);
+
+        if (cn->chain) {
+            cn->x509 = x509;
+            X509_up_ref(x509);
+        }
+    }
+}
+
+
+static EVP_PKEY *
+ngx_ssl_cache_certificate_key(ngx_ssl_cache_t *cache, ngx_str_t *name)
+{
+    EVP_PKEY              *pkey;
+    ngx_ssl_cache_node_t  *cn;
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    pkey = NULL;
+
+    cn = ngx_ssl_cache_lookup(cache, name);
+
+    if (cn && cn->pkey) {
+        pkey = cn->pkey;
+        EVP_PKEY_up_ref(pkey);
+    }
+
+    return pkey;
+}
+
+
+static void
+ngx_ssl_cache_store_certificate_key(ngx_ssl_cache_t *cache, ngx_str_t *name,
+    EVP_PKEY *pkey, ngx_log_t *log)
+{
+    ngx_ssl_cache_node_t  *cn;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    cn = ngx_ssl_cache_add(cache, name, log);
+
+    if (cn && cn->pkey == NULL) {
+        cn->pkey = pkey;
+        EVP_PKEY_up_ref(pkey);
+    }
+}
+
+
+static ngx_ssl_cache_node_t *
+ngx_ssl_cache_lookup(ngx_ssl_cache_t *cache, ngx_str_t *name)
+{
+    time_t                 now;
+    uint32_t               hash;
+    ngx_ssl_cache_node_t  *cn;
+
+    hash = ngx_crc32_long(name->data, name->len);
+
+    cn = (ngx_ssl_cache_node_t *) ngx_str_rbtree_lookup(&cache->rbtree, name,
+                                                        hash);
+    if (cn == NULL) {
+        return NULL;
+    }
+
+    now = ngx_time();
+
+    if (now - cn->created >= cache->valid) {
+
+        /* the file is read again to pick up a renewed certificate */
+
+        ngx_ssl_cache_delete(cache, cn);
+        return NULL;
+    }
+
+    cn->accessed = now;
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->expire_queue, &cn->queue);
+
+    return cn;
+}
+
+
+static ngx_ssl_cache_node_t *
+ngx_ssl_cache_add(ngx_ssl_cache_t *cache, ngx_str_t *name, ngx_log_t *log)
+{
+    ngx_ssl_cache_node_t  *cn;
+
+    cn = ngx_ssl_cache_lookup(cache, name);
+
+    if (cn) {
+        return cn;
+    }
+
+    ngx_ssl_cache_expire(cache, cache->current >= cache->max ? 0 : 1);
+
+    cn = ngx_alloc(sizeof(ngx_ssl_cache_node_t) + name->len, log);
+    if (cn == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(cn, sizeof(ngx_ssl_cache_node_t));
+
+    cn->sn.str.len = name->len;
+    cn->sn.str.data = (u_char *) cn + sizeof(ngx_ssl_cache_node_t);
+    ngx_memcpy(cn->sn.str.data, name->data, name->len);
+
+    cn->sn.node.key = ngx_crc32_long(name->data, name->len);
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+
+    cn->created = ngx_time();
+    cn->accessed = cn->created;
+
+    ngx_queue_insert_head(&cache->expire_queue, &cn->queue);
+
+    cache->current++;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ssl cache add: \"%V\", %ui entries",
+                   &cn->sn.str, cache->current);
+
+    return cn;
+}
+
+
+static void
+ngx_ssl_cache_expire(ngx_ssl_cache_t *cache, ngx_uint_t n)
+{
+    time_t                 now;
+    ngx_queue_t           *q;
+    ngx_ssl_cache_node_t  *cn;
+
+    now = ngx_time();
+
+    /*
+     * n == 1 deletes one or two inactive entries
+     * n == 0 deletes least recently used entry by force
+     *        and one or two inactive entries
+     */
+
+    while (n < 3) {
+
+        if (ngx_queue_empty(&cache->expire_queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->expire_queue);
+
+        cn = ngx_queue_data(q, ngx_ssl_cache_node_t, queue);
+
+        if (n++ != 0 && now - cn->accessed <= cache->inactive) {
+            return;
+        }
+
+        ngx_ssl_cache_delete(cache, cn);
+    }
+}
+
+
+static void
+ngx_ssl_cache_delete(ngx_ssl_cache_t *cache, ngx_ssl_cache_node_t *cn)
+{
+    ngx_queue_remove(&cn->queue);
+    ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+
+    if (cn->x509) {
+        X509_free(cn->x509);
+        sk_X509_pop_free(cn->chain, X509_free);
+    }
+
+    if (cn->pkey) {
+        EVP_PKEY_free(cn->pkey);
+    }
+
+    ngx_free(cn);
+
+    cache->current--;
+}
+
+
+static void
+ngx_ssl_cache_cleanup(void *data)
+{
+    ngx_ssl_cache_t  *cache = data;
+
+    ngx_queue_t           *q;
+    ngx_ssl_cache_node_t  *cn;
+
+    while (!ngx_queue_empty(&cache->expire_queue)) {
+        q = ngx_queue_head(&cache->expire_queue);
+        cn = ngx_queue_data(q, ngx_ssl_cache_node_t, queue);
+
+        ngx_ssl_cache_delete(cache, cn);
+    }
+}
+
+#endif
+
+
 static int
 ngx_ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
 {
     ngx_str_t *pwd = userdata;
 
+    if (pwd == NULL) {
+        return 0;
+    }
+
     if (rwflag) {
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ngx_ssl_password_callback() is called for encryption");
@@ -1030,6 +1727,69 @@ cleanup:
 }
 
 
+ngx_array_t *
+ngx_ssl_preserve_passwords(ngx_conf_t *cf, ngx_array_t *passwords)
+{
+    ngx_str_t           *opwd, *pwd;
+    ngx_uint_t           i;
+    ngx_array_t         *pwds;
+    ngx_pool_cleanup_t  *cln;
+    static ngx_array_t   empty_passwords;
+
+    if (passwords == NULL) {
+
+        /*
+         * If there are no passwords, an empty array is used
+         * to make sure OpenSSL's default password callback
+         * won't block on reading from stdin.
+         */
+
+        return &empty_passwords;
+    }
+
+    /*
+     * Passwords are normally allocated from the temporary pool
+     * and cleared after parsing configuration.  To be used at
+     * runtime they have to be copied to the configuration pool.
+     */
+
+    pwds = ngx_array_create(cf->pool, passwords->nelts, sizeof(ngx_str_t));
+    if (pwds == NULL) {
+        return NULL;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_ssl_passwords_cleanup;
+    cln->data = pwds;
+
+    opwd = passwords->elts;
+
+    for (i = 0; i < passwords->nelts; i++) {
+
+        pwd = ngx_array_push(pwds);
+        if (pwd == NULL) {
+            return NULL;
+        }
+
+        pwd->len = opwd[i].len;
+        pwd->data = ngx_pnalloc(cf->pool, pwd->len);
+
+        if (pwd->data == NULL) {
+            pwds->nelts--;
+            return NULL;
+        }
+
+        ngx_memcpy(pwd->data, opwd[i].data, opwd[i].len);
+    }
+
+    return pwds;
+}
+
+
 static void
 ngx_ssl_passwords_cleanup(void *data)
 {
@@ -1169,17 +1929,46 @@ ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name)
 
 
 ngx_int_t
-ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+ngx_ssl_certificate_compression(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_uint_t enable)
 {
     if (!enable) {
         return NGX_OK;
     }
 
-#ifdef SSL_ERROR_EARLY_DATA_REJECTED
+#ifdef SSL_OP_NO_TX_CERTIFICATE_COMPRESSION
 
-    /* BoringSSL */
+    /* RFC 8879, compressed certificates are prepared once per context */
 
-    SSL_CTX_set_early_data_enabled(ssl->ctx, 1);
+    SSL_CTX_clear_options(ssl->ctx, SSL_OP_NO_TX_CERTIFICATE_COMPRESSION);
+
+    if (SSL_CTX_compress_certs(ssl->ctx, 0) == 0) {
+        ngx_ssl_error(NGX_LOG_WARN, ssl->log, 0,
+                      "SSL_CTX_compress_certs() failed, ignored");
+    }
+
+#else
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_certificate_compression\" is not supported "
+                  "on this platform, ignored");
+#endif
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+{
+    if (!enable) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_ERROR_EARLY_DATA_REJECTED
+
+    /* BoringSSL */
+
+    SSL_CTX_set_early_data_enabled(ssl->ctx, 1);
 
 #else
     ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
@@ -1204,10 +1993,61 @@ ngx_ssl_client_session_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
 
     SSL_CTX_sess_set_new_cb(ssl->ctx, ngx_ssl_new_client_session);
 
+    ngx_ssl_client_session_tag(ssl);
+
     return NGX_OK;
 }
 
 
+static void
+ngx_ssl_client_session_tag(ngx_ssl_t *ssl)
+{
+    int                    i, n;
+    long                   options;
+    uint32_t               crc;
+    const char            *name;
+    STACK_OF(SSL_CIPHER)  *ciphers;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+    X509                  *x509;
+    u_int                  len;
+    u_char                 buf[EVP_MAX_MD_SIZE];
+#endif
+
+    /*
+     * sessions stored in a shared cache are only used by contexts
+     * with the same protocols, ciphers, and client certificate,
+     * hence these are hashed into a tag which is a part of the key
+     */
+
+    ngx_crc32_init(crc);
+
+    options = SSL_CTX_get_options(ssl->ctx);
+    ngx_crc32_update(&crc, (u_char *) &options, sizeof(long));
+
+    ciphers = SSL_CTX_get_ciphers(ssl->ctx);
+    n = ciphers ? sk_SSL_CIPHER_num(ciphers) : 0;
+
+    for (i = 0; i < n; i++) {
+        name = SSL_CIPHER_get_name(sk_SSL_CIPHER_value(ciphers, i));
+        ngx_crc32_update(&crc, (u_char *) name, ngx_strlen(name));
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+
+    x509 = SSL_CTX_get0_certificate(ssl->ctx);
+
+    if (x509 && X509_digest(x509, EVP_sha1(), buf, &len)) {
+        ngx_crc32_update(&crc, buf, len);
+    }
+
+#endif
+
+    ngx_crc32_final(crc);
+
+    ssl->session_tag = crc;
+}
+
+
 static int
 ngx_ssl_new_client_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 {
@@ -1227,6 +2067,337 @@ ngx_ssl_new_client_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 }
 
 
+/*
+ * the shared client session cache keeps several sessions for each key,
+ * normally a context tag, a peer address, and a server name; TLS 1.3
+ * sessions are only used once as recommended by RFC 8446
+ */
+
+ngx_int_t
+ngx_ssl_client_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_ssl_client_session_cache_t  *ocache = data;
+
+    size_t                           len;
+    ngx_slab_pool_t                 *shpool;
+    ngx_ssl_client_session_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    cache->shpool = shpool;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = shpool->data;
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(shpool,
+                               sizeof(ngx_ssl_client_session_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in SSL client session cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in SSL client session cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_set_cached_client_session(ngx_connection_t *c,
+    ngx_shm_zone_t *shm_zone, ngx_str_t *key)
+{
+    size_t                           len;
+    time_t                           now;
+    uint32_t                         hash;
+    ngx_int_t                        rc;
+    ngx_uint_t                       i, n;
+    const u_char                    *p;
+    ngx_slab_pool_t                 *shpool;
+    ngx_ssl_session_t               *sess;
+    ngx_ssl_client_session_node_t   *sn;
+    ngx_ssl_client_session_cache_t  *cache;
+    u_char                           buf[NGX_SSL_MAX_SESSION_SIZE];
+
+    cache = shm_zone->data;
+    shpool = cache->shpool;
+
+    hash = ngx_crc32_long(key->data, key->len);
+    now = ngx_time();
+    len = 0;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = (ngx_ssl_client_session_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, key, hash);
+
+    if (sn) {
+
+        /* the most recent session first */
+
+        for (n = 0; n < NGX_SSL_CLIENT_SESSIONS; n++) {
+            i = (sn->last + NGX_SSL_CLIENT_SESSIONS - n)
+                % NGX_SSL_CLIENT_SESSIONS;
+
+            if (sn->session[i] == NULL) {
+                continue;
+            }
+
+            if (sn->expire[i] <= now) {
+                ngx_ssl_free_client_session(cache, sn, i);
+                continue;
+            }
+
+            len = sn->len[i];
+            ngx_memcpy(buf, sn->session[i], len);
+
+            if (sn->single[i]) {
+                ngx_ssl_free_client_session(cache, sn, i);
+            }
+
+            break;
+        }
+
+        for (n = 0; n < NGX_SSL_CLIENT_SESSIONS; n++) {
+            if (sn->session[n]) {
+                break;
+            }
+        }
+
+        if (n == NGX_SSL_CLIENT_SESSIONS) {
+            ngx_queue_remove(&sn->queue);
+            ngx_rbtree_delete(&cache->sh->rbtree, &sn->sn.node);
+            ngx_slab_free_locked(shpool, sn);
+        }
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl cached client session: \"%V\", %uz bytes",
+                   key, len);
+
+    if (len == 0) {
+        return NGX_DECLINED;
+    }
+
+    p = buf;
+
+    sess = d2i_SSL_SESSION(NULL, &p, len);
+    if (sess == NULL) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "d2i_SSL_SESSION() failed");
+        return NGX_DECLINED;
+    }
+
+    rc = ngx_ssl_set_session(c, sess);
+
+    ngx_ssl_free_session(sess);
+
+    return rc;
+}
+
+
+void
+ngx_ssl_cache_client_session(ngx_connection_t *c, ngx_shm_zone_t *shm_zone,
+    ngx_str_t *key)
+{
+    int                              len;
+    u_char                          *p, *data, single;
+    time_t                           expire;
+    uint32_t                         hash;
+    ngx_uint_t                       i;
+    ngx_slab_pool_t                 *shpool;
+    ngx_ssl_session_t               *sess;
+    ngx_ssl_client_session_node_t   *sn;
+    ngx_ssl_client_session_cache_t  *cache;
+    u_char                           buf[NGX_SSL_MAX_SESSION_SIZE];
+
+    sess = ngx_ssl_get0_session(c);
+    if (sess == NULL) {
+        return;
+    }
+
+    len = i2d_SSL_SESSION(sess, NULL);
+
+    /* do not cache too big session */
+
+    if (len > NGX_SSL_MAX_SESSION_SIZE) {
+        return;
+    }
+
+    p = buf;
+    i2d_SSL_SESSION(sess, &p);
+
+    expire = SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+
+#ifdef TLS1_3_VERSION
+    single = (SSL_SESSION_get_protocol_version(sess) == TLS1_3_VERSION);
+#else
+    single = 0;
+#endif
+
+    cache = shm_zone->data;
+    shpool = cache->shpool;
+
+    hash = ngx_crc32_long(key->data, key->len);
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    sn = (ngx_ssl_client_session_node_t *)
+             ngx_str_rbtree_lookup(&cache->sh->rbtree, key, hash);
+
+    if (sn == NULL) {
+        sn = (ngx_ssl_client_session_node_t *) ngx_ssl_alloc_client_session(
+                cache, NULL, sizeof(ngx_ssl_client_session_node_t) + key->len);
+        if (sn == NULL) {
+            goto failed;
+        }
+
+        ngx_memzero(sn, sizeof(ngx_ssl_client_session_node_t));
+
+        sn->sn.str.len = key->len;
+        sn->sn.str.data = (u_char *) sn + sizeof(ngx_ssl_client_session_node_t);
+        ngx_memcpy(sn->sn.str.data, key->data, key->len);
+
+        sn->sn.node.key = hash;
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &sn->sn.node);
+
+    } else {
+        ngx_queue_remove(&sn->queue);
+    }
+
+    ngx_queue_insert_head(&cache->sh->queue, &sn->queue);
+
+    i = (sn->last + 1) % NGX_SSL_CLIENT_SESSIONS;
+
+    if (sn->session[i]) {
+        ngx_ssl_free_client_session(cache, sn, i);
+    }
+
+    data = ngx_ssl_alloc_client_session(cache, sn, len);
+    if (data == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(data, buf, len);
+
+    sn->session[i] = data;
+    sn->len[i] = (u_short) len;
+    sn->expire[i] = expire;
+    sn->single[i] = single;
+    sn->last = i;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl cache client session: \"%V\", %d bytes", key, len);
+
+    return;
+
+failed:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "could not allocate client session%s", shpool->log_ctx);
+}
+
+
+static u_char *
+ngx_ssl_alloc_client_session(ngx_ssl_client_session_cache_t *cache,
+    ngx_ssl_client_session_node_t *sn, size_t size)
+{
+    u_char  *p;
+
+    p = ngx_slab_alloc_locked(cache->shpool, size);
+
+    if (p == NULL) {
+
+        /* drop the least recently used keys and try again */
+
+        ngx_ssl_expire_client_sessions(cache, sn);
+
+        p = ngx_slab_alloc_locked(cache->shpool, size);
+    }
+
+    return p;
+}
+
+
+static void
+ngx_ssl_free_client_session(ngx_ssl_client_session_cache_t *cache,
+    ngx_ssl_client_session_node_t *sn, ngx_uint_t i)
+{
+    ngx_slab_free_locked(cache->shpool, sn->session[i]);
+
+    sn->session[i] = NULL;
+    sn->len[i] = 0;
+}
+
+
+static void
+ngx_ssl_expire_client_sessions(ngx_ssl_client_session_cache_t *cache,
+    ngx_ssl_client_session_node_t *sn)
+{
+    ngx_uint_t                      i, n;
+    ngx_queue_t                    *q;
+    ngx_ssl_client_session_node_t  *old;
+
+    /* the node being updated is kept */
+
+    for (n = 0; n < 2; n++) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        old = ngx_queue_data(q, ngx_ssl_client_session_node_t, queue);
+
+        if (old == sn) {
+            return;
+        }
+
+        for (i = 0; i < NGX_SSL_CLIENT_SESSIONS; i++) {
+            if (old->session[i]) {
+                ngx_ssl_free_client_session(cache, old, i);
+            }
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &old->sn.node);
+        ngx_slab_free_locked(cache->shpool, old);
+    }
+}
+
+
 ngx_int_t
 ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 {
@@ -1239,11 +2410,18 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
 
     sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
     sc->buffer_size = ssl->buffer_size;
+    sc->dyn_rec_threshold = ssl->dyn_rec_threshold;
+    sc->dyn_rec_timeout = ssl->dyn_rec_timeout;
 
     sc->session_ctx = ssl->ctx;
+    sc->handshake_start = ngx_current_msec;
+
+    ngx_ssl_memory_owner_set(sc);
 
     sc->connection = SSL_new(ssl->ctx);
 
+    ngx_ssl_memory_owner_set(NULL);
+
     if (sc->connection == NULL) {
         ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "SSL_new() failed");
         return NGX_ERROR;
@@ -1315,19 +2493,72 @@ ngx_ssl_set_session(ngx_connection_t *c, ngx_ssl_session_t *session)
 }
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_connection_t           *connection;
+    BIO                        *bio;
+    int                         n;
+    int                         sslerr;
+    ngx_err_t                   err;
+    ngx_uint_t                  closed;
+    unsigned                    read_ready:1;
+    unsigned                    write_ready:1;
+} ngx_ssl_handshake_ctx_t;
+
+#endif
+
+
 ngx_int_t
 ngx_ssl_handshake(ngx_connection_t *c)
 {
     int        n, sslerr;
     ngx_err_t  err;
+#if (NGX_THREADS)
+    ngx_int_t  rc;
+#endif
 
     ngx_ssl_clear_error(c->log);
 
+    ngx_ssl_memory_owner_set(c->ssl);
+
     n = SSL_do_handshake(c->ssl->connection);
 
+    ngx_ssl_memory_owner_set(NULL);
+
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
     if (n == 1) {
+        return ngx_ssl_handshake_done(c);
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+#if (NGX_THREADS)
+
+    if (sslerr == SSL_ERROR_WANT_X509_LOOKUP && c->ssl->handshake_offload) {
+
+        /* the rest of the handshake step is done in a thread */
+
+        rc = ngx_ssl_handshake_thread(c);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
+        /* the thread pool queue is full, the handshake is done inline */
+
+        return ngx_ssl_handshake(c);
+    }
+
+#endif
+
+    if (sslerr == SSL_ERROR_WANT_READ) {
+        c->read->ready = 0;
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
 
         if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
             return NGX_ERROR;
@@ -1337,153 +2568,527 @@ ngx_ssl_handshake(ngx_connection_t *c)
             return NGX_ERROR;
         }
 
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+        c->write->ready = 0;
+        c->read->handler = ngx_ssl_handshake_handler;
+        c->write->handler = ngx_ssl_handshake_handler;
+
+        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->read->eof = 1;
+
+#if (NGX_STAT_STUB)
+    ngx_ssl_handshake_stat(c);
+#endif
+
+    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+        ngx_connection_error(c, err,
+                             "peer closed connection in SSL handshake");
+
+        return NGX_ERROR;
+    }
+
+    c->read->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_ssl_handshake_done(ngx_connection_t *c)
+{
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
 #if (NGX_DEBUG)
-        {
-        char         buf[129], *s, *d;
+    {
+    char         buf[129], *s, *d;
 #if OPENSSL_VERSION_NUMBER >= 0x10000000L
-        const
+    const
 #endif
-        SSL_CIPHER  *cipher;
+    SSL_CIPHER  *cipher;
+
+    cipher = SSL_get_current_cipher(c->ssl->connection);
+
+    if (cipher) {
+        SSL_CIPHER_description(cipher, &buf[1], 128);
+
+        for (s = &buf[1], d = buf; *s; s++) {
+            if (*s == ' ' && *d == ' ') {
+                continue;
+            }
+
+            if (*s == LF || *s == CR) {
+                continue;
+            }
+
+            *++d = *s;
+        }
+
+        if (*d != ' ') {
+            d++;
+        }
+
+        *d = '\0';
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL: %s, cipher: \"%s\"",
+                       SSL_get_version(c->ssl->connection), &buf[1]);
+
+        if (SSL_session_reused(c->ssl->connection)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "SSL reused session");
+        }
+
+    } else {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL no shared ciphers");
+    }
+    }
+#endif
+
+    /* handshake flight sizes, including record headers */
+
+    c->ssl->handshake_sent =
+                        BIO_number_written(SSL_get_wbio(c->ssl->connection));
+    c->ssl->handshake_received =
+                        BIO_number_read(SSL_get_rbio(c->ssl->connection));
+
+    c->ssl->handshake_time = ngx_current_msec - c->ssl->handshake_start;
+
+    c->ssl->handshaked = 1;
+
+#if (NGX_STAT_STUB)
+    ngx_ssl_handshake_stat(c);
+#endif
+
+    c->recv = ngx_ssl_recv;
+    c->send = ngx_ssl_write;
+    c->recv_chain = ngx_ssl_recv_chain;
+    c->send_chain = ngx_ssl_send_chain;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
+
+    /* initial handshake done, disable renegotiation (CVE-2009-3555) */
+    if (c->ssl->connection->s3 && SSL_is_server(c->ssl->connection)) {
+        c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
+    }
+
+#endif
+#endif
+
+    return NGX_OK;
+}
+
+
+#if (NGX_STAT_STUB)
+
+static void
+ngx_ssl_handshake_stat(ngx_connection_t *c)
+{
+    int                 nid;
+    ngx_uint_t          i;
+    ngx_ssl_stat_t     *stat;
+#if OPENSSL_VERSION_NUMBER >= 0x10000000L
+    const
+#endif
+    SSL_CIPHER         *cipher;
+
+    if (!SSL_is_server(c->ssl->connection)) {
+        return;
+    }
+
+    stat = ngx_ssl_stat;
+
+    if (!c->ssl->handshaked) {
+        (void) ngx_atomic_fetch_add(&stat->failed, 1);
+        return;
+    }
+
+    if (!SSL_session_reused(c->ssl->connection)) {
+        (void) ngx_atomic_fetch_add(&stat->full, 1);
+
+    } else if (c->ssl->session_cached) {
+        (void) ngx_atomic_fetch_add(&stat->cache, 1);
+
+    } else {
+        (void) ngx_atomic_fetch_add(&stat->ticket, 1);
+    }
+
+    for (i = 0; i < NGX_SSL_STAT_TIMES - 1; i++) {
+        if (c->ssl->handshake_time <= ngx_ssl_stat_times[i]) {
+            break;
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(&stat->time[i], 1);
+
+    cipher = SSL_get_current_cipher(c->ssl->connection);
+
+    if (cipher) {
+        ngx_ssl_stat_slot(stat->ciphers, SSL_CIPHER_get_id(cipher),
+                          SSL_CIPHER_get_name(cipher));
+    }
+
+#ifdef SSL_get_negotiated_group
+
+    nid = SSL_get_negotiated_group(c->ssl->connection);
+
+    if (nid > 0 && !(nid & TLSEXT_nid_unknown)) {
+        ngx_ssl_stat_slot(stat->groups, nid, OBJ_nid2sn(nid));
+    }
+
+#else
+    (void) nid;
+#endif
+}
+
+
+static void
+ngx_ssl_stat_slot(ngx_ssl_stat_slot_t *slot, ngx_atomic_uint_t id,
+    const char *name)
+{
+    ngx_uint_t  i;
+
+    /*
+     * slots are claimed by the first connection with the id,
+     * ids not fitting into the table are not counted
+     */
+
+    for (i = 0; i < NGX_SSL_STAT_SLOTS; i++) {
+
+        if (slot[i].id == 0 && ngx_atomic_cmp_set(&slot[i].id, 0, id)) {
+            if (name) {
+                ngx_cpystrn(slot[i].name, (u_char *) name,
+                            NGX_SSL_STAT_NAME_LEN);
+            }
+        }
+
+        if (slot[i].id == id) {
+            (void) ngx_atomic_fetch_add(&slot[i].count, 1);
+            return;
+        }
+    }
+}
+
+#endif
+
+
+static void
+ngx_ssl_handshake_handler(ngx_event_t *ev)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake handler: %d", ev->write);
+
+#if (NGX_THREADS)
+
+    if (c->ssl->handshake_task && c->ssl->handshake_task->event.active) {
+
+        /*
+         * the handshake is in progress in a thread, the connection
+         * cannot be used until it completes; the event readiness
+         * and the timeout are checked on completion
+         */
+
+        return;
+    }
+
+#endif
+
+    if (ev->timedout) {
+        c->ssl->handler(c);
+        return;
+    }
+
+    if (ngx_ssl_handshake(c) == NGX_AGAIN) {
+        return;
+    }
+
+    c->ssl->handler(c);
+}
+
+
+#if (NGX_THREADS)
+
+/*
+ * The certificate callback is called after the SNI, session resumption
+ * and session ticket callbacks, and before the private key operation
+ * of a full handshake.  It pauses the handshake on the first call, and
+ * the handshake step is then resumed in a thread.  The rest of the step
+ * only calls the certificate status and ALPN callbacks, which do not
+ * modify connection or configuration data; later handshake steps are
+ * done inline.
+ */
+
+int
+ngx_ssl_offload_handshake(ngx_ssl_conn_t *ssl_conn, void *data)
+{
+    ngx_ssl_t  *ssl = data;
+
+    ngx_connection_t  *c;
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    if (ssl->thread_pool == NULL
+        || c->ssl->handshake_offload
+        || !(ngx_event_flags & NGX_USE_CLEAR_EVENT))
+    {
+        return 1;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL handshake offload");
+
+    c->ssl->thread_pool = ssl->thread_pool;
+    c->ssl->handshake_offload = 1;
+
+    return -1;
+}
+
+
+static ngx_int_t
+ngx_ssl_handshake_thread(ngx_connection_t *c)
+{
+    ngx_thread_task_t        *task;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    task = c->ssl->handshake_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(c->pool, sizeof(ngx_ssl_handshake_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_ssl_handshake_thread_handler;
+
+        c->ssl->handshake_task = task;
+    }
+
+    ctx = task->ctx;
+
+    /*
+     * nothing is read in the thread, so the handshake step stops once
+     * the next flight of the peer is expected, and the session and
+     * session ticket callbacks are only called inline
+     */
+
+    ctx->bio = BIO_new(BIO_s_mem());
+    if (ctx->bio == NULL) {
+        ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "BIO_new() failed");
+        return NGX_ERROR;
+    }
+
+    BIO_set_mem_eof_return(ctx->bio, -1);
+
+    ctx->connection = c;
+    ctx->read_ready = c->read->ready;
+    ctx->write_ready = c->write->ready;
 
-        cipher = SSL_get_current_cipher(c->ssl->connection);
+    /* events reported while the task runs mark the connection ready again */
 
-        if (cipher) {
-            SSL_CIPHER_description(cipher, &buf[1], 128);
+    c->read->ready = 0;
+    c->write->ready = 0;
 
-            for (s = &buf[1], d = buf; *s; s++) {
-                if (*s == ' ' && *d == ' ') {
-                    continue;
-                }
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
 
-                if (*s == LF || *s == CR) {
-                    continue;
-                }
+    task->event.data = c;
+    task->event.handler = ngx_ssl_handshake_thread_event_handler;
 
-                *++d = *s;
-            }
+    if (ngx_thread_task_post(c->ssl->thread_pool, task) != NGX_OK) {
+        c->read->ready = ctx->read_ready;
+        c->write->ready = ctx->write_ready;
 
-            if (*d != ' ') {
-                d++;
-            }
+        BIO_free(ctx->bio);
 
-            *d = '\0';
+        return NGX_DECLINED;
+    }
 
-            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "SSL: %s, cipher: \"%s\"",
-                           SSL_get_version(c->ssl->connection), &buf[1]);
+    return NGX_AGAIN;
+}
 
-            if (SSL_session_reused(c->ssl->connection)) {
-                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                               "SSL reused session");
-            }
 
-        } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                           "SSL no shared ciphers");
-        }
-        }
+static void
+ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_ssl_handshake_ctx_t *ctx = data;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    BIO               *rbio;
 #endif
+    ngx_connection_t  *c;
 
-        c->ssl->handshaked = 1;
+    c = ctx->connection;
 
-        c->recv = ngx_ssl_recv;
-        c->send = ngx_ssl_write;
-        c->recv_chain = ngx_ssl_recv_chain;
-        c->send_chain = ngx_ssl_send_chain;
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "SSL handshake thread");
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-#ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
+    ngx_ssl_clear_error(c->log);
 
-        /* initial handshake done, disable renegotiation (CVE-2009-3555) */
-        if (c->ssl->connection->s3 && SSL_is_server(c->ssl->connection)) {
-            c->ssl->connection->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
-        }
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+    rbio = SSL_get_rbio(c->ssl->connection);
+
+    BIO_up_ref(rbio);
+    SSL_set0_rbio(c->ssl->connection, ctx->bio);
 
-#endif
 #endif
 
-        return NGX_OK;
-    }
+    ngx_ssl_memory_owner_set(c->ssl);
 
-    sslerr = SSL_get_error(c->ssl->connection, n);
+    ctx->n = SSL_do_handshake(c->ssl->connection);
 
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+    ngx_ssl_memory_owner_set(NULL);
 
-    if (sslerr == SSL_ERROR_WANT_READ) {
-        c->read->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
+    ctx->sslerr = 0;
+    ctx->err = 0;
+    ctx->closed = 0;
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    if (ctx->n != 1) {
+        ctx->sslerr = SSL_get_error(c->ssl->connection, ctx->n);
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
+        if (ctx->sslerr == SSL_ERROR_SYSCALL) {
+            ctx->err = ngx_errno;
         }
-
-        return NGX_AGAIN;
     }
 
-    if (sslerr == SSL_ERROR_WANT_WRITE) {
-        c->write->ready = 0;
-        c->read->handler = ngx_ssl_handshake_handler;
-        c->write->handler = ngx_ssl_handshake_handler;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
 
-        if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    /* the memory BIO is freed */
 
-        if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
-            return NGX_ERROR;
-        }
+    SSL_set0_rbio(c->ssl->connection, rbio);
 
-        return NGX_AGAIN;
+#endif
+
+    if (ctx->n == 1
+        || ctx->sslerr == SSL_ERROR_WANT_READ
+        || ctx->sslerr == SSL_ERROR_WANT_WRITE)
+    {
+        return;
     }
 
-    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+    /* the error queue is thread local, so errors are logged here */
 
-    c->ssl->no_wait_shutdown = 1;
-    c->ssl->no_send_shutdown = 1;
-    c->read->eof = 1;
+    if (ctx->sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+        ctx->closed = 1;
 
-    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
-        ngx_connection_error(c, err,
+        ngx_connection_error(c, ctx->err,
                              "peer closed connection in SSL handshake");
-
-        return NGX_ERROR;
+        return;
     }
 
-    c->read->error = 1;
-
-    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
-
-    return NGX_ERROR;
+    ngx_ssl_connection_error(c, ctx->sslerr, ctx->err,
+                             "SSL_do_handshake() failed");
 }
 
 
 static void
-ngx_ssl_handshake_handler(ngx_event_t *ev)
+ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev)
 {
-    ngx_connection_t  *c;
+    ngx_int_t                 rc;
+    ngx_connection_t         *c;
+    ngx_ssl_handshake_ctx_t  *ctx;
 
     c = ev->data;
+    ctx = c->ssl->handshake_task->ctx;
 
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "SSL handshake handler: %d", ev->write);
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_do_handshake: %d, SSL_get_error: %d",
+                   ctx->n, ctx->sslerr);
 
-    if (ev->timedout) {
+    if (ctx->read_ready) {
+        c->read->ready = 1;
+    }
+
+    if (ctx->write_ready && ctx->sslerr != SSL_ERROR_WANT_WRITE) {
+        c->write->ready = 1;
+    }
+
+    if (c->read->timedout || c->write->timedout) {
         c->ssl->handler(c);
         return;
     }
 
-    if (ngx_ssl_handshake(c) == NGX_AGAIN) {
+    ngx_ssl_stapling_check(c);
+
+    if (ctx->n == 1) {
+        rc = ngx_ssl_handshake_done(c);
+
+    } else if (ctx->sslerr == SSL_ERROR_WANT_READ) {
+
+        /* the socket was not read in the thread */
+
+        rc = ngx_ssl_handshake(c);
+
+    } else if (ctx->sslerr == SSL_ERROR_WANT_WRITE) {
+
+        if (c->write->ready) {
+
+            /* the event was reported while the task was running */
+
+            rc = ngx_ssl_handshake(c);
+
+        } else if (ngx_handle_read_event(c->read, 0) != NGX_OK
+                   || ngx_handle_write_event(c->write, 0) != NGX_OK)
+        {
+            rc = NGX_ERROR;
+
+        } else {
+            rc = NGX_AGAIN;
+        }
+
+    } else {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+        c->read->eof = 1;
+
+#if (NGX_STAT_STUB)
+        ngx_ssl_handshake_stat(c);
+#endif
+
+        if (!ctx->closed) {
+            c->read->error = 1;
+        }
+
+        rc = NGX_ERROR;
+    }
+
+    if (rc == NGX_AGAIN) {
         return;
     }
 
     c->ssl->handler(c);
 }
 
+#endif
+
 
 ssize_t
 ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit)
@@ -1571,8 +3176,12 @@ ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size)
 
     for ( ;; ) {
 
+        ngx_ssl_memory_owner_set(c->ssl);
+
         n = SSL_read(c->ssl->connection, buf, size);
 
+        ngx_ssl_memory_owner_set(NULL);
+
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_read: %d", n);
 
         if (n > 0) {
@@ -1731,6 +3340,36 @@ ngx_ssl_handle_recv(ngx_connection_t *c, int n)
 }
 
 
+/*
+ * Dynamic record sizing: small records at the start of a connection
+ * and after it was idle, so the first bytes can be decrypted as soon as
+ * the first TCP segments arrive, and full-sized records once enough data
+ * was sent and the congestion window is likely to be open.
+ */
+
+static size_t
+ngx_ssl_record_size(ngx_connection_t *c)
+{
+    ngx_ssl_connection_t  *sc;
+
+    sc = c->ssl;
+
+    if (sc->dyn_rec_threshold == 0) {
+        return 0;
+    }
+
+    if (ngx_current_msec - sc->dyn_rec_last > sc->dyn_rec_timeout) {
+        sc->dyn_rec_sent = 0;
+    }
+
+    if (sc->dyn_rec_sent >= sc->dyn_rec_threshold) {
+        return 0;
+    }
+
+    return NGX_SSL_DYN_REC_SIZE;
+}
+
+
 static void
 ngx_ssl_write_handler(ngx_event_t *wev)
 {
@@ -1756,10 +3395,14 @@ ngx_chain_t *
 ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
     int          n;
+    u_char      *end;
+    size_t       record;
     ngx_uint_t   flush;
     ssize_t      send, size;
     ngx_buf_t   *buf;
 
+    record = ngx_ssl_record_size(c);
+
     if (!c->ssl->buffer) {
 
         while (in) {
@@ -1768,7 +3411,13 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
-            n = ngx_ssl_write(c, in->buf->pos, in->buf->last - in->buf->pos);
+            size = in->buf->last - in->buf->pos;
+
+            if (record && size > (ssize_t) record) {
+                size = record;
+            }
+
+            n = ngx_ssl_write(c, in->buf->pos, size);
 
             if (n == NGX_ERROR) {
                 return NGX_CHAIN_ERROR;
@@ -1783,6 +3432,10 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             if (in->buf->pos == in->buf->last) {
                 in = in->next;
             }
+
+            if (record) {
+                record = ngx_ssl_record_size(c);
+            }
         }
 
         return in;
@@ -1820,9 +3473,15 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
     send = buf->last - buf->pos;
     flush = (in == NULL) ? 1 : buf->flush;
 
+    end = buf->end;
+
+    if (record && (size_t) (end - buf->start) > record) {
+        end = buf->start + record;
+    }
+
     for ( ;; ) {
 
-        while (in && buf->last < buf->end && send < limit) {
+        while (in && buf->last < end && send < limit) {
             if (in->buf->last_buf || in->buf->flush) {
                 flush = 1;
             }
@@ -1834,8 +3493,8 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
             size = in->buf->last - in->buf->pos;
 
-            if (size > buf->end - buf->last) {
-                size = buf->end - buf->last;
+            if (size > end - buf->last) {
+                size = end - buf->last;
             }
 
             if (send + size > limit) {
@@ -1856,7 +3515,7 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
             }
         }
 
-        if (!flush && send < limit && buf->last < buf->end) {
+        if (!flush && send < limit && buf->last < end) {
             break;
         }
 
@@ -1892,6 +3551,14 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
         if (in == NULL || send == limit) {
             break;
         }
+
+        if (record) {
+            record = ngx_ssl_record_size(c);
+
+            if (record == 0) {
+                end = buf->end;
+            }
+        }
     }
 
     buf->flush = flush;
@@ -1917,8 +3584,12 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL to write: %uz", size);
 
+    ngx_ssl_memory_owner_set(c->ssl);
+
     n = SSL_write(c->ssl->connection, data, size);
 
+    ngx_ssl_memory_owner_set(NULL);
+
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_write: %d", n);
 
     if (n > 0) {
@@ -1938,6 +3609,11 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 
         c->sent += n;
 
+        if (c->ssl->dyn_rec_threshold) {
+            c->ssl->dyn_rec_sent += n;
+            c->ssl->dyn_rec_last = ngx_current_msec;
+        }
+
         return n;
     }
 
@@ -2223,6 +3899,9 @@ ngx_ssl_connection_error(ngx_connection_t *c, int sslerr, ngx_err_t err,
 #ifdef SSL_R_INAPPROPRIATE_FALLBACK
             || n == SSL_R_INAPPROPRIATE_FALLBACK                     /*  373 */
 #endif
+#ifdef SSL_R_CERT_CB_ERROR
+            || n == SSL_R_CERT_CB_ERROR                              /*  377 */
+#endif
 #ifdef SSL_R_VERSION_TOO_LOW
             || n == SSL_R_VERSION_TOO_LOW                            /*  396 */
 #endif
@@ -2510,36 +4189,106 @@ failed:
 
 
 ngx_int_t
-ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+ngx_ssl_session_cache_zone(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards)
 {
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
     ngx_ssl_session_cache_t  *cache;
 
-    if (data) {
-        shm_zone->data = data;
+    cache = shm_zone->data;
+
+    if (cache == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_cache_t));
+        if (cache == NULL) {
+            return NGX_ERROR;
+        }
+
+        shm_zone->data = cache;
+        shm_zone->init = ngx_ssl_session_cache_init;
+    }
+
+    if (shards == 0) {
+        return NGX_OK;
+    }
+
+    if (cache->nshards && cache->nshards != shards) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "session cache \"%V\" is already declared "
+                           "with %ui shards",
+                           &shm_zone->shm.name, cache->nshards);
+        return NGX_ERROR;
+    }
+
+    if (shm_zone->shm.size < shards * 8 * ngx_pagesize) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "session cache \"%V\" is too small for %ui shards",
+                           &shm_zone->shm.name, shards);
+        return NGX_ERROR;
+    }
+
+    cache->nshards = shards;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_ssl_session_cache_t  *ocache = data;
+
+    u_char                      *p;
+    size_t                       len, size;
+    ngx_uint_t                   i, n;
+    ngx_slab_pool_t             *shpool, *sp;
+    ngx_ssl_session_cache_t     *cache;
+    ngx_ssl_session_shard_t     *shard;
+    ngx_ssl_session_cache_sh_t  *sh;
+
+    cache = shm_zone->data;
+
+    n = cache->nshards ? cache->nshards : 1;
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+    /* shard mutexes would require lock files */
+
+    n = 1;
+
+#endif
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+
+        /* the zone is reused as is, it is only recreated after restart */
+
+        if (cache->sh->nshards != n) {
+            ngx_log_error(NGX_LOG_WARN, shm_zone->shm.log, 0,
+                          "the number of shards in SSL session cache "
+                          "\"%V\" cannot be changed on reload, "
+                          "%ui shards are used",
+                          &shm_zone->shm.name, cache->sh->nshards);
+        }
+
         return NGX_OK;
     }
 
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        shm_zone->data = shpool->data;
+        cache->sh = shpool->data;
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
-    if (cache == NULL) {
+    sh = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_cache_sh_t)
+                                 + (n - 1) * sizeof(ngx_ssl_session_shard_t));
+    if (sh == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = cache;
-    shm_zone->data = cache;
-
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+    shpool->data = sh;
+    cache->sh = sh;
 
-    ngx_queue_init(&cache->expire_queue);
+    sh->nshards = n;
 
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
@@ -2553,10 +4302,70 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     shpool->log_nomem = 0;
 
+    /*
+     * with several shards, the rest of the zone is split into
+     * independent slab pools, each with its own mutex
+     */
+
+    size = (shpool->pfree / n) << ngx_pagesize_shift;
+
+    for (i = 0; i < n; i++) {
+        shard = &sh->shards[i];
+
+        if (n == 1) {
+            sp = shpool;
+
+        } else {
+            p = ngx_slab_alloc(shpool, size);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            sp = (ngx_slab_pool_t *) p;
+
+            sp->end = p + size;
+            sp->min_shift = 3;
+            sp->addr = p;
+
+            if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_slab_init(sp);
+
+            sp->log_ctx = shpool->log_ctx;
+            sp->log_nomem = 0;
+        }
+
+        shard->shpool = sp;
+
+        ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
+
+        ngx_queue_init(&shard->expire_queue);
+
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->evictions = 0;
+    }
+
     return NGX_OK;
 }
 
 
+static ngx_ssl_session_shard_t *
+ngx_ssl_session_shard(ngx_shm_zone_t *shm_zone, uint32_t hash)
+{
+    ngx_ssl_session_cache_t     *cache;
+    ngx_ssl_session_cache_sh_t  *sh;
+
+    cache = shm_zone->data;
+    sh = cache->sh;
+
+    return &sh->shards[hash % sh->nshards];
+}
+
+
 /*
  * The length of the session id is 16 bytes for SSLv2 sessions and
  * between 1 and 32 bytes for SSLv3/TLSv1, typically 32 bytes.
@@ -2571,7 +4380,10 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
  * and an ASN1 representation, they take accordingly 128 and 128 bytes.
  *
  * OpenSSL's i2d_SSL_SESSION() and d2i_SSL_SESSION are slow,
- * so they are outside the code locked by shared pool mutex
+ * so they are outside the code locked by shared pool mutex.
+ *
+ * The cache may be split into several shards selected by the session id
+ * hash, each shard has its own slab pool, mutex, rbtree and expire queue.
  */
 
 static int
@@ -2586,7 +4398,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ngx_connection_t         *c;
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
     len = i2d_SSL_SESSION(sess, NULL);
@@ -2605,13 +4417,26 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ssl_ctx = c->ssl->session_ctx;
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
-    cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
+
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+#else
+
+    session_id = sess->session_id;
+    session_id_length = sess->session_id_length;
+
+#endif
+
+    hash = ngx_crc32_short(session_id, session_id_length);
+
+    shard = ngx_ssl_session_shard(shm_zone, hash);
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(shard, 1);
 
     cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2619,7 +4444,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         cached_sess = ngx_slab_alloc_locked(shpool, len);
 
@@ -2635,7 +4460,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
 
@@ -2644,17 +4469,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
-
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
-#else
-
-    session_id = sess->session_id;
-    session_id_length = sess->session_id_length;
-
-#endif
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
@@ -2667,7 +4481,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(shard, 0);
 
         id = ngx_slab_alloc_locked(shpool, session_id_length);
 
@@ -2682,8 +4496,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%ud:%d",
                    hash, session_id_length, len);
@@ -2696,9 +4508,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
     ngx_shmtx_unlock(&shpool->mutex);
 
@@ -2741,7 +4553,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
     ngx_connection_t         *c;
 
@@ -2756,16 +4568,16 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     shm_zone = SSL_CTX_get_ex_data(c->ssl->session_ctx,
                                    ngx_ssl_session_cache_index);
 
-    cache = shm_zone->data;
+    shard = ngx_ssl_session_shard(shm_zone, hash);
 
     sess = NULL;
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2791,6 +4603,10 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
             if (sess_id->expire > ngx_time()) {
                 ngx_memcpy(buf, sess_id->session, sess_id->len);
 
+                shard->hits++;
+
+                c->ssl->session_cached = 1;
+
                 ngx_shmtx_unlock(&shpool->mutex);
 
                 p = buf;
@@ -2801,7 +4617,7 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2819,6 +4635,8 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
 done:
 
+    shard->misses++;
+
     ngx_shmtx_unlock(&shpool->mutex);
 
     return sess;
@@ -2845,7 +4663,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_slab_pool_t          *shpool;
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shard_t  *shard;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
 
@@ -2853,8 +4671,6 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
         return;
     }
 
-    cache = shm_zone->data;
-
 #if OPENSSL_VERSION_NUMBER >= 0x0090800fL
 
     id = (u_char *) SSL_SESSION_get_id(sess, &len);
@@ -2871,12 +4687,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = ngx_ssl_session_shard(shm_zone, hash);
+    shpool = shard->shpool;
 
     ngx_shmtx_lock(&shpool->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2900,7 +4717,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -2921,22 +4738,23 @@ done:
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
+    ngx_slab_pool_t    *shpool;
     ngx_ssl_sess_id_t  *sess_id;
 
     now = ngx_time();
+    shpool = shard->shpool;
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -2944,12 +4762,16 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
             return;
         }
 
+        if (sess_id->expire > now) {
+            shard->evictions++;
+        }
+
         ngx_queue_remove(q);
 
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
         ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -3018,7 +4840,42 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     ngx_ssl_session_ticket_key_t  *key;
 
     if (paths == NULL) {
-        return NGX_OK;
+
+        /*
+         * without key files, keys are generated in the shared session
+         * cache and rotated every session timeout; the newest key
+         * is used for encryption, older ones are still accepted
+         */
+
+        if (SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_session_cache_index)
+            == NULL)
+        {
+            return NGX_OK;
+        }
+
+#ifdef SSL_OP_NO_TICKET
+        if (SSL_CTX_get_options(ssl->ctx) & SSL_OP_NO_TICKET) {
+            return NGX_OK;
+        }
+#endif
+
+        keys = ngx_array_create(cf->pool, NGX_SSL_TICKET_KEYS,
+                                sizeof(ngx_ssl_session_ticket_key_t));
+        if (keys == NULL) {
+            return NGX_ERROR;
+        }
+
+        key = ngx_array_push_n(keys, NGX_SSL_TICKET_KEYS);
+        if (key == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memzero(key,
+                    NGX_SSL_TICKET_KEYS * sizeof(ngx_ssl_session_ticket_key_t));
+
+        key[0].shared = 1;
+
+        goto set;
     }
 
     keys = ngx_array_create(cf->pool, paths->nelts,
@@ -3081,6 +4938,9 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
             goto failed;
         }
 
+        key->expire = 0;
+        key->shared = 0;
+
         if (size == 48) {
             key->size = 48;
             ngx_memcpy(key->name, buf, 16);
@@ -3100,6 +4960,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         }
     }
 
+set:
+
     if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys)
         == 0)
     {
@@ -3139,12 +5001,13 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
 {
     size_t                         size;
     SSL_CTX                       *ssl_ctx;
-    ngx_uint_t                     i;
+    ngx_uint_t                     i, n;
     ngx_array_t                   *keys;
     ngx_connection_t              *c;
     ngx_ssl_session_ticket_key_t  *key;
     const EVP_MD                  *digest;
     const EVP_CIPHER              *cipher;
+    ngx_ssl_session_ticket_key_t   shared[NGX_SSL_TICKET_KEYS];
 #if (NGX_DEBUG)
     u_char                         buf[32];
 #endif
@@ -3164,6 +5027,15 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     }
 
     key = keys->elts;
+    n = keys->nelts;
+
+    if (key[0].shared) {
+        if (ngx_ssl_rotate_ticket_keys(ssl_ctx, c->log, shared) != NGX_OK) {
+            return -1;
+        }
+
+        key = shared;
+    }
 
     if (enc == 1) {
         /* encrypt session ticket */
@@ -3209,8 +5081,8 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     } else {
         /* decrypt session ticket */
 
-        for (i = 0; i < keys->nelts; i++) {
-            if (ngx_memcmp(name, key[i].name, 16) == 0) {
+        for (i = 0; i < n; i++) {
+            if (key[i].size && ngx_memcmp(name, key[i].name, 16) == 0) {
                 goto found;
             }
         }
@@ -3256,6 +5128,88 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     }
 }
 
+
+static ngx_int_t
+ngx_ssl_rotate_ticket_keys(SSL_CTX *ssl_ctx, ngx_log_t *log,
+    ngx_ssl_session_ticket_key_t *out)
+{
+    time_t                         now;
+    ngx_int_t                      rc;
+    ngx_array_t                   *keys;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_slab_pool_t               *shpool;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key, *skey;
+    u_char                         buf[80];
+#if (NGX_DEBUG)
+    u_char                         name[32];
+#endif
+
+    /*
+     * each worker keeps a copy of the shared keys and only looks
+     * into the shared memory once the newest key expires
+     */
+
+    keys = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_ticket_keys_index);
+    key = keys->elts;
+
+    now = ngx_time();
+    rc = NGX_OK;
+
+    if (key[0].expire > now) {
+        goto done;
+    }
+
+    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    cache = shm_zone->data;
+    skey = cache->sh->ticket_keys;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (skey[0].expire <= now) {
+
+        if (RAND_bytes(buf, 80) != 1) {
+            ngx_shmtx_unlock(&shpool->mutex);
+
+            ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+            rc = NGX_ERROR;
+            goto done;
+        }
+
+        ngx_memmove(&skey[1], &skey[0], (NGX_SSL_TICKET_KEYS - 1)
+                                        * sizeof(ngx_ssl_session_ticket_key_t));
+
+        skey[0].size = 80;
+        ngx_memcpy(skey[0].name, buf, 16);
+        ngx_memcpy(skey[0].hmac_key, buf + 16, 32);
+        ngx_memcpy(skey[0].aes_key, buf + 48, 32);
+
+        skey[0].expire = now + SSL_CTX_get_timeout(ssl_ctx);
+        skey[0].shared = 1;
+
+        OPENSSL_cleanse(buf, 80);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "ssl session ticket key rotated: \"%*s\"",
+                       ngx_hex_dump(name, skey[0].name, 16) - name, name);
+    }
+
+    ngx_memcpy(key, skey,
+               NGX_SSL_TICKET_KEYS * sizeof(ngx_ssl_session_ticket_key_t));
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+done:
+
+    ngx_memcpy(out, key,
+               NGX_SSL_TICKET_KEYS * sizeof(ngx_ssl_session_ticket_key_t));
+
+    return rc;
+}
+
 #else
 
 ngx_int_t
@@ -3678,6 +5632,208 @@ ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 }
 
 
+ngx_int_t
+ngx_ssl_get_handshake_bytes_sent(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    s->data = ngx_pnalloc(pool, NGX_SIZE_T_LEN);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(s->data, "%uz", c->ssl->handshake_sent) - s->data;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_handshake_bytes_received(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    s->data = ngx_pnalloc(pool, NGX_SIZE_T_LEN);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(s->data, "%uz", c->ssl->handshake_received)
+             - s->data;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    if (!c->ssl->handshaked) {
+        s->len = 0;
+        return NGX_OK;
+    }
+
+    s->data = ngx_pnalloc(pool, NGX_TIME_T_LEN + 4);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(s->data, "%T.%03M",
+                         (time_t) c->ssl->handshake_time / 1000,
+                         c->ssl->handshake_time % 1000)
+             - s->data;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_session_resumption(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    if (!SSL_session_reused(c->ssl->connection)) {
+        s->len = 0;
+        return NGX_OK;
+    }
+
+    if (c->ssl->session_cached) {
+        ngx_str_set(s, "cache");
+
+    } else {
+        ngx_str_set(s, "ticket");
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_memory(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    ssize_t  size;
+
+#if (NGX_SSL_MEMORY_OWNER)
+
+    if (!ngx_ssl_memory_accounting) {
+        s->len = 0;
+        return NGX_OK;
+    }
+
+#else
+
+    /* the accounting is not available */
+
+    s->len = 0;
+    return NGX_OK;
+
+#endif
+
+    size = c->ssl->memory;
+
+    if (c->ssl->buf && c->ssl->buf->start) {
+        size += c->ssl->buf->end - c->ssl->buf->start;
+    }
+
+    s->data = ngx_pnalloc(pool, NGX_ATOMIC_T_LEN);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(s->data, "%z", size) - s->data;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_worker_memory(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
+{
+    if (!ngx_ssl_memory_accounting) {
+        s->len = 0;
+        return NGX_OK;
+    }
+
+    s->data = ngx_pnalloc(pool, NGX_ATOMIC_T_LEN);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(s->data, "%A", (ngx_atomic_int_t) ngx_ssl_memory)
+             - s->data;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_get_session_cache_hits(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    return ngx_ssl_get_session_cache_stat(c, pool, s,
+                                   offsetof(ngx_ssl_session_shard_t, hits));
+}
+
+
+ngx_int_t
+ngx_ssl_get_session_cache_misses(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    return ngx_ssl_get_session_cache_stat(c, pool, s,
+                                   offsetof(ngx_ssl_session_shard_t, misses));
+}
+
+
+ngx_int_t
+ngx_ssl_get_session_cache_evictions(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s)
+{
+    return ngx_ssl_get_session_cache_stat(c, pool, s,
+                                offsetof(ngx_ssl_session_shard_t, evictions));
+}
+
+
+static ngx_int_t
+ngx_ssl_get_session_cache_stat(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s, size_t offset)
+{
+    ngx_uint_t                   i;
+    ngx_atomic_uint_t            n;
+    ngx_shm_zone_t              *shm_zone;
+    ngx_ssl_session_cache_t     *cache;
+    ngx_ssl_session_cache_sh_t  *sh;
+
+    s->len = 0;
+
+    if (c->ssl->session_ctx == NULL) {
+        return NGX_OK;
+    }
+
+    shm_zone = SSL_CTX_get_ex_data(c->ssl->session_ctx,
+                                   ngx_ssl_session_cache_index);
+
+    if (shm_zone == NULL) {
+        return NGX_OK;
+    }
+
+    cache = shm_zone->data;
+    sh = cache->sh;
+
+    n = 0;
+
+    for (i = 0; i < sh->nshards; i++) {
+        n += *(ngx_atomic_t *) ((u_char *) &sh->shards[i] + offset);
+    }
+
+    s->data = ngx_pnalloc(pool, NGX_ATOMIC_T_LEN);
+    if (s->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    s->len = ngx_sprintf(s->data, "%uA", n) - s->data;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_get_early_data(ngx_connection_t *c, ngx_pool_t *pool, ngx_str_t *s)
 {
@@ -4332,10 +6488,23 @@ ngx_openssl_create_conf(ngx_cycle_t *cycle)
      *     oscf->engine = 0;
      */
 
+    oscf->memory_accounting = NGX_CONF_UNSET;
+
     return oscf;
 }
 
 
+static char *
+ngx_openssl_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_openssl_conf_t *oscf = conf;
+
+    ngx_conf_init_value(oscf->memory_accounting, 0);
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -4384,6 +6553,20 @@ ngx_openssl_engine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static ngx_int_t
+ngx_openssl_init_module(ngx_cycle_t *cycle)
+{
+    ngx_openssl_conf_t  *oscf;
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    ngx_ssl_memory_accounting = oscf->memory_accounting;
+
+    return NGX_OK;
+}
+
+
 static void
 ngx_openssl_exit(ngx_cycle_t *cycle)
 {
@@ -64,10 +64,29 @@
 #endif
 
 
+#if (OPENSSL_VERSION_NUMBER < 0x10100001L)
+#define X509_up_ref(x)                                                        \
+    CRYPTO_add(&(x)->references, 1, CRYPTO_LOCK_X509)
+#define EVP_PKEY_up_ref(pkey)                                                 \
+    CRYPTO_add(&(pkey)->references, 1, CRYPTO_LOCK_EVP_PKEY)
+#endif
+
+
+#if (NGX_THREADS)
+typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
+#endif
+
+
 struct ngx_ssl_s {
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
     size_t                      buffer_size;
+    size_t                      dyn_rec_threshold;
+    ngx_msec_t                  dyn_rec_timeout;
+    uint32_t                    session_tag;
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+#endif
 };
 
 
@@ -79,6 +98,20 @@ struct ngx_ssl_connection_s {
     ngx_buf_t                  *buf;
     size_t                      buffer_size;
 
+    size_t                      dyn_rec_threshold;
+    ngx_msec_t                  dyn_rec_timeout;
+    size_t                      dyn_rec_sent;
+    ngx_msec_t                  dyn_rec_last;
+
+    /* memory allocated by OpenSSL for the connection */
+    ssize_t                     memory;
+
+    size_t                      handshake_sent;
+    size_t                      handshake_received;
+
+    ngx_msec_t                  handshake_start;
+    ngx_msec_t                  handshake_time;
+
     ngx_connection_handler_pt   handler;
 
     ngx_ssl_session_t          *session;
@@ -87,12 +120,21 @@ struct ngx_ssl_connection_s {
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
 
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t          *handshake_task;
+#endif
+
     unsigned                    handshaked:1;
     unsigned                    renegotiation:1;
     unsigned                    buffer:1;
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    handshake_buffer_set:1;
+    unsigned                    session_cached:1;
+#if (NGX_THREADS)
+    unsigned                    handshake_offload:1;
+#endif
 };
 
 
@@ -120,25 +162,125 @@ struct ngx_ssl_sess_id_s {
 };
 
 
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+
+#define NGX_SSL_TICKET_KEYS  3
+
 typedef struct {
+    size_t                      size;
+    u_char                      name[16];
+    u_char                      hmac_key[32];
+    u_char                      aes_key[32];
+    time_t                      expire;
+    unsigned                    shared:1;
+} ngx_ssl_session_ticket_key_t;
+
+#endif
+
+
+#define NGX_SSL_MAX_SESSION_SHARDS  64
+
+typedef struct {
+    ngx_slab_pool_t            *shpool;
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
-} ngx_ssl_session_cache_t;
+    ngx_atomic_t                hits;
+    ngx_atomic_t                misses;
+    ngx_atomic_t                evictions;
+} ngx_ssl_session_shard_t;
 
 
+typedef struct {
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    ngx_ssl_session_ticket_key_t  ticket_keys[NGX_SSL_TICKET_KEYS];
+#endif
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_shard_t     shards[1];
+} ngx_ssl_session_cache_sh_t;
+
 
 typedef struct {
-    size_t                      size;
-    u_char                      name[16];
-    u_char                      hmac_key[32];
-    u_char                      aes_key[32];
-} ngx_ssl_session_ticket_key_t;
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_cache_sh_t *sh;
+} ngx_ssl_session_cache_t;
+
+
+#define NGX_SSL_CLIENT_SESSIONS  4
+
+typedef struct {
+    ngx_str_node_t              sn;
+    ngx_queue_t                 queue;
+    ngx_uint_t                  last;
+    u_char                     *session[NGX_SSL_CLIENT_SESSIONS];
+    time_t                      expire[NGX_SSL_CLIENT_SESSIONS];
+    u_short                     len[NGX_SSL_CLIENT_SESSIONS];
+    u_char                      single[NGX_SSL_CLIENT_SESSIONS];
+} ngx_ssl_client_session_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 queue;
+} ngx_ssl_client_session_cache_sh_t;
+
+
+typedef struct {
+    ngx_ssl_client_session_cache_sh_t  *sh;
+    ngx_slab_pool_t                    *shpool;
+} ngx_ssl_client_session_cache_t;
+
+
+#if (NGX_STAT_STUB)
+
+#define NGX_SSL_STAT_TIMES     10
+#define NGX_SSL_STAT_SLOTS     32
+#define NGX_SSL_STAT_NAME_LEN  48
+
+
+typedef struct {
+    ngx_atomic_t                id;
+    ngx_atomic_t                count;
+    u_char                      name[NGX_SSL_STAT_NAME_LEN];
+} ngx_ssl_stat_slot_t;
+
+
+typedef struct {
+    ngx_atomic_t                full;
+    ngx_atomic_t                cache;
+    ngx_atomic_t                ticket;
+    ngx_atomic_t                failed;
+    ngx_atomic_t                time[NGX_SSL_STAT_TIMES];
+    ngx_ssl_stat_slot_t         ciphers[NGX_SSL_STAT_SLOTS];
+    ngx_ssl_stat_slot_t         groups[NGX_SSL_STAT_SLOTS];
+} ngx_ssl_stat_t;
 
 #endif
 
 
+typedef struct {
+    ngx_str_node_t              sn;
+    ngx_queue_t                 queue;
+    X509                       *x509;
+    STACK_OF(X509)             *chain;
+    EVP_PKEY                   *pkey;
+    time_t                      created;
+    time_t                      accessed;
+} ngx_ssl_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 expire_queue;
+    ngx_uint_t                  current;
+    ngx_uint_t                  max;
+    time_t                      valid;
+    time_t                      inactive;
+} ngx_ssl_cache_t;
+
+
 #define NGX_SSL_SSLv2    0x0002
 #define NGX_SSL_SSLv3    0x0004
 #define NGX_SSL_TLSv1    0x0008
@@ -152,6 +294,12 @@ typedef struct {
 
 #define NGX_SSL_BUFSIZE  16384
 
+/*
+ * a record which fits into a single TCP segment of a typical 1460 bytes MSS
+ * with TCP timestamps, TLS record header, and MAC or AEAD overhead
+ */
+#define NGX_SSL_DYN_REC_SIZE  1369
+
 
 ngx_int_t ngx_ssl_init(ngx_log_t *log);
 ngx_int_t ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data);
@@ -159,6 +307,11 @@ ngx_int_t ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *certs, ngx_array_t *keys, ngx_array_t *passwords);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
+ngx_int_t ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_ssl_cache_t *cache,
+    ngx_array_t *passwords);
+ngx_ssl_cache_t *ngx_ssl_cache_init(ngx_pool_t *pool, ngx_uint_t max,
+    time_t valid, time_t inactive);
 ngx_int_t ngx_ssl_ciphers(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers,
     ngx_uint_t prefer_server_ciphers);
 ngx_int_t ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -170,11 +323,22 @@ ngx_int_t ngx_ssl_stapling(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *file, ngx_str_t *responder, ngx_uint_t verify);
 ngx_int_t ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_resolver_t *resolver, ngx_msec_t resolver_timeout);
+ngx_int_t ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_shm_zone_t *shm_zone);
+ngx_int_t ngx_ssl_stapling_preload(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_str_t *file);
+ngx_int_t ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+void ngx_ssl_stapling_check(ngx_connection_t *c);
+void ngx_ssl_stapling_init_worker(ngx_ssl_t *ssl);
 RSA *ngx_ssl_rsa512_key_callback(ngx_ssl_conn_t *ssl_conn, int is_export,
     int key_length);
 ngx_array_t *ngx_ssl_read_password_file(ngx_conf_t *cf, ngx_str_t *file);
+ngx_array_t *ngx_ssl_preserve_passwords(ngx_conf_t *cf,
+    ngx_array_t *passwords);
 ngx_int_t ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file);
 ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
+ngx_int_t ngx_ssl_certificate_compression(ngx_conf_t *cf, ngx_ssl_t *ssl,
+    ngx_uint_t enable);
 ngx_int_t ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_uint_t enable);
 ngx_int_t ngx_ssl_client_session_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -183,12 +347,20 @@ ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *paths);
+ngx_int_t ngx_ssl_session_cache_zone(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
 void ngx_ssl_remove_cached_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
 ngx_int_t ngx_ssl_set_session(ngx_connection_t *c, ngx_ssl_session_t *session);
+ngx_int_t ngx_ssl_client_session_cache_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+ngx_int_t ngx_ssl_set_cached_client_session(ngx_connection_t *c,
+    ngx_shm_zone_t *shm_zone, ngx_str_t *key);
+void ngx_ssl_cache_client_session(ngx_connection_t *c,
+    ngx_shm_zone_t *shm_zone, ngx_str_t *key);
 ngx_ssl_session_t *ngx_ssl_get_session(ngx_connection_t *c);
 ngx_ssl_session_t *ngx_ssl_get0_session(ngx_connection_t *c);
 #define ngx_ssl_free_session        SSL_SESSION_free
@@ -219,6 +391,24 @@ ngx_int_t ngx_ssl_get_session_id(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_session_reused(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_bytes_sent(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_bytes_received(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_str_t *s);
+ngx_int_t ngx_ssl_get_handshake_time(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_session_resumption(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_str_t *s);
+ngx_int_t ngx_ssl_get_memory(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_worker_memory(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_session_cache_hits(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *s);
+ngx_int_t ngx_ssl_get_session_cache_misses(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_str_t *s);
+ngx_int_t ngx_ssl_get_session_cache_evictions(ngx_connection_t *c,
+    ngx_pool_t *pool, ngx_str_t *s);
 ngx_int_t ngx_ssl_get_early_data(ngx_connection_t *c, ngx_pool_t *pool,
     ngx_str_t *s);
 ngx_int_t ngx_ssl_get_server_name(ngx_connection_t *c, ngx_pool_t *pool,
@@ -252,6 +442,9 @@ ngx_int_t ngx_ssl_get_client_v_remain(ngx_connection_t *c, ngx_pool_t *pool,
 
 
 ngx_int_t ngx_ssl_handshake(ngx_connection_t *c);
+#if (NGX_THREADS)
+int ngx_ssl_offload_handshake(ngx_ssl_conn_t *ssl_conn, void *data);
+#endif
 ssize_t ngx_ssl_recv(ngx_connection_t *c, u_char *buf, size_t size);
 ssize_t ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size);
 ssize_t ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit);
@@ -273,5 +466,10 @@ extern int  ngx_ssl_next_certificate_index;
 extern int  ngx_ssl_certificate_name_index;
 extern int  ngx_ssl_stapling_index;
 
+#if (NGX_STAT_STUB)
+extern ngx_ssl_stat_t    *ngx_ssl_stat;
+extern ngx_msec_t         ngx_ssl_stat_times[NGX_SSL_STAT_TIMES];
+#endif
+
 
 #endif /* _NGX_EVENT_OPENSSL_H_INCLUDED_ */
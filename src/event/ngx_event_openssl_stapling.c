@@ -10,10 +10,35 @@
 #include <ngx_event.h>
 #include <ngx_event_connect.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #if (!defined OPENSSL_NO_OCSP && defined SSL_CTRL_SET_TLSEXT_STATUS_REQ_CB)
 
 
+typedef struct {
+    ngx_str_node_t               sn;
+    u_char                       id[20];
+
+    time_t                       valid;
+    time_t                       refresh;
+    time_t                       updating;
+
+    ngx_atomic_t                 generation;
+
+    size_t                       len;
+    u_char                      *response;
+} ngx_ssl_stapling_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                 rbtree;
+    ngx_rbtree_node_t            sentinel;
+} ngx_ssl_stapling_cache_t;
+
+
 typedef struct {
     ngx_str_t                    staple;
     ngx_msec_t                   timeout;
@@ -36,6 +61,19 @@ typedef struct {
     time_t                       valid;
     time_t                       refresh;
 
+    ngx_event_t                  event;
+
+    ngx_shm_zone_t              *shm_zone;
+    ngx_ssl_stapling_node_t     *node;
+    ngx_atomic_uint_t            generation;
+    uint32_t                     hash;
+    u_char                       id[20];
+
+#if (NGX_THREADS)
+    /* the response is also used by handshakes running in threads */
+    ngx_atomic_t                 lock;
+#endif
+
     unsigned                     verify:1;
     unsigned                     loading:1;
 } ngx_ssl_stapling_t;
@@ -99,6 +137,13 @@ static ngx_int_t ngx_ssl_stapling_responder(ngx_conf_t *cf, ngx_ssl_t *ssl,
 static int ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn,
     void *data);
 static void ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_refresh_handler(ngx_event_t *ev);
+static void ngx_ssl_stapling_schedule(ngx_ssl_stapling_t *staple);
+static ngx_ssl_stapling_node_t *ngx_ssl_stapling_lookup(
+    ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_sync(ngx_ssl_stapling_t *staple);
+static void ngx_ssl_stapling_store(ngx_ssl_stapling_t *staple,
+    ngx_uint_t updated);
 static void ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx);
 
 static time_t ngx_ssl_stapling_time(ASN1_GENERALIZEDTIME *asn1time);
@@ -494,6 +539,177 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_shm_zone_t *shm_zone)
+{
+    X509                *cert;
+    unsigned int         len;
+    ngx_ssl_stapling_t  *staple;
+
+    if (shm_zone == NULL) {
+        return NGX_OK;
+    }
+
+    for (cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
+         cert;
+         cert = X509_get_ex_data(cert, ngx_ssl_next_certificate_index))
+    {
+        staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+        if (staple == NULL || staple->host.len == 0) {
+            continue;
+        }
+
+        /* responses are shared by certificates with the same digest */
+
+        if (X509_digest(cert, EVP_sha1(), staple->id, &len) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "X509_digest() failed");
+            return NGX_ERROR;
+        }
+
+        staple->hash = ngx_crc32_short(staple->id, sizeof(staple->id));
+        staple->shm_zone = shm_zone;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_preload(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    const
+#endif
+    u_char                *p;
+    X509                  *cert;
+    OCSP_RESPONSE         *ocsp;
+    OCSP_BASICRESP        *basic;
+    OCSP_SINGLERESP       *single;
+    ngx_ssl_stapling_t    *staple;
+    ASN1_GENERALIZEDTIME  *nextupdate;
+
+    if (file->len == 0) {
+        return NGX_OK;
+    }
+
+    for (cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
+         cert;
+         cert = X509_get_ex_data(cert, ngx_ssl_next_certificate_index))
+    {
+        staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+        if (staple == NULL || staple->host.len == 0) {
+            continue;
+        }
+
+        /*
+         * unlike "ssl_stapling_file", the response is only used
+         * until it expires or is refreshed from the responder
+         */
+
+        if (ngx_ssl_stapling_file(cf, ssl, staple, file) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        p = staple->staple.data;
+
+        ocsp = d2i_OCSP_RESPONSE(NULL, &p, staple->staple.len);
+        if (ocsp == NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "d2i_OCSP_RESPONSE(\"%s\") failed", file->data);
+            return NGX_ERROR;
+        }
+
+        basic = OCSP_response_get1_basic(ocsp);
+        OCSP_RESPONSE_free(ocsp);
+
+        if (basic == NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "OCSP_response_get1_basic(\"%s\") failed",
+                          file->data);
+            return NGX_ERROR;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+
+        single = OCSP_resp_get0(basic, 0);
+
+        if (single
+            && OCSP_single_get0_status(single, NULL, NULL, NULL, &nextupdate)
+               != -1
+            && nextupdate)
+        {
+            staple->valid = ngx_ssl_stapling_time(nextupdate);
+
+            if (staple->valid == (time_t) NGX_ERROR) {
+                staple->valid = 0;
+            }
+        }
+
+#else
+
+        (void) single;
+        (void) nextupdate;
+
+#endif
+
+        OCSP_BASICRESP_free(basic);
+
+        staple->refresh = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    size_t                     len;
+    ngx_slab_pool_t           *shpool;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    if (data) {
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shm_zone->data = shpool->data;
+        return NGX_OK;
+    }
+
+    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_stapling_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cache;
+    shm_zone->data = cache;
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    len = sizeof(" in OCSP stapling cache \"\"") + shm_zone->shm.name.len;
+
+    shpool->log_ctx = ngx_slab_alloc(shpool, len);
+    if (shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shpool->log_ctx, " in OCSP stapling cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
 static int
 ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
 {
@@ -517,41 +733,154 @@ ngx_ssl_certificate_status_callback(ngx_ssl_conn_t *ssl_conn, void *data)
         return rc;
     }
 
+#if (NGX_THREADS)
+    if (c->ssl->handshake_task && c->ssl->handshake_task->event.active) {
+
+        /* updated by ngx_ssl_stapling_check() when the task completes */
+
+        goto staple;
+    }
+#endif
+
+    /* picks up a response fetched by another worker */
+
+    ngx_ssl_stapling_update(staple);
+
+#if (NGX_THREADS)
+
+staple:
+
+    ngx_spinlock(&staple->lock, 1, 1024);
+#endif
+
     if (staple->staple.len
         && staple->valid >= ngx_time())
     {
         /* we have to copy ocsp response as OpenSSL will free it by itself */
 
         p = OPENSSL_malloc(staple->staple.len);
+
         if (p == NULL) {
             ngx_ssl_error(NGX_LOG_ALERT, c->log, 0, "OPENSSL_malloc() failed");
-            return SSL_TLSEXT_ERR_NOACK;
+
+        } else {
+            ngx_memcpy(p, staple->staple.data, staple->staple.len);
+
+            SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
+
+            rc = SSL_TLSEXT_ERR_OK;
         }
+    }
+
+#if (NGX_THREADS)
+    ngx_unlock(&staple->lock);
+#endif
 
-        ngx_memcpy(p, staple->staple.data, staple->staple.len);
+    return rc;
+}
 
-        SSL_set_tlsext_status_ocsp_resp(ssl_conn, p, staple->staple.len);
 
-        rc = SSL_TLSEXT_ERR_OK;
+void
+ngx_ssl_stapling_check(ngx_connection_t *c)
+{
+    X509                *cert;
+    ngx_ssl_stapling_t  *staple;
+
+    cert = SSL_get_certificate(c->ssl->connection);
+
+    if (cert == NULL) {
+        return;
+    }
+
+    staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+    if (staple == NULL) {
+        return;
     }
 
     ngx_ssl_stapling_update(staple);
+}
 
-    return rc;
+
+void
+ngx_ssl_stapling_init_worker(ngx_ssl_t *ssl)
+{
+    X509                *cert;
+    ngx_ssl_stapling_t  *staple;
+
+    /*
+     * responses are fetched when a worker starts rather than on the first
+     * handshake; with a shared cache, only the worker which claims a node
+     * fetches it, others schedule a refresh
+     */
+
+    for (cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
+         cert;
+         cert = X509_get_ex_data(cert, ngx_ssl_next_certificate_index))
+    {
+        staple = X509_get_ex_data(cert, ngx_ssl_stapling_index);
+
+        if (staple == NULL) {
+            continue;
+        }
+
+        ngx_ssl_stapling_update(staple);
+    }
 }
 
 
 static void
 ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 {
-    ngx_ssl_ocsp_ctx_t  *ctx;
+    time_t                    now;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_ocsp_ctx_t       *ctx;
+    ngx_ssl_stapling_node_t  *node;
+
+    if (staple->host.len == 0 || staple->loading) {
+        return;
+    }
+
+    if (staple->shm_zone) {
+        ngx_ssl_stapling_sync(staple);
+    }
+
+    now = ngx_time();
+
+    if (staple->refresh >= now) {
+
+        if (!staple->event.timer_set) {
+            ngx_ssl_stapling_schedule(staple);
+        }
 
-    if (staple->host.len == 0
-        || staple->loading || staple->refresh >= ngx_time())
-    {
         return;
     }
 
+    node = staple->node;
+
+    if (node) {
+
+        /* only one worker fetches the response */
+
+        shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+        ngx_shmtx_lock(&shpool->mutex);
+
+        if (node->refresh >= now || node->updating >= now) {
+            staple->refresh = ngx_max(node->refresh, node->updating);
+
+            ngx_shmtx_unlock(&shpool->mutex);
+
+            ngx_ssl_stapling_schedule(staple);
+            return;
+        }
+
+        node->updating = now + (staple->timeout + staple->resolver_timeout)
+                               / 1000 + 1;
+
+        ngx_shmtx_unlock(&shpool->mutex);
+    }
+
     staple->loading = 1;
 
     ctx = ngx_ssl_ocsp_start();
@@ -581,6 +910,214 @@ ngx_ssl_stapling_update(ngx_ssl_stapling_t *staple)
 }
 
 
+static void
+ngx_ssl_stapling_refresh_handler(ngx_event_t *ev)
+{
+    ngx_ssl_stapling_t  *staple = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "ssl stapling refresh: \"%s\"", staple->name);
+
+    ngx_ssl_stapling_update(staple);
+}
+
+
+static void
+ngx_ssl_stapling_schedule(ngx_ssl_stapling_t *staple)
+{
+    time_t  delay;
+
+    /*
+     * the response is refreshed in background,
+     * instead of waiting for the next handshake
+     */
+
+    if (staple->event.handler == NULL) {
+        staple->event.handler = ngx_ssl_stapling_refresh_handler;
+        staple->event.data = staple;
+        staple->event.log = ngx_cycle->log;
+        staple->event.cancelable = 1;
+    }
+
+    delay = staple->refresh - ngx_time() + 1;
+
+    if (delay < 1) {
+        delay = 1;
+
+    } else if (delay > 3600) {
+        delay = 3600;
+    }
+
+    ngx_add_timer(&staple->event, (ngx_msec_t) delay * 1000);
+}
+
+
+static ngx_ssl_stapling_node_t *
+ngx_ssl_stapling_lookup(ngx_ssl_stapling_t *staple)
+{
+    ngx_str_t                  id;
+    ngx_slab_pool_t           *shpool;
+    ngx_ssl_stapling_node_t   *node;
+    ngx_ssl_stapling_cache_t  *cache;
+
+    cache = staple->shm_zone->data;
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    id.len = sizeof(staple->id);
+    id.data = staple->id;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    node = (ngx_ssl_stapling_node_t *)
+               ngx_str_rbtree_lookup(&cache->rbtree, &id, staple->hash);
+
+    if (node == NULL) {
+        node = ngx_slab_calloc_locked(shpool, sizeof(ngx_ssl_stapling_node_t));
+
+        if (node == NULL) {
+            ngx_shmtx_unlock(&shpool->mutex);
+
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "could not allocate node%s", shpool->log_ctx);
+            return NULL;
+        }
+
+        ngx_memcpy(node->id, staple->id, sizeof(staple->id));
+
+        node->sn.node.key = staple->hash;
+        node->sn.str.len = sizeof(node->id);
+        node->sn.str.data = node->id;
+
+        ngx_rbtree_insert(&cache->rbtree, &node->sn.node);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    staple->node = node;
+
+    return node;
+}
+
+
+static void
+ngx_ssl_stapling_sync(ngx_ssl_stapling_t *staple)
+{
+    u_char                   *buf, *old;
+    size_t                    len;
+    time_t                    valid, refresh;
+    ngx_atomic_uint_t         generation;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *node;
+
+    node = staple->node;
+
+    if (node == NULL) {
+        node = ngx_ssl_stapling_lookup(staple);
+        if (node == NULL) {
+            return;
+        }
+    }
+
+    if (node->generation == staple->generation) {
+        return;
+    }
+
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    buf = NULL;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    len = node->len;
+
+    if (len) {
+        buf = ngx_alloc(len, ngx_cycle->log);
+        if (buf == NULL) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return;
+        }
+
+        ngx_memcpy(buf, node->response, len);
+    }
+
+    generation = node->generation;
+    valid = node->valid;
+    refresh = node->refresh;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
+                   "ssl stapling sync: \"%s\", %uz", staple->name, len);
+
+#if (NGX_THREADS)
+    ngx_spinlock(&staple->lock, 1, 1024);
+#endif
+
+    old = staple->staple.data;
+
+    staple->staple.data = buf;
+    staple->staple.len = len;
+    staple->valid = valid;
+
+#if (NGX_THREADS)
+    ngx_unlock(&staple->lock);
+#endif
+
+    if (old) {
+        ngx_free(old);
+    }
+
+    staple->refresh = refresh;
+    staple->generation = generation;
+}
+
+
+static void
+ngx_ssl_stapling_store(ngx_ssl_stapling_t *staple, ngx_uint_t updated)
+{
+    u_char                   *p;
+    ngx_slab_pool_t          *shpool;
+    ngx_ssl_stapling_node_t  *node;
+
+    node = staple->node;
+    shpool = (ngx_slab_pool_t *) staple->shm_zone->shm.addr;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    node->updating = 0;
+    node->refresh = staple->refresh;
+
+    if (!updated) {
+        ngx_shmtx_unlock(&shpool->mutex);
+        return;
+    }
+
+    p = ngx_slab_alloc_locked(shpool, staple->staple.len);
+
+    if (p == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "could not allocate OCSP response%s", shpool->log_ctx);
+        return;
+    }
+
+    ngx_memcpy(p, staple->staple.data, staple->staple.len);
+
+    if (node->response) {
+        ngx_slab_free_locked(shpool, node->response);
+    }
+
+    node->response = p;
+    node->len = staple->staple.len;
+    node->valid = staple->valid;
+
+    staple->generation = ++node->generation;
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
 static void
 ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
 {
@@ -588,6 +1125,7 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
     const
 #endif
     u_char                *p;
+    u_char                *old;
     int                    n;
     size_t                 len;
     time_t                 now, valid;
@@ -730,13 +1268,23 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
                    "ssl ocsp response, %s, %uz",
                    OCSP_cert_status_str(n), response.len);
 
-    if (staple->staple.data) {
-        ngx_free(staple->staple.data);
-    }
+#if (NGX_THREADS)
+    ngx_spinlock(&staple->lock, 1, 1024);
+#endif
+
+    old = staple->staple.data;
 
     staple->staple = response;
     staple->valid = valid;
 
+#if (NGX_THREADS)
+    ngx_unlock(&staple->lock);
+#endif
+
+    if (old) {
+        ngx_free(old);
+    }
+
     /*
      * refresh before the response expires,
      * but not earlier than in 5 minutes, and at least in an hour
@@ -745,6 +1293,12 @@ ngx_ssl_stapling_ocsp_handler(ngx_ssl_ocsp_ctx_t *ctx)
     staple->loading = 0;
     staple->refresh = ngx_max(ngx_min(valid - 300, now + 3600), now + 300);
 
+    if (staple->node) {
+        ngx_ssl_stapling_store(staple, 1);
+    }
+
+    ngx_ssl_stapling_schedule(staple);
+
     ngx_ssl_ocsp_done(ctx);
     return;
 
@@ -753,6 +1307,12 @@ error:
     staple->loading = 0;
     staple->refresh = now + 300;
 
+    if (staple->node) {
+        ngx_ssl_stapling_store(staple, 0);
+    }
+
+    ngx_ssl_stapling_schedule(staple);
+
     if (id) {
         OCSP_CERTID_free(id);
     }
@@ -808,6 +1368,10 @@ ngx_ssl_stapling_cleanup(void *data)
 {
     ngx_ssl_stapling_t  *staple = data;
 
+    if (staple->event.timer_set) {
+        ngx_del_timer(&staple->event);
+    }
+
     if (staple->issuer) {
         X509_free(staple->issuer);
     }
@@ -1889,4 +2453,37 @@ ngx_ssl_stapling_resolver(ngx_conf_t *cf, ngx_ssl_t *ssl,
 }
 
 
+ngx_int_t
+ngx_ssl_stapling_cache(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_shm_zone_t *shm_zone)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_preload(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file)
+{
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_ssl_stapling_cache_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    return NGX_OK;
+}
+
+
+void
+ngx_ssl_stapling_check(ngx_connection_t *c)
+{
+}
+
+
+void
+ngx_ssl_stapling_init_worker(ngx_ssl_t *ssl)
+{
+}
+
+
 #endif
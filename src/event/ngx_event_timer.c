@@ -10,9 +10,42 @@
 #include <ngx_event.h>
 
 
+/*
+ * the timing wheel has 256 slots of 1ms at the first level, and
+ * 4 levels of 64 slots, each slot covering the whole lower level;
+ * timers are moved to lower levels when the time reaches their slot
+ */
+
+#define NGX_TIMER_WHEEL_LEVELS  5
+#define NGX_TIMER_WHEEL_SLOTS   (256 + (NGX_TIMER_WHEEL_LEVELS - 1) * 64)
+
+
+static void ngx_event_timer_wheel_link(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_unlink(ngx_rbtree_node_t *node);
+static void ngx_event_timer_wheel_cascade(void);
+static ngx_uint_t ngx_event_timer_wheel_next(ngx_uint_t from, ngx_uint_t to);
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_uint_t                ngx_event_timer_wheel;
+
+/*
+ * the wheel slots are circular lists linked through the left (next)
+ * and right (prev) pointers of the timer nodes, the parent pointer
+ * of a node points to its slot
+ */
+
+static ngx_rbtree_node_t  ngx_event_timer_slots[NGX_TIMER_WHEEL_SLOTS];
+static uint64_t           ngx_event_timer_bitmap[NGX_TIMER_WHEEL_SLOTS / 64];
+
+/* the last millisecond processed */
+static ngx_msec_t         ngx_event_timer_wheel_time;
+static ngx_uint_t         ngx_event_timer_wheel_n;
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -22,9 +55,18 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t  i;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+        ngx_event_timer_slots[i].left = &ngx_event_timer_slots[i];
+        ngx_event_timer_slots[i].right = &ngx_event_timer_slots[i];
+    }
+
+    ngx_event_timer_wheel_time = ngx_current_msec;
+
     return NGX_OK;
 }
 
@@ -35,6 +77,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -56,6 +102,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -99,8 +150,27 @@ ngx_event_expire_timers(void)
 ngx_int_t
 ngx_event_no_timers_left(void)
 {
+    ngx_uint_t          i;
     ngx_event_t        *ev;
-    ngx_rbtree_node_t  *node, *root, *sentinel;
+    ngx_rbtree_node_t  *node, *root, *sentinel, *slot;
+
+    if (ngx_event_timer_wheel) {
+
+        for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+            slot = &ngx_event_timer_slots[i];
+
+            for (node = slot->left; node != slot; node = node->left) {
+                ev = (ngx_event_t *)
+                         ((char *) node - offsetof(ngx_event_t, timer));
+
+                if (!ev->cancelable) {
+                    return NGX_AGAIN;
+                }
+            }
+        }
+
+        return NGX_OK;
+    }
 
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
@@ -124,3 +194,294 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_link(node);
+    ngx_event_timer_wheel_n++;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_unlink(node);
+    ngx_event_timer_wheel_n--;
+}
+
+
+static void
+ngx_event_timer_wheel_link(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          i, level, shift;
+    ngx_msec_t          expire, diff;
+    ngx_rbtree_node_t  *slot;
+
+    expire = node->key;
+
+    if ((ngx_msec_int_t) (expire - ngx_event_timer_wheel_time) < 0) {
+        expire = ngx_event_timer_wheel_time;
+    }
+
+    diff = expire - ngx_event_timer_wheel_time;
+
+    if (diff < 256) {
+        i = expire & 255;
+
+    } else {
+
+#if (NGX_PTR_SIZE == 8)
+        if (diff > 0xffffffff) {
+
+            /* timers beyond the wheel are placed again on cascading */
+
+            expire = ngx_event_timer_wheel_time + 0xffffffff;
+        }
+#endif
+
+        for (level = 1, shift = 8;
+             level < NGX_TIMER_WHEEL_LEVELS - 1;
+             level++, shift += 6)
+        {
+            if (diff < ((ngx_msec_t) 1 << (shift + 6))) {
+                break;
+            }
+        }
+
+        i = 256 + (level - 1) * 64 + ((expire >> shift) & 63);
+    }
+
+    slot = &ngx_event_timer_slots[i];
+
+    node->parent = slot;
+    node->left = slot;
+    node->right = slot->right;
+    slot->right->left = node;
+    slot->right = node;
+
+    ngx_event_timer_bitmap[i >> 6] |= (uint64_t) 1 << (i & 63);
+}
+
+
+static void
+ngx_event_timer_wheel_unlink(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          i;
+    ngx_rbtree_node_t  *slot;
+
+    node->right->left = node->left;
+    node->left->right = node->right;
+
+    slot = node->parent;
+
+    if (slot->left == slot) {
+        i = slot - ngx_event_timer_slots;
+        ngx_event_timer_bitmap[i >> 6] &= ~((uint64_t) 1 << (i & 63));
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(void)
+{
+    ngx_uint_t          i, level, shift;
+    ngx_rbtree_node_t  *slot, *node, *next;
+
+    /* called when the wheel time reaches the end of the first level */
+
+    for (level = 1, shift = 8;
+         level < NGX_TIMER_WHEEL_LEVELS;
+         level++, shift += 6)
+    {
+        i = 256 + (level - 1) * 64
+            + ((ngx_event_timer_wheel_time >> shift) & 63);
+
+        slot = &ngx_event_timer_slots[i];
+
+        if (slot->left != slot) {
+            node = slot->left;
+
+            slot->right->left = NULL;
+            slot->left = slot;
+            slot->right = slot;
+
+            ngx_event_timer_bitmap[i >> 6] &= ~((uint64_t) 1 << (i & 63));
+
+            while (node) {
+                next = node->left;
+                ngx_event_timer_wheel_link(node);
+                node = next;
+            }
+        }
+
+        if ((ngx_event_timer_wheel_time >> shift) & 63) {
+            break;
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_event_timer_wheel_next(ngx_uint_t from, ngx_uint_t to)
+{
+    uint64_t  word;
+
+    /* the first non-empty slot in the range, or "to" */
+
+    while (from < to) {
+        word = ngx_event_timer_bitmap[from >> 6] >> (from & 63);
+
+        if (word == 0) {
+            from = (from | 63) + 1;
+            continue;
+        }
+
+        while (!(word & 1)) {
+            word >>= 1;
+            from++;
+        }
+
+        return ngx_min(from, to);
+    }
+
+    return to;
+}
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    ngx_uint_t      i, j, base, level, shift;
+    ngx_msec_t      time, next, cascade;
+    ngx_msec_int_t  timer;
+
+    if (ngx_event_timer_wheel_n == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    time = ngx_event_timer_wheel_time;
+    next = time + NGX_MAX_INT32_VALUE;
+
+    /* the first level contains timers which expire in 256ms */
+
+    i = time & 255;
+
+    j = ngx_event_timer_wheel_next(i, 256);
+
+    if (j == 256) {
+        j = ngx_event_timer_wheel_next(0, i);
+        j = (j == i) ? 512 : j + 256;
+    }
+
+    if (j < 512) {
+        next = time + (j - i);
+    }
+
+    /*
+     * timers at upper levels do not expire before their slot is cascaded,
+     * the current slot of a level is only cascaded on the next rotation
+     */
+
+    for (level = 1, shift = 8;
+         level < NGX_TIMER_WHEEL_LEVELS;
+         level++, shift += 6)
+    {
+        base = 256 + (level - 1) * 64;
+        i = (time >> shift) & 63;
+
+        j = ngx_event_timer_wheel_next(base + i + 1, base + 64);
+
+        if (j == base + 64) {
+            j = ngx_event_timer_wheel_next(base, base + i + 1);
+
+            if (j == base + i + 1) {
+                continue;
+            }
+
+            j += 64;
+        }
+
+        cascade = ((time >> shift) + (j - base - i)) << shift;
+
+        if ((ngx_msec_int_t) (cascade - next) < 0) {
+            next = cascade;
+        }
+    }
+
+    timer = (ngx_msec_int_t) (next - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    ngx_uint_t          i, j;
+    ngx_msec_t          next;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *slot;
+
+    for ( ;; ) {
+
+        if (ngx_event_timer_wheel_n == 0) {
+            ngx_event_timer_wheel_time = ngx_current_msec;
+            return;
+        }
+
+        /* the slot contains timers which expire at the wheel time */
+
+        i = ngx_event_timer_wheel_time & 255;
+        slot = &ngx_event_timer_slots[i];
+
+        while (slot->left != slot) {
+            node = slot->left;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+#if (NGX_DEBUG)
+            ev->timer.left = NULL;
+            ev->timer.right = NULL;
+            ev->timer.parent = NULL;
+#endif
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+        }
+
+        /* ngx_event_timer_wheel_time >= ngx_current_msec */
+
+        if ((ngx_msec_int_t) (ngx_event_timer_wheel_time - ngx_current_msec)
+            >= 0)
+        {
+            return;
+        }
+
+        /* skip empty slots up to the end of the first level */
+
+        j = ngx_event_timer_wheel_next(i + 1, 256);
+        next = ngx_event_timer_wheel_time + (j - i);
+
+        if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+            ngx_event_timer_wheel_time = ngx_current_msec;
+            return;
+        }
+
+        ngx_event_timer_wheel_time = next;
+
+        if (j == 256) {
+            ngx_event_timer_wheel_cascade();
+        }
+    }
+}
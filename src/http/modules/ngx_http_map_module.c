@@ -186,6 +186,10 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_variable_t               *var;
     ngx_http_map_conf_ctx_t            ctx;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_PCRE)
+    ngx_uint_t                         i;
+    ngx_regex_t                      **regex;
+#endif
 
     if (mcf->hash_max_size == NGX_CONF_UNSET_UINT) {
         mcf->hash_max_size = 2048;
@@ -355,6 +359,24 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        regex = ngx_palloc(pool, map->map.nregex * sizeof(ngx_regex_t *));
+        if (regex == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < map->map.nregex; i++) {
+            regex[i] = map->map.regex[i].regex->regex;
+        }
+
+        if (ngx_regex_prefilter_init(cf->pool, regex, map->map.nregex,
+                                     &map->map.prefilter)
+            != NGX_OK)
+        {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
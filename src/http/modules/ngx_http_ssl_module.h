@@ -21,6 +21,7 @@ typedef struct {
 
     ngx_flag_t                      prefer_server_ciphers;
     ngx_flag_t                      early_data;
+    ngx_flag_t                      certificate_compression;
 
     ngx_uint_t                      protocols;
 
@@ -29,6 +30,14 @@ typedef struct {
 
     size_t                          buffer_size;
 
+    ngx_flag_t                      dynamic_records;
+    size_t                          dynamic_records_threshold;
+    ngx_msec_t                      dynamic_records_timeout;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t              *thread_pool;
+#endif
+
     ssize_t                         builtin_session_cache;
 
     time_t                          session_timeout;
@@ -36,6 +45,11 @@ typedef struct {
     ngx_array_t                    *certificates;
     ngx_array_t                    *certificate_keys;
 
+    ngx_array_t                    *certificate_values;
+    ngx_array_t                    *certificate_key_values;
+
+    ngx_ssl_cache_t                *certificate_cache;
+
     ngx_str_t                       dhparam;
     ngx_str_t                       ecdh_curve;
     ngx_str_t                       client_certificate;
@@ -55,6 +69,8 @@ typedef struct {
     ngx_flag_t                      stapling_verify;
     ngx_str_t                       stapling_file;
     ngx_str_t                       stapling_responder;
+    ngx_str_t                       stapling_preload;
+    ngx_shm_zone_t                 *stapling_cache;
 
     u_char                         *file;
     ngx_uint_t                      line;
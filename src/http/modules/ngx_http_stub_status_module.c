@@ -10,10 +10,29 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_flag_t  ssl;
+    ngx_flag_t  zones;
+    ngx_flag_t  pools;
+} ngx_http_stub_status_loc_conf_t;
+
+
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
+#if (NGX_SSL)
+static size_t ngx_http_stub_status_ssl_size(void);
+static u_char *ngx_http_stub_status_ssl(u_char *p);
+#endif
+static size_t ngx_http_stub_status_zones_size(void);
+static u_char *ngx_http_stub_status_zones(u_char *p);
+static u_char *ngx_http_stub_status_zone_locks(u_char *p);
+static u_char *ngx_http_stub_status_zone_pages(u_char *p);
+static u_char *ngx_http_stub_status_zone_slots(u_char *p);
+static size_t ngx_http_stub_status_pools_size(ngx_http_request_t *r);
+static u_char *ngx_http_stub_status_pools(ngx_http_request_t *r, u_char *p);
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
+static void *ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
@@ -21,9 +40,9 @@ static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_status_commands[] = {
 
     { ngx_string("stub_status"),
-      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE123,
       ngx_http_set_stub_status,
-      0,
+      NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
 
@@ -41,7 +60,7 @@ static ngx_http_module_t  ngx_http_stub_status_module_ctx = {
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
-    NULL,                                  /* create location configuration */
+    ngx_http_stub_status_create_loc_conf,  /* create location configuration */
     NULL                                   /* merge location configuration */
 };
 
@@ -83,11 +102,12 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 static ngx_int_t
 ngx_http_stub_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    size_t                            size;
+    ngx_int_t                         rc;
+    ngx_buf_t                        *b;
+    ngx_chain_t                       out;
+    ngx_atomic_int_t                  ap, hn, ac, rq, rd, wr, wa;
+    ngx_http_stub_status_loc_conf_t  *sscf;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -118,6 +138,22 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    sscf = ngx_http_get_module_loc_conf(r, ngx_http_stub_status_module);
+
+#if (NGX_SSL)
+    if (sscf->ssl) {
+        size += ngx_http_stub_status_ssl_size();
+    }
+#endif
+
+    if (sscf->zones) {
+        size += ngx_http_stub_status_zones_size();
+    }
+
+    if (sscf->pools) {
+        size += ngx_http_stub_status_pools_size(r);
+    }
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -144,6 +180,20 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+#if (NGX_SSL)
+    if (sscf->ssl) {
+        b->last = ngx_http_stub_status_ssl(b->last);
+    }
+#endif
+
+    if (sscf->zones) {
+        b->last = ngx_http_stub_status_zones(b->last);
+    }
+
+    if (sscf->pools) {
+        b->last = ngx_http_stub_status_pools(r, b->last);
+    }
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -160,6 +210,350 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
 }
 
 
+#if (NGX_SSL)
+
+static size_t
+ngx_http_stub_status_ssl_size(void)
+{
+    size_t      size;
+    ngx_uint_t  i;
+
+    size = sizeof("SSL handshakes: full cache ticket failed\n") - 1
+           + 5 + 4 * NGX_ATOMIC_T_LEN
+           + sizeof("SSL time:  \n") - 1
+           + NGX_SSL_STAT_TIMES * (sizeof(":  ") - 1 + NGX_INT_T_LEN
+                                   + NGX_ATOMIC_T_LEN)
+           + sizeof("SSL ciphers: \n") - 1
+           + sizeof("SSL groups: \n") - 1;
+
+    for (i = 0; i < NGX_SSL_STAT_SLOTS; i++) {
+        size += 2 * (sizeof(": ") - 1 + NGX_SSL_STAT_NAME_LEN
+                     + NGX_ATOMIC_T_LEN);
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_stub_status_ssl(u_char *p)
+{
+    ngx_uint_t            i, n;
+    ngx_ssl_stat_t       *stat;
+    ngx_ssl_stat_slot_t  *slot;
+
+    stat = ngx_ssl_stat;
+
+    p = ngx_cpymem(p, "SSL handshakes: full cache ticket failed\n",
+                   sizeof("SSL handshakes: full cache ticket failed\n") - 1);
+
+    p = ngx_sprintf(p, " %uA %uA %uA %uA \n",
+                    stat->full, stat->cache, stat->ticket, stat->failed);
+
+    /* handshake time histogram, the upper bound of each bucket in ms */
+
+    p = ngx_cpymem(p, "SSL time:", sizeof("SSL time:") - 1);
+
+    for (i = 0; i < NGX_SSL_STAT_TIMES - 1; i++) {
+        p = ngx_sprintf(p, " %M: %uA", ngx_ssl_stat_times[i], stat->time[i]);
+    }
+
+    p = ngx_sprintf(p, " inf: %uA \n", stat->time[i]);
+
+    for (n = 0; n < 2; n++) {
+
+        if (n == 0) {
+            p = ngx_cpymem(p, "SSL ciphers:", sizeof("SSL ciphers:") - 1);
+            slot = stat->ciphers;
+
+        } else {
+            p = ngx_cpymem(p, "SSL groups:", sizeof("SSL groups:") - 1);
+            slot = stat->groups;
+        }
+
+        for (i = 0; i < NGX_SSL_STAT_SLOTS && slot[i].id; i++) {
+            p = ngx_sprintf(p, " %*s: %uA",
+                            ngx_strnlen(slot[i].name, NGX_SSL_STAT_NAME_LEN),
+                            slot[i].name, slot[i].count);
+        }
+
+        *p++ = ' ';
+        *p++ = LF;
+    }
+
+    return p;
+}
+
+#endif
+
+
+static size_t
+ngx_http_stub_status_zones_size(void)
+{
+    size_t            size;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_shm_zone_t   *shm_zone;
+
+    size = sizeof("Zone locks: acquired contended spins sleeps wait\n") - 1
+           + sizeof("Zone pages: total free runs largest partial\n") - 1
+           + sizeof("Zone slots: size pages used total reqs fails\n") - 1;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        size += sizeof("  .000 \n") - 1 + shm_zone[i].shm.name.len
+                + 5 + 5 * NGX_ATOMIC_T_LEN;
+
+        size += sizeof("  \n") - 1 + shm_zone[i].shm.name.len
+                + 5 + 5 * NGX_INT_T_LEN;
+
+        /* a line for each size class */
+
+        size += ngx_pagesize_shift * (sizeof("  \n") - 1
+                                      + shm_zone[i].shm.name.len
+                                      + 6 + 6 * NGX_INT_T_LEN);
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_stub_status_zones(u_char *p)
+{
+    p = ngx_http_stub_status_zone_locks(p);
+    p = ngx_http_stub_status_zone_pages(p);
+    p = ngx_http_stub_status_zone_slots(p);
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_stub_status_zone_locks(u_char *p)
+{
+    ngx_uint_t          i;
+    ngx_list_part_t    *part;
+    ngx_shm_zone_t     *shm_zone;
+    ngx_slab_pool_t    *shpool;
+    ngx_shmtx_stat_t   *stat;
+
+    p = ngx_cpymem(p, "Zone locks: acquired contended spins sleeps wait\n",
+                   sizeof("Zone locks: acquired contended spins sleeps "
+                          "wait\n") - 1);
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].shm.addr == NULL) {
+            continue;
+        }
+
+        shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        stat = &shpool->lock.stat;
+
+        /* the wait time is in microseconds, output in milliseconds */
+
+        p = ngx_sprintf(p, " %V %uA %uA %uA %uA %uA.%03uA \n",
+                        &shm_zone[i].shm.name,
+                        stat->acquired, stat->contended, stat->spins,
+                        stat->sleeps, stat->wait_time / 1000,
+                        stat->wait_time % 1000);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_stub_status_zone_pages(u_char *p)
+{
+    ngx_uint_t             i;
+    ngx_list_part_t       *part;
+    ngx_shm_zone_t        *shm_zone;
+    ngx_slab_pool_t       *shpool;
+    ngx_slab_pool_stat_t   ps;
+
+    p = ngx_cpymem(p, "Zone pages: total free runs largest partial\n",
+                   sizeof("Zone pages: total free runs largest partial\n")
+                   - 1);
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].shm.addr == NULL) {
+            continue;
+        }
+
+        shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        /* walks the free list of the zone under its mutex */
+
+        ngx_slab_stat(shpool, &ps);
+
+        p = ngx_sprintf(p, " %V %ui %ui %ui %ui %ui \n",
+                        &shm_zone[i].shm.name, ps.pages, ps.free,
+                        ps.runs, ps.largest, ps.partial);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_stub_status_zone_slots(u_char *p)
+{
+    ngx_uint_t         i, slot;
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_slab_pool_t   *shpool;
+    ngx_slab_stat_t   *ss;
+
+    p = ngx_cpymem(p, "Zone slots: size pages used total reqs fails\n",
+                   sizeof("Zone slots: size pages used total reqs fails\n")
+                   - 1);
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].shm.addr == NULL) {
+            continue;
+        }
+
+        shpool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        ss = shpool->stats;
+
+        for (slot = 0; slot < ngx_pagesize_shift - shpool->min_shift; slot++) {
+
+            if (ss[slot].reqs == 0) {
+                continue;
+            }
+
+            p = ngx_sprintf(p, " %V %uz %ui %ui %ui %ui %ui \n",
+                            &shm_zone[i].shm.name,
+                            (size_t) 1 << (slot + shpool->min_shift),
+                            ss[slot].pages, ss[slot].used,
+                            ss[slot].total, ss[slot].reqs, ss[slot].fails);
+        }
+    }
+
+    return p;
+}
+
+
+static size_t
+ngx_http_stub_status_pools_size(ngx_http_request_t *r)
+{
+    size_t                      size;
+    ngx_uint_t                  i;
+    ngx_http_pool_stat_name_t  *psn;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    size = sizeof("Request pools: requests used peak blocks large\n") - 1;
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    if (cmcf->pool_stats == NULL) {
+        return size;
+    }
+
+    psn = cmcf->pool_stat_names.elts;
+
+    for (i = 0; i < cmcf->pool_stat_names.nelts; i++) {
+        size += sizeof("  \"\" \n") - 1
+                + psn[i].server->len + psn[i].location->len
+                + 5 + 5 * NGX_ATOMIC_T_LEN;
+    }
+
+    return size;
+}
+
+
+static u_char *
+ngx_http_stub_status_pools(ngx_http_request_t *r, u_char *p)
+{
+    ngx_uint_t                  i;
+    ngx_http_pool_stat_t       *ps;
+    ngx_http_pool_stat_name_t  *psn;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    p = ngx_cpymem(p, "Request pools: requests used peak blocks large\n",
+                   sizeof("Request pools: requests used peak blocks large\n")
+                   - 1);
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    if (cmcf->pool_stats == NULL) {
+        return p;
+    }
+
+    ps = cmcf->pool_stats;
+    psn = cmcf->pool_stat_names.elts;
+
+    /* the memory used is summed up over the requests */
+
+    for (i = 0; i < cmcf->pool_stat_names.nelts; i++) {
+        p = ngx_sprintf(p, " %V \"%V\" %uA %uA %uA %uA %uA \n",
+                        psn[i].server, psn[i].location,
+                        ps[i].requests, ps[i].used, ps[i].peak,
+                        ps[i].blocks, ps[i].large);
+    }
+
+    return p;
+}
+
+
 static ngx_int_t
 ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -224,13 +618,68 @@ ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 }
 
 
+static void *
+ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->ssl = 0;
+     *     conf->zones = 0;
+     *     conf->pools = 0;
+     */
+
+    return conf;
+}
+
+
 static char *
 ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_http_stub_status_loc_conf_t *sscf = conf;
+
+    ngx_str_t                 *value;
+    ngx_uint_t                 i;
     ngx_http_core_loc_conf_t  *clcf;
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
     clcf->handler = ngx_http_stub_status_handler;
 
+    if (cf->args->nelts == 1) {
+        return NGX_CONF_OK;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "ssl") == 0) {
+#if (NGX_SSL)
+            sscf->ssl = 1;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the \"ssl\" parameter requires SSL support");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strcmp(value[i].data, "zones") == 0) {
+            sscf->zones = 1;
+        }
+
+        if (ngx_strcmp(value[i].data, "pools") == 0) {
+            sscf->pools = 1;
+        }
+
+        /* other values, such as "on", are ignored for compatibility */
+    }
+
     return NGX_CONF_OK;
 }
@@ -0,0 +1,954 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CONF_PEER_LEN                                       \
+    (sizeof("server  weight= max_conns= max_fails= fail_timeout=s"            \
+            " backup drain; # id=" CRLF) - 1                                 \
+     + NGX_SOCKADDR_STRLEN + 5 * NGX_INT_T_LEN)
+
+
+typedef struct {
+    ngx_uint_t                      id;
+    ngx_str_t                       server;
+    ngx_int_t                       weight;
+    ngx_int_t                       max_conns;
+    ngx_int_t                       max_fails;
+    time_t                          fail_timeout;
+    ngx_int_t                       down;
+    ngx_uint_t                      drain;
+    ngx_uint_t                      backup;
+
+    unsigned                        add:1;
+    unsigned                        remove:1;
+    unsigned                        modify:1;
+} ngx_http_upstream_conf_op_t;
+
+
+static ngx_int_t ngx_http_upstream_conf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_op_t *op,
+    char **err);
+static ngx_int_t ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op,
+    char **err);
+static ngx_int_t ngx_http_upstream_conf_remove(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op);
+static ngx_int_t ngx_http_upstream_conf_modify(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_conf_find(
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t id,
+    ngx_http_upstream_rr_peers_t **listp,
+    ngx_http_upstream_rr_peer_t ***peerp);
+static ngx_int_t ngx_http_upstream_conf_write_state(
+    ngx_http_upstream_srv_conf_t *uscf, ngx_buf_t *b, ngx_uint_t changes,
+    ngx_log_t *log);
+static ngx_buf_t *ngx_http_upstream_conf_list(ngx_pool_t *pool,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t id, ngx_uint_t state);
+static u_char *ngx_http_upstream_conf_peer(u_char *p,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t backup, ngx_uint_t state);
+static ngx_int_t ngx_http_upstream_conf_send(ngx_http_request_t *r,
+    ngx_uint_t status, ngx_buf_t *b);
+static ngx_int_t ngx_http_upstream_conf_error(ngx_http_request_t *r,
+    ngx_uint_t status, char *err);
+static char *ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_conf_commands[] = {
+
+    { ngx_string("upstream_conf"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_conf,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_conf_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_conf_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_conf_module_ctx,    /* module context */
+    ngx_http_upstream_conf_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_conf_handler(ngx_http_request_t *r)
+{
+    char                           *err;
+    ngx_int_t                       rc;
+    ngx_str_t                       name;
+    ngx_buf_t                      *b, *state;
+    ngx_uint_t                      i, changes;
+    ngx_http_upstream_conf_op_t     op;
+    ngx_http_upstream_rr_peers_t   *peers, *backup;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_POST
+                       |NGX_HTTP_PATCH|NGX_HTTP_DELETE)))
+    {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "upstream", 8, &name) != NGX_OK) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                            "upstream name is required");
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscf = NULL;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf
+            && uscfp[i]->host.len == name.len
+            && ngx_strncasecmp(uscfp[i]->host.data, name.data, name.len) == 0)
+        {
+            uscf = uscfp[i];
+            break;
+        }
+    }
+
+    if (uscf == NULL) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_NOT_FOUND,
+                                            "upstream not found");
+    }
+
+    if (uscf->shm_zone == NULL) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                        "upstream is not in shared memory");
+    }
+
+    if (ngx_http_upstream_conf_parse(r, uscf, &op, &err) != NGX_OK) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST, err);
+    }
+
+    peers = uscf->peer.data;
+
+    /* changes are only accepted with POST, PATCH or DELETE */
+
+    if (!op.add && !op.remove && !op.modify) {
+
+        if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST,
+                                                "no changes requested");
+        }
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+
+        b = ngx_http_upstream_conf_list(r->pool, peers, op.id, 0);
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        if (b == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        if (b->last == b->pos && op.id != NGX_CONF_UNSET_UINT) {
+            return ngx_http_upstream_conf_error(r, NGX_HTTP_NOT_FOUND,
+                                                "server not found");
+        }
+
+        return ngx_http_upstream_conf_send(r, NGX_HTTP_OK, b);
+    }
+
+    /*
+     * both lists are locked for writing, the primary one first;
+     * the backup list may appear while the primary one is locked
+     */
+
+    if (r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD)) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    backup = peers->next;
+
+    if (backup) {
+        ngx_http_upstream_rr_peers_wlock(backup);
+    }
+
+    if (op.add) {
+        rc = ngx_http_upstream_conf_add(r, peers, &op, &err);
+
+    } else if (op.remove) {
+        rc = ngx_http_upstream_conf_remove(peers, &op);
+        err = "server not found";
+
+    } else {
+        rc = ngx_http_upstream_conf_modify(peers, &op);
+        err = "server not found";
+    }
+
+    /*
+     * the state is only serialized under the lock,
+     * the file is written after the lists are unlocked
+     */
+
+    state = NULL;
+    changes = 0;
+
+    if (rc == NGX_OK && uscf->state.data) {
+        state = ngx_http_upstream_conf_list(r->pool, peers,
+                                            NGX_CONF_UNSET_UINT, 1);
+        changes = ++peers->changes;
+    }
+
+    if (rc == NGX_OK) {
+        b = ngx_http_upstream_conf_list(r->pool, peers,
+                                        op.remove ? NGX_CONF_UNSET_UINT : op.id,
+                                        0);
+
+    } else {
+        b = NULL;
+    }
+
+    if (backup) {
+        ngx_http_upstream_rr_peers_unlock(backup);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    if (rc == NGX_OK && uscf->state.data) {
+
+        if (state == NULL) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "upstream \"%V\" state was not saved",
+                          &uscf->host);
+
+        } else {
+            (void) ngx_http_upstream_conf_write_state(uscf, state, changes,
+                                                      r->connection->log);
+        }
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_NOT_FOUND, err);
+    }
+
+    if (rc == NGX_ABORT) {
+        return ngx_http_upstream_conf_error(r, NGX_HTTP_BAD_REQUEST, err);
+    }
+
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "upstream \"%V\" changed, server id: %ui",
+                  &uscf->host, op.id);
+
+    return ngx_http_upstream_conf_send(r, NGX_HTTP_OK, b);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_conf_op_t *op,
+    char **err)
+{
+    u_char     *dst, *src;
+    ngx_int_t   n;
+    ngx_str_t   value;
+
+    ngx_memzero(op, sizeof(ngx_http_upstream_conf_op_t));
+
+    op->id = NGX_CONF_UNSET_UINT;
+    op->weight = NGX_CONF_UNSET;
+    op->max_conns = NGX_CONF_UNSET;
+    op->max_fails = NGX_CONF_UNSET;
+    op->fail_timeout = NGX_CONF_UNSET;
+    op->down = NGX_CONF_UNSET;
+
+    if (ngx_http_arg(r, (u_char *) "id", 2, &value) == NGX_OK) {
+        n = ngx_atoi(value.data, value.len);
+
+        if (n == NGX_ERROR) {
+            *err = "invalid server id";
+            return NGX_ERROR;
+        }
+
+        op->id = n;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "add", 3, &value) == NGX_OK) {
+        op->add = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "remove", 6, &value) == NGX_OK) {
+        op->remove = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "server", 6, &value) == NGX_OK) {
+
+        dst = ngx_pnalloc(r->pool, value.len);
+        if (dst == NULL) {
+            *err = "internal error";
+            return NGX_ERROR;
+        }
+
+        src = value.data;
+        op->server.data = dst;
+
+        ngx_unescape_uri(&dst, &src, value.len, NGX_UNESCAPE_URI);
+
+        op->server.len = dst - op->server.data;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "weight", 6, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_WEIGHT)) {
+            goto not_supported;
+        }
+
+        op->weight = ngx_atoi(value.data, value.len);
+
+        if (op->weight == NGX_ERROR || op->weight == 0) {
+            *err = "invalid weight";
+            return NGX_ERROR;
+        }
+
+        op->modify = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "max_conns", 9, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_MAX_CONNS)) {
+            goto not_supported;
+        }
+
+        op->max_conns = ngx_atoi(value.data, value.len);
+
+        if (op->max_conns == NGX_ERROR) {
+            *err = "invalid max_conns";
+            return NGX_ERROR;
+        }
+
+        op->modify = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "max_fails", 9, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_MAX_FAILS)) {
+            goto not_supported;
+        }
+
+        op->max_fails = ngx_atoi(value.data, value.len);
+
+        if (op->max_fails == NGX_ERROR) {
+            *err = "invalid max_fails";
+            return NGX_ERROR;
+        }
+
+        op->modify = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "fail_timeout", 12, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_FAIL_TIMEOUT)) {
+            goto not_supported;
+        }
+
+        op->fail_timeout = ngx_parse_time(&value, 1);
+
+        if (op->fail_timeout == (time_t) NGX_ERROR) {
+            *err = "invalid fail_timeout";
+            return NGX_ERROR;
+        }
+
+        op->modify = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "down", 4, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_DOWN)) {
+            goto not_supported;
+        }
+
+        op->down = (value.len == 1 && value.data[0] == '0') ? 0 : 1;
+        op->modify = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "drain", 5, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_DOWN)) {
+            goto not_supported;
+        }
+
+        op->drain = 1;
+        op->modify = 1;
+    }
+
+    if (ngx_http_arg(r, (u_char *) "backup", 6, &value) == NGX_OK) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_BACKUP)) {
+            goto not_supported;
+        }
+
+        op->backup = 1;
+    }
+
+    if (op->add + op->remove > 1) {
+        *err = "\"add\" and \"remove\" are mutually exclusive";
+        return NGX_ERROR;
+    }
+
+    if (op->add) {
+
+        if (op->server.len == 0) {
+            *err = "server address is required";
+            return NGX_ERROR;
+        }
+
+        if (op->id != NGX_CONF_UNSET_UINT) {
+            *err = "server id cannot be set";
+            return NGX_ERROR;
+        }
+
+        op->modify = 0;
+        return NGX_OK;
+    }
+
+    if (op->backup) {
+        *err = "\"backup\" can only be set on add";
+        return NGX_ERROR;
+    }
+
+    if ((op->remove || op->modify) && op->id == NGX_CONF_UNSET_UINT) {
+        *err = "server id is required";
+        return NGX_ERROR;
+    }
+
+    if (op->remove && op->modify) {
+        *err = "server parameters cannot be set on remove";
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+not_supported:
+
+    *err = "balancing method does not support the parameter";
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_add(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_conf_op_t *op,
+    char **err)
+{
+    ngx_url_t                      u;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_upstream_rr_peer_t    src, *peer, **peerp;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = op->server;
+    u.default_port = 80;
+    u.no_resolve = 1;
+
+    if (ngx_parse_url(r->pool, &u) != NGX_OK) {
+        *err = u.err ? u.err : "invalid server address";
+        return NGX_ABORT;
+    }
+
+    if (u.naddrs != 1) {
+        *err = "server address must be an IP address or a unix socket";
+        return NGX_ABORT;
+    }
+
+    ngx_memzero(&src, sizeof(ngx_http_upstream_rr_peer_t));
+
+    src.sockaddr = u.addrs[0].sockaddr;
+    src.socklen = u.addrs[0].socklen;
+    src.name = u.addrs[0].name;
+    src.server = u.url;
+
+    src.weight = (op->weight == NGX_CONF_UNSET) ? 1 : op->weight;
+    src.effective_weight = src.weight;
+    src.max_conns = (op->max_conns == NGX_CONF_UNSET) ? 0 : op->max_conns;
+    src.max_fails = (op->max_fails == NGX_CONF_UNSET) ? 1 : op->max_fails;
+    src.fail_timeout = (op->fail_timeout == NGX_CONF_UNSET)
+                       ? 10 : op->fail_timeout;
+    src.down = (op->down == NGX_CONF_UNSET) ? 0 : op->down;
+
+    if (op->drain) {
+        src.down = 1;
+        src.drain = 1;
+    }
+
+    shpool = peers->shpool;
+
+    list = peers;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (op->backup) {
+        list = peers->next;
+
+        if (list == NULL) {
+            list = ngx_slab_calloc_locked(shpool,
+                                         sizeof(ngx_http_upstream_rr_peers_t));
+            if (list == NULL) {
+                goto failed;
+            }
+
+            /*
+             * the new list is only reachable through the primary one,
+             * which is locked for writing
+             */
+
+            list->name = peers->name;
+            list->shpool = shpool;
+            list->config = peers->config;
+
+            peers->next = list;
+        }
+    }
+
+    peer = ngx_http_upstream_zone_copy_peer(list, &src);
+    if (peer == NULL) {
+        goto failed;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    peer->id = ++(*peers->config);
+    op->id = peer->id;
+
+    for (peerp = &list->peer; *peerp; peerp = &(*peerp)->next) {
+        /* void */
+    }
+
+    *peerp = peer;
+
+    ngx_http_upstream_zone_update_peers(peers);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    *err = "no memory in upstream zone";
+
+    return NGX_ABORT;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_remove(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_conf_op_t *op)
+{
+    ngx_http_upstream_rr_peer_t    *peer, **peerp;
+    ngx_http_upstream_rr_peers_t   *list;
+
+    peer = ngx_http_upstream_conf_find(peers, op->id, &list, &peerp);
+
+    if (peer == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_http_upstream_zone_remove_peer(peers, list, peerp);
+    ngx_http_upstream_zone_update_peers(peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_modify(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_conf_op_t *op)
+{
+    ngx_http_upstream_rr_peer_t    *peer, **peerp;
+    ngx_http_upstream_rr_peers_t   *list;
+
+    peer = ngx_http_upstream_conf_find(peers, op->id, &list, &peerp);
+
+    if (peer == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (op->weight != NGX_CONF_UNSET) {
+        peer->weight = op->weight;
+        peer->effective_weight = op->weight;
+        peer->current_weight = 0;
+
+        /* weights are used by some balancers to prepare their data */
+
+        (*peers->config)++;
+    }
+
+    if (op->max_conns != NGX_CONF_UNSET) {
+        peer->max_conns = op->max_conns;
+    }
+
+    if (op->max_fails != NGX_CONF_UNSET) {
+        peer->max_fails = op->max_fails;
+    }
+
+    if (op->fail_timeout != NGX_CONF_UNSET) {
+        peer->fail_timeout = op->fail_timeout;
+    }
+
+    if (op->down != NGX_CONF_UNSET) {
+        peer->down = op->down;
+        peer->drain = 0;
+    }
+
+    if (op->drain) {
+        peer->down = 1;
+        peer->drain = 1;
+    }
+
+    ngx_http_upstream_zone_update_peers(peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_conf_find(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t id, ngx_http_upstream_rr_peers_t **listp,
+    ngx_http_upstream_rr_peer_t ***peerp)
+{
+    ngx_http_upstream_rr_peer_t  **pp;
+
+    for ( /* void */ ; peers; peers = peers->next) {
+
+        for (pp = &peers->peer; *pp; pp = &(*pp)->next) {
+
+            if ((*pp)->id == id) {
+                *listp = peers;
+                *peerp = pp;
+                return *pp;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_write_state(ngx_http_upstream_srv_conf_t *uscf,
+    ngx_buf_t *b, ngx_uint_t changes, ngx_log_t *log)
+{
+    ssize_t                        n;
+    ngx_fd_t                       fd;
+    ngx_int_t                      rc;
+    ngx_http_upstream_rr_peers_t  *peers;
+    u_char                         temp[NGX_MAX_PATH];
+
+    /* several workers may save the state at the same time */
+
+    if (uscf->state.len + sizeof(".4294967295.tmp") > NGX_MAX_PATH) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      "upstream state file name \"%V\" is too long",
+                      &uscf->state);
+        return NGX_ERROR;
+    }
+
+    (void) ngx_sprintf(temp, "%V.%P.tmp%Z", &uscf->state, ngx_pid);
+
+    fd = ngx_open_file(temp, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE,
+                       NGX_FILE_DEFAULT_ACCESS);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", temp);
+        return NGX_ERROR;
+    }
+
+    n = ngx_write_fd(fd, b->pos, b->last - b->pos);
+
+    if (n != b->last - b->pos) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_write_fd_n " \"%s\" failed", temp);
+
+        (void) ngx_close_file(fd);
+        (void) ngx_delete_file(temp);
+        return NGX_ERROR;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", temp);
+    }
+
+    /*
+     * the zone mutex orders renames, so an older state written
+     * by another worker does not replace a newer one; it is not
+     * used while selecting peers
+     */
+
+    peers = uscf->peer.data;
+    rc = NGX_OK;
+
+    ngx_shmtx_lock(&peers->shpool->mutex);
+
+    if (changes > peers->saved) {
+
+        if (ngx_rename_file(temp, uscf->state.data) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                          ngx_rename_file_n " \"%s\" to \"%V\" failed",
+                          temp, &uscf->state);
+            rc = NGX_ERROR;
+
+        } else {
+            peers->saved = changes;
+        }
+
+    } else {
+        rc = NGX_DECLINED;
+    }
+
+    ngx_shmtx_unlock(&peers->shpool->mutex);
+
+    if (rc != NGX_OK && ngx_delete_file(temp) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", temp);
+    }
+
+    return (rc == NGX_ERROR) ? NGX_ERROR : NGX_OK;
+}
+
+
+static ngx_buf_t *
+ngx_http_upstream_conf_list(ngx_pool_t *pool,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t id, ngx_uint_t state)
+{
+    size_t                         len;
+    ngx_buf_t                     *b;
+    ngx_uint_t                     backup;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    len = 0;
+
+    for (list = peers; list; list = list->next) {
+        len += list->number * NGX_HTTP_UPSTREAM_CONF_PEER_LEN;
+
+        if (!state) {
+            continue;
+        }
+
+        for (peer = list->resolve; peer; peer = peer->next) {
+            len += NGX_HTTP_UPSTREAM_CONF_PEER_LEN
+                   + sizeof(" service= resolve") - 1
+                   + peer->name.len + peer->host->service.len;
+        }
+    }
+
+    b = ngx_create_temp_buf(pool, len ? len : 1);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    for (list = peers, backup = 0; list; list = list->next, backup = 1) {
+
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (id != NGX_CONF_UNSET_UINT && peer->id != id) {
+                continue;
+            }
+
+            /* peers of resolved names are recreated on startup */
+
+            if (state && peer->host) {
+                continue;
+            }
+
+            b->last = ngx_http_upstream_conf_peer(b->last, peer, backup,
+                                                  state);
+        }
+
+        if (!state) {
+            continue;
+        }
+
+        for (peer = list->resolve; peer; peer = peer->next) {
+            b->last = ngx_http_upstream_conf_peer(b->last, peer, backup,
+                                                  state);
+        }
+    }
+
+    return b;
+}
+
+
+static u_char *
+ngx_http_upstream_conf_peer(u_char *p, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t backup, ngx_uint_t state)
+{
+    p = ngx_sprintf(p, "server %V", &peer->name);
+
+    if (peer->weight != 1) {
+        p = ngx_sprintf(p, " weight=%i", peer->weight);
+    }
+
+    if (peer->max_conns) {
+        p = ngx_sprintf(p, " max_conns=%ui", peer->max_conns);
+    }
+
+    if (peer->max_fails != 1) {
+        p = ngx_sprintf(p, " max_fails=%ui", peer->max_fails);
+    }
+
+    if (peer->fail_timeout != 10) {
+        p = ngx_sprintf(p, " fail_timeout=%Ts", peer->fail_timeout);
+    }
+
+    if (backup) {
+        p = ngx_cpymem(p, " backup", sizeof(" backup") - 1);
+    }
+
+    if (state && peer->host) {
+
+        if (peer->host->service.len) {
+            p = ngx_sprintf(p, " service=%V", &peer->host->service);
+        }
+
+        p = ngx_cpymem(p, " resolve", sizeof(" resolve") - 1);
+    }
+
+    /* the "drain" state is not preserved in the state file */
+
+    if (peer->drain && !state) {
+        p = ngx_cpymem(p, " drain", sizeof(" drain") - 1);
+
+    } else if (peer->down) {
+        p = ngx_cpymem(p, " down", sizeof(" down") - 1);
+    }
+
+    *p++ = ';';
+
+    if (!state) {
+        p = ngx_sprintf(p, " # id=%ui", peer->id);
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_send(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_buf_t *b)
+{
+    ngx_int_t    rc;
+    ngx_chain_t  out;
+
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (b->last == b->pos) {
+        r->header_only = 1;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_error(ngx_http_request_t *r, ngx_uint_t status,
+    char *err)
+{
+    size_t      len;
+    ngx_buf_t  *b;
+
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                  "upstream_conf: %s", err);
+
+    len = ngx_strlen(err);
+
+    b = ngx_create_temp_buf(r->pool, len + 1);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->last, err, len);
+    *b->last++ = LF;
+
+    return ngx_http_upstream_conf_send(r, status, b);
+}
+
+
+static char *
+ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_conf_handler;
+
+    return NGX_CONF_OK;
+}
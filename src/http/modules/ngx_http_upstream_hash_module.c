@@ -25,6 +25,9 @@ typedef struct {
 typedef struct {
     ngx_http_complex_value_t            key;
     ngx_http_upstream_chash_points_t   *points;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                          config;
+#endif
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -49,6 +52,9 @@ static ngx_int_t ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc,
 
 static ngx_int_t ngx_http_upstream_init_chash(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_update_chash(ngx_pool_t *pool,
+    ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_hash_srv_conf_t *hcf);
 static int ngx_libc_cdecl
     ngx_http_upstream_chash_cmp_points(const void *one, const void *two);
 static ngx_uint_t ngx_http_upstream_find_chash_point(
@@ -178,11 +184,18 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single) {
+    if (hp->tries > 20 || hp->rrp.peers->number < 2) {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
     now = ngx_time();
 
     pc->cached = 0;
@@ -285,19 +298,7 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 static ngx_int_t
 ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
-    u_char                             *host, *port, c;
-    size_t                              host_len, port_len, size;
-    uint32_t                            hash, base_hash;
-    ngx_str_t                          *server;
-    ngx_uint_t                          npoints, i, j;
-    ngx_http_upstream_rr_peer_t        *peer;
-    ngx_http_upstream_rr_peers_t       *peers;
-    ngx_http_upstream_chash_points_t   *points;
     ngx_http_upstream_hash_srv_conf_t  *hcf;
-    union {
-        uint32_t                        value;
-        u_char                          byte[4];
-    } prev_hash;
 
     if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
         return NGX_ERROR;
@@ -305,13 +306,59 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 
     us->peer.init = ngx_http_upstream_init_chash_peer;
 
-    peers = us->peer.data;
-    npoints = peers->total_weight * 160;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->shm_zone) {
+        /*
+         * peers may be changed at run time or kept in the "state" file,
+         * workers build the points from the shared list of peers
+         */
+        return NGX_OK;
+    }
+#endif
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    return ngx_http_upstream_update_chash(cf->pool, us->peer.data, hcf);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_update_chash(ngx_pool_t *pool,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_hash_srv_conf_t *hcf)
+{
+    u_char                            *host, *port, c;
+    size_t                             host_len, port_len, size;
+    uint32_t                           hash, base_hash;
+    ngx_str_t                         *server;
+    ngx_uint_t                         npoints, i, j;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_http_upstream_chash_points_t  *points;
+    union {
+        uint32_t                       value;
+        u_char                         byte[4];
+    } prev_hash;
+
+    npoints = 0;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        npoints += peer->weight * 160;
+    }
+
+    /* the list of peers may be empty */
 
     size = sizeof(ngx_http_upstream_chash_points_t)
-           + sizeof(ngx_http_upstream_chash_point_t) * (npoints - 1);
+           + sizeof(ngx_http_upstream_chash_point_t)
+             * (npoints ? npoints - 1 : 0);
+
+    /* points built in a worker are replaced when peers change */
+
+    if (pool) {
+        points = ngx_palloc(pool, size);
+
+    } else {
+        points = ngx_alloc(size, ngx_cycle->log);
+    }
 
-    points = ngx_palloc(cf->pool, size);
     if (points == NULL) {
         return NGX_ERROR;
     }
@@ -399,11 +446,22 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
         }
     }
 
-    points->number = i + 1;
+    if (points->number) {
+        points->number = i + 1;
+    }
+
+    if (pool == NULL && hcf->points) {
+        ngx_free(hcf->points);
+    }
 
-    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
     hcf->points = points;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config) {
+        hcf->config = *peers->config;
+    }
+#endif
+
     return NGX_OK;
 }
 
@@ -481,6 +539,19 @@ ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
 
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config
+        && (hcf->points == NULL || hcf->config != *hp->rrp.peers->config))
+    {
+        if (ngx_http_upstream_update_chash(NULL, hp->rrp.peers, hcf)
+            != NGX_OK)
+        {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return NGX_ERROR;
+        }
+    }
+#endif
+
     hp->hash = ngx_http_upstream_find_chash_point(hcf->points, hash);
 
     ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
@@ -509,11 +580,22 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single) {
+    if (hp->tries > 20 || hp->rrp.peers->number < 2
+        || hp->conf->points->number == 0)
+    {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+#endif
+
     pc->cached = 0;
     pc->connection = NULL;
 
@@ -630,6 +712,9 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    conf->config = 0;
+#endif
 
     return conf;
 }
@@ -14,9 +14,14 @@ typedef struct {
     ngx_uint_t                         max_cached;
     ngx_uint_t                         requests;
     ngx_msec_t                         timeout;
+    ngx_uint_t                         prewarm;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
+    ngx_queue_t                        connecting;
+
+    ngx_http_upstream_srv_conf_t      *upstream;
+    ngx_event_t                        prewarm_event;
 
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
@@ -65,6 +70,16 @@ static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+static ngx_int_t ngx_http_upstream_keepalive_init_worker(ngx_cycle_t *cycle);
+static void ngx_http_upstream_keepalive_prewarm(ngx_event_t *ev);
+static void ngx_http_upstream_keepalive_connect(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_cache_t *item);
+static void ngx_http_upstream_keepalive_connect_handler(ngx_event_t *ev);
+static void ngx_http_upstream_keepalive_connect_failed(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_cache_t *item);
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -100,6 +115,13 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
       offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
       NULL },
 
+    { ngx_string("keepalive_prewarm"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, prewarm),
+      NULL },
+
       ngx_null_command
 };
 
@@ -126,7 +148,7 @@ ngx_module_t  ngx_http_upstream_keepalive_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_keepalive_init_worker, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -151,6 +173,7 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
 
     ngx_conf_init_msec_value(kcf->timeout, 60000);
     ngx_conf_init_uint_value(kcf->requests, 100);
+    ngx_conf_init_uint_value(kcf->prewarm, 0);
 
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
@@ -170,6 +193,9 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
 
     ngx_queue_init(&kcf->cache);
     ngx_queue_init(&kcf->free);
+    ngx_queue_init(&kcf->connecting);
+
+    kcf->upstream = us;
 
     for (i = 0; i < kcf->max_cached; i++) {
         ngx_queue_insert_head(&kcf->free, &cached[i].queue);
@@ -470,6 +496,388 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_keepalive_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                               i;
+    ngx_event_t                             *event;
+    ngx_http_upstream_srv_conf_t            *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscf,
+                                              ngx_http_upstream_keepalive_module);
+
+        if (kcf->max_cached == 0 || kcf->prewarm == 0) {
+            continue;
+        }
+
+        event = &kcf->prewarm_event;
+
+        event->handler = ngx_http_upstream_keepalive_prewarm;
+        event->data = kcf;
+        event->log = cycle->log;
+        event->cancelable = 1;
+
+        ngx_add_timer(event, 1);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_prewarm(ngx_event_t *ev)
+{
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf = ev->data;
+
+    time_t                                now;
+    ngx_uint_t                            n;
+    ngx_queue_t                          *q, *next;
+    ngx_http_upstream_rr_peer_t          *peer;
+    ngx_http_upstream_rr_peers_t         *peers;
+    ngx_http_upstream_keepalive_cache_t  *item;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0, "keepalive prewarm");
+
+    peers = kcf->upstream->peer.data;
+    now = ngx_time();
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (peer->drain || peer->zombie) {
+            continue;
+        }
+#endif
+
+        /* count idle and connecting connections to the peer */
+
+        n = 0;
+
+        for (q = ngx_queue_head(&kcf->cache);
+             q != ngx_queue_sentinel(&kcf->cache);
+             q = ngx_queue_next(q))
+        {
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                  queue);
+
+            if (ngx_memn2cmp((u_char *) &item->sockaddr,
+                             (u_char *) peer->sockaddr,
+                             item->socklen, peer->socklen)
+                == 0)
+            {
+                n++;
+            }
+        }
+
+        for (q = ngx_queue_head(&kcf->connecting);
+             q != ngx_queue_sentinel(&kcf->connecting);
+             q = ngx_queue_next(q))
+        {
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                  queue);
+
+            if (ngx_memn2cmp((u_char *) &item->sockaddr,
+                             (u_char *) peer->sockaddr,
+                             item->socklen, peer->socklen)
+                == 0)
+            {
+                n++;
+            }
+        }
+
+        /* connections used by requests are never evicted for prewarming */
+
+        for ( /* void */ ; n < kcf->prewarm; n++) {
+
+            if (ngx_queue_empty(&kcf->free)) {
+                goto done;
+            }
+
+            q = ngx_queue_head(&kcf->free);
+            ngx_queue_remove(q);
+
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                  queue);
+
+            item->connection = NULL;
+            item->socklen = peer->socklen;
+            ngx_memcpy(&item->sockaddr, peer->sockaddr, peer->socklen);
+
+            ngx_queue_insert_tail(&kcf->connecting, q);
+        }
+    }
+
+done:
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    for (q = ngx_queue_head(&kcf->connecting);
+         q != ngx_queue_sentinel(&kcf->connecting);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+        if (item->connection == NULL) {
+            ngx_http_upstream_keepalive_connect(kcf, item);
+        }
+    }
+
+    if (ngx_exiting || ngx_terminate) {
+        return;
+    }
+
+    ngx_add_timer(ev, 1000);
+}
+
+
+static void
+ngx_http_upstream_keepalive_connect(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_cache_t *item)
+{
+    u_char                 text[NGX_SOCKADDR_STRLEN];
+    ngx_int_t              rc;
+    ngx_str_t              name;
+    ngx_connection_t      *c;
+    ngx_peer_connection_t  pc;
+
+    name.data = text;
+    name.len = ngx_sock_ntop(&item->sockaddr.sockaddr, item->socklen, text,
+                             NGX_SOCKADDR_STRLEN, 1);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "keepalive prewarm connect: %V", &name);
+
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
+
+    pc.sockaddr = &item->sockaddr.sockaddr;
+    pc.socklen = item->socklen;
+    pc.name = &name;
+    pc.get = ngx_event_get_peer;
+    pc.log = ngx_cycle->log;
+    pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&pc);
+
+    if (rc == NGX_DECLINED) {
+        ngx_http_upstream_keepalive_connect_failed(kcf, item);
+        goto failed;
+    }
+
+    if (rc == NGX_ERROR) {
+        goto failed;
+    }
+
+    c = pc.connection;
+
+    c->pool = ngx_create_pool(128, ngx_cycle->log);
+    if (c->pool == NULL) {
+        ngx_close_connection(c);
+        goto failed;
+    }
+
+    /* closed on graceful shutdown like other idle connections */
+
+    c->idle = 1;
+    c->data = item;
+    c->read->handler = ngx_http_upstream_keepalive_connect_handler;
+    c->write->handler = ngx_http_upstream_keepalive_connect_handler;
+
+    item->connection = c;
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_keepalive_connect_handler(c->write);
+        return;
+    }
+
+    ngx_add_timer(c->write, kcf->timeout);
+
+    return;
+
+failed:
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&kcf->free, &item->queue);
+}
+
+
+static void
+ngx_http_upstream_keepalive_connect_handler(ngx_event_t *ev)
+{
+    int                                      err;
+    u_char                                   text[NGX_SOCKADDR_STRLEN];
+    socklen_t                                len;
+    ngx_connection_t                        *c;
+    ngx_http_upstream_keepalive_cache_t     *item;
+    ngx_http_upstream_keepalive_srv_conf_t  *conf;
+
+    c = ev->data;
+    item = c->data;
+    conf = item->conf;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "keepalive prewarm handler: %d", ev->write);
+
+    if (c->close) {
+        goto close;
+    }
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "keepalive prewarm connect timed out");
+        goto failed;
+    }
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            goto failed;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            len = ngx_sock_ntop(&item->sockaddr.sockaddr, item->socklen, text,
+                                NGX_SOCKADDR_STRLEN, 1);
+
+            ngx_log_error(NGX_LOG_ERR, c->log, err,
+                          "connect() to %*s failed", (size_t) len, text);
+            goto failed;
+        }
+    }
+
+    if (!ev->write) {
+
+        /* the peer sent data or closed the connection */
+
+        goto close;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "keepalive prewarm: saving connection %p", c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&conf->cache, &item->queue);
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->handler = ngx_http_upstream_keepalive_dummy_handler;
+    c->read->handler = ngx_http_upstream_keepalive_close_handler;
+
+    ngx_add_timer(c->read, conf->timeout);
+
+    if (c->read->ready) {
+        ngx_http_upstream_keepalive_close_handler(c->read);
+    }
+
+    return;
+
+failed:
+
+    ngx_http_upstream_keepalive_connect_failed(conf, item);
+
+close:
+
+    ngx_http_upstream_keepalive_close(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&conf->free, &item->queue);
+}
+
+
+static void
+ngx_http_upstream_keepalive_connect_failed(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_keepalive_cache_t *item)
+{
+    time_t                         now;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    /*
+     * the failure is accounted as for requests, so the peer
+     * is not prewarmed again during fail_timeout
+     */
+
+    peers = kcf->upstream->peer.data;
+    now = ngx_time();
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) peer->sockaddr,
+                         item->socklen, peer->socklen)
+            != 0)
+        {
+            continue;
+        }
+
+        ngx_http_upstream_rr_peer_lock(peers, peer);
+
+        peer->fails++;
+        peer->accessed = now;
+        peer->checked = now;
+
+        ngx_http_upstream_rr_peer_unlock(peers, peer);
+
+        break;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -514,6 +922,7 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 
     conf->timeout = NGX_CONF_UNSET_MSEC;
     conf->requests = NGX_CONF_UNSET_UINT;
+    conf->prewarm = NGX_CONF_UNSET_UINT;
 
     return conf;
 }
@@ -124,6 +124,15 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config && rrp->config != *peers->config) {
+        if (ngx_http_upstream_rr_peer_data_renew(rrp) != NGX_OK) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return NGX_ERROR;
+        }
+    }
+#endif
+
     best = NULL;
     total = 0;
 
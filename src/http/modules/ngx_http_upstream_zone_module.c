@@ -16,8 +16,15 @@ static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
-static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
-    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+static ngx_int_t ngx_http_upstream_zone_copy_hosts(
+    ngx_http_upstream_rr_peers_t *peers);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_host(
+    ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peer_t *src);
+static ngx_int_t ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+static ngx_int_t ngx_http_upstream_zone_resolved(ngx_resolver_ctx_t *ctx,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_host_t *host);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -55,7 +62,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_worker,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -188,9 +195,15 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_http_upstream_srv_conf_t *uscf)
 {
     ngx_str_t                     *name;
+    ngx_uint_t                    *config, id;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
+    config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+    if (config == NULL) {
+        return NULL;
+    }
+
     peers = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_rr_peers_t));
     if (peers == NULL) {
         return NULL;
@@ -214,6 +227,9 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     peers->name = name;
 
     peers->shpool = shpool;
+    peers->config = config;
+
+    id = 0;
 
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
@@ -222,9 +238,15 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = id++;
+
         *peerp = peer;
     }
 
+    if (ngx_http_upstream_zone_copy_hosts(peers) != NGX_OK) {
+        return NULL;
+    }
+
     if (peers->next == NULL) {
         goto done;
     }
@@ -239,6 +261,7 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     backup->name = name;
 
     backup->shpool = shpool;
+    backup->config = config;
 
     for (peerp = &backup->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
@@ -247,20 +270,95 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
             return NULL;
         }
 
+        peer->id = id++;
+
         *peerp = peer;
     }
 
+    if (ngx_http_upstream_zone_copy_hosts(backup) != NGX_OK) {
+        return NULL;
+    }
+
     peers->next = backup;
 
 done:
 
+    /*
+     * the configuration generation is bumped on every change
+     * of the peers list, and ids of added peers are taken from it,
+     * so it starts after the ids of the configured peers
+     */
+
+    *config = id;
+
     uscf->peer.data = peers;
 
     return peers;
 }
 
 
+static ngx_int_t
+ngx_http_upstream_zone_copy_hosts(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_http_upstream_rr_peer_t  *peer, **peerp;
+
+    for (peerp = &peers->resolve; *peerp; peerp = &peer->next) {
+        peer = ngx_http_upstream_zone_copy_host(peers->shpool, *peerp);
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        *peerp = peer;
+    }
+
+    return NGX_OK;
+}
+
+
 static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_zone_copy_host(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peer_t *src)
+{
+    size_t                        size;
+    u_char                       *p;
+    ngx_http_upstream_host_t     *host;
+    ngx_http_upstream_rr_peer_t  *dst;
+
+    /* the pool is not shared yet, and allocations are not freed */
+
+    size = sizeof(ngx_http_upstream_rr_peer_t)
+           + sizeof(ngx_http_upstream_host_t)
+           + src->name.len + src->host->name.len + src->host->service.len;
+
+    dst = ngx_slab_calloc(shpool, size);
+    if (dst == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(dst, src, sizeof(ngx_http_upstream_rr_peer_t));
+
+    host = (ngx_http_upstream_host_t *) (dst + 1);
+    ngx_memcpy(host, src->host, sizeof(ngx_http_upstream_host_t));
+
+    p = (u_char *) (host + 1);
+
+    dst->name.data = p;
+    dst->server.data = p;
+    p = ngx_cpymem(p, src->name.data, src->name.len);
+
+    host->name.data = p;
+    p = ngx_cpymem(p, src->host->name.data, src->host->name.len);
+
+    host->service.data = p;
+    ngx_memcpy(p, src->host->service.data, src->host->service.len);
+
+    dst->host = host;
+
+    return dst;
+}
+
+
+ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
     ngx_http_upstream_rr_peer_t *src)
 {
@@ -279,6 +377,10 @@ ngx_http_upstream_zone_copy_peer(ngx_http_upstream_rr_peers_t *peers,
         dst->sockaddr = NULL;
         dst->name.data = NULL;
         dst->server.data = NULL;
+#if (NGX_HTTP_SSL)
+        dst->ssl_session = NULL;
+        dst->ssl_session_len = 0;
+#endif
     }
 
     dst->sockaddr = ngx_slab_calloc_locked(pool, sizeof(ngx_sockaddr_t));
@@ -323,3 +425,382 @@ failed:
 
     return NULL;
 }
+
+
+void
+ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_slab_pool_t  *pool;
+
+    pool = peers->shpool;
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(pool, peer->name.data);
+    }
+
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(pool, peer->sockaddr);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+#endif
+
+    ngx_slab_free_locked(pool, peer);
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+void
+ngx_http_upstream_zone_remove_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peers_t *list, ngx_http_upstream_rr_peer_t **peerp)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /* the peers are locked for writing */
+
+    peer = *peerp;
+    *peerp = peer->next;
+
+    (*peers->config)++;
+
+    /*
+     * connections to the peer are counted in peer->conns under the
+     * peers lock, so the last one will free the peer, see
+     * ngx_http_upstream_free_round_robin_peer()
+     */
+
+    if (peer->conns) {
+        peer->zombie = 1;
+        peer->down = 1;
+        peer->next = NULL;
+
+    } else {
+        ngx_http_upstream_zone_free_peer(list, peer);
+    }
+}
+
+
+void
+ngx_http_upstream_zone_update_peers(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                     n, w;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    for (list = peers; list; list = list->next) {
+        n = 0;
+        w = 0;
+
+        for (peer = list->peer; peer; peer = peer->next) {
+            n++;
+            w += peer->weight;
+        }
+
+        list->number = n;
+        list->total_weight = w;
+        list->weighted = (w != n);
+        list->single = 0;
+    }
+
+    peers->single = (peers->number == 1
+                     && (peers->next == NULL || peers->next->number == 0));
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i, n;
+    ngx_event_t                    *event;
+    ngx_core_conf_t                *ccf;
+    ngx_http_upstream_host_t       *host;
+    ngx_http_upstream_rr_peer_t    *peer;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL) {
+            continue;
+        }
+
+        for (peers = uscf->peer.data; peers; peers = peers->next) {
+
+            for (peer = peers->resolve; peer; peer = peer->next) {
+
+                /* each name is resolved by a single worker */
+
+                if (ngx_process == NGX_PROCESS_WORKER
+                    && n++ % ccf->worker_processes != ngx_worker)
+                {
+                    continue;
+                }
+
+                host = peer->host;
+                host->upstream = uscf;
+
+                event = &host->event;
+                ngx_memzero(event, sizeof(ngx_event_t));
+
+                event->handler = ngx_http_upstream_zone_resolve_timer;
+                event->data = host;
+                event->log = cycle->log;
+                event->cancelable = 1;
+
+                ngx_add_timer(event, 1);
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t            *ctx;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    host = event->data;
+    uscf = host->upstream;
+
+    ctx = ngx_resolve_start(uscf->resolver, NULL);
+    if (ctx == NULL) {
+        goto retry;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V", &host->name);
+        return;
+    }
+
+    ctx->name = host->name;
+    ctx->service = host->service;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = host;
+    ctx->timeout = uscf->resolver_timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+retry:
+
+    ngx_add_timer(event, ngx_max(uscf->resolver_timeout, 1000));
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                         valid;
+    ngx_event_t                   *event;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_rr_peers_t  *peers, *backup;
+
+    host = ctx->data;
+    event = &host->event;
+    peers = host->upstream->peer.data;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "%V could not be resolved (%i: %s)",
+                      &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        /* on temporary errors, the known addresses are kept */
+
+        if (ctx->state != NGX_RESOLVE_NXDOMAIN) {
+            goto done;
+        }
+
+        ctx->naddrs = 0;
+    }
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    backup = peers->next;
+
+    if (backup) {
+        ngx_http_upstream_rr_peers_wlock(backup);
+    }
+
+    (void) ngx_http_upstream_zone_resolved(ctx, peers, host);
+
+    if (backup) {
+        ngx_http_upstream_rr_peers_unlock(backup);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+done:
+
+    valid = ctx->valid - ngx_time();
+
+    ngx_resolve_name_done(ctx);
+
+    if (valid < 1) {
+        valid = 1;
+    }
+
+    ngx_add_timer(event, (ngx_msec_t) valid * 1000);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_resolved(ngx_resolver_ctx_t *ctx,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_host_t *host)
+{
+    u_char                         text[NGX_SOCKADDR_STRLEN];
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, changed;
+    ngx_resolver_addr_t           *addr;
+    ngx_http_upstream_rr_peer_t    src, *peer, *template, **peerp;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    list = host->backup ? peers->next : peers;
+
+    for (template = list->resolve; template; template = template->next) {
+        if (template->host == host) {
+            break;
+        }
+    }
+
+    addr = ctx->addrs;
+
+    if (host->service.len == 0) {
+        for (i = 0; i < ctx->naddrs; i++) {
+            ngx_inet_set_port(addr[i].sockaddr, host->port);
+        }
+    }
+
+    rc = NGX_OK;
+    changed = 0;
+
+    /* peers with addresses no longer resolved are drained */
+
+    peerp = &list->peer;
+
+    while (*peerp) {
+        peer = *peerp;
+
+        if (peer->host != host) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < ctx->naddrs; i++) {
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addr[i].sockaddr, addr[i].socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < ctx->naddrs) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, host->event.log, 0,
+                      "upstream \"%V\": server %V of %V removed",
+                      peers->name, &peer->name, &host->name);
+
+        ngx_http_upstream_zone_remove_peer(peers, list, peerp);
+        changed = 1;
+    }
+
+    /* new addresses are appended to the list */
+
+    for (i = 0; i < ctx->naddrs; i++) {
+
+        for (peer = list->peer; peer; peer = peer->next) {
+            if (peer->host == host
+                && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                    addr[i].sockaddr, addr[i].socklen, 1)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer) {
+            continue;
+        }
+
+        src = *template;
+
+        src.sockaddr = addr[i].sockaddr;
+        src.socklen = addr[i].socklen;
+        src.name.len = ngx_sock_ntop(addr[i].sockaddr, addr[i].socklen,
+                                     text, NGX_SOCKADDR_STRLEN, 1);
+        src.name.data = text;
+        src.next = NULL;
+
+        if (host->service.len && addr[i].weight) {
+            src.weight = addr[i].weight;
+            src.effective_weight = addr[i].weight;
+        }
+
+        ngx_shmtx_lock(&peers->shpool->mutex);
+        peer = ngx_http_upstream_zone_copy_peer(list, &src);
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+
+        if (peer == NULL) {
+            rc = NGX_ERROR;
+            break;
+        }
+
+        peer->id = ++(*peers->config);
+
+        *peerp = peer;
+        peerp = &peer->next;
+
+        changed = 1;
+
+        ngx_log_error(NGX_LOG_NOTICE, host->event.log, 0,
+                      "upstream \"%V\": server %V of %V added",
+                      peers->name, &peer->name, &host->name);
+    }
+
+    if (changed) {
+        ngx_http_upstream_zone_update_peers(peers);
+    }
+
+    return rc;
+}
@@ -676,6 +676,7 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_PCRE)
     ngx_uint_t                   r;
     ngx_queue_t                 *regex;
+    ngx_regex_t                **re;
 #endif
 
     locations = pclcf->locations;
@@ -785,6 +786,22 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        re = ngx_palloc(cf->temp_pool, r * sizeof(ngx_regex_t *));
+        if (re == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (n = 0; n < r; n++) {
+            re[n] = pclcf->regex_locations[n]->regex->regex;
+        }
+
+        if (ngx_regex_prefilter_init(cf->pool, re, r,
+                                     &pclcf->regex_prefilter)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
     }
 
 #endif
@@ -1768,6 +1785,10 @@ ngx_http_add_listening(ngx_conf_t *cf, ngx_http_conf_addr_t *addr)
     ls->reuseport = addr->opt.reuseport;
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    ls->reuseport_cpu = addr->opt.reuseport_cpu;
+#endif
+
     return ls;
 }
 
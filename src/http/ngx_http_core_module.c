@@ -87,6 +87,10 @@ static char *ngx_http_disable_symlinks(ngx_conf_t *cf, ngx_command_t *cmd,
 
 static char *ngx_http_core_lowat_check(ngx_conf_t *cf, void *post, void *data);
 static char *ngx_http_core_pool_size(ngx_conf_t *cf, void *post, void *data);
+static ngx_int_t ngx_http_core_add_pool_stat(ngx_conf_t *cf,
+    ngx_http_core_loc_conf_t *clcf);
+static ngx_int_t ngx_http_core_init_pool_stat_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 
 static ngx_conf_post_t  ngx_http_core_lowat_post =
     { ngx_http_core_lowat_check };
@@ -228,6 +232,20 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_srv_conf_t, request_pool_size),
       &ngx_http_core_pool_size_p },
 
+    { ngx_string("request_pool_adaptive"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_core_srv_conf_t, request_pool_adaptive),
+      NULL },
+
+    { ngx_string("request_pool_stat"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, request_pool_stat),
+      NULL },
+
     { ngx_string("client_header_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -1305,8 +1323,11 @@ ngx_http_core_find_location(ngx_http_request_t *r)
     ngx_int_t                  rc;
     ngx_http_core_loc_conf_t  *pclcf;
 #if (NGX_PCRE)
+    u_char                    *candidates;
+    u_char                     buf[NGX_REGEX_PREFILTER_STACK];
     ngx_int_t                  n;
     ngx_uint_t                 noregex;
+    ngx_regex_prefilter_t     *pf;
     ngx_http_core_loc_conf_t  *clcf, **clcfp;
 
     noregex = 0;
@@ -1339,8 +1360,33 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
+        pf = pclcf->regex_prefilter;
+        candidates = NULL;
+
+        if (pf) {
+            if (pf->size <= NGX_REGEX_PREFILTER_STACK) {
+                candidates = buf;
+
+            } else {
+                candidates = ngx_pnalloc(r->pool, pf->size);
+                if (candidates == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            ngx_regex_prefilter_exec(pf, &r->uri, candidates);
+        }
+
         for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
 
+            if (candidates) {
+                n = clcfp - pclcf->regex_locations;
+
+                if (!ngx_regex_prefilter_candidate(candidates, n)) {
+                    continue;
+                }
+            }
+
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
 
@@ -3251,6 +3297,7 @@ ngx_http_core_create_srv_conf(ngx_conf_t *cf)
 
     cscf->connection_pool_size = NGX_CONF_UNSET_SIZE;
     cscf->request_pool_size = NGX_CONF_UNSET_SIZE;
+    cscf->request_pool_adaptive = NGX_CONF_UNSET;
     cscf->client_header_timeout = NGX_CONF_UNSET_MSEC;
     cscf->client_header_buffer_size = NGX_CONF_UNSET_SIZE;
     cscf->ignore_invalid_headers = NGX_CONF_UNSET;
@@ -3279,6 +3326,8 @@ ngx_http_core_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
                               prev->connection_pool_size, 64 * sizeof(void *));
     ngx_conf_merge_size_value(conf->request_pool_size,
                               prev->request_pool_size, 4096);
+    ngx_conf_merge_value(conf->request_pool_adaptive,
+                         prev->request_pool_adaptive, 0);
     ngx_conf_merge_msec_value(conf->client_header_timeout,
                               prev->client_header_timeout, 60000);
     ngx_conf_merge_size_value(conf->client_header_buffer_size,
@@ -3402,6 +3451,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->lingering_timeout = NGX_CONF_UNSET_MSEC;
     clcf->resolver_timeout = NGX_CONF_UNSET_MSEC;
     clcf->reset_timedout_connection = NGX_CONF_UNSET;
+    clcf->request_pool_stat = NGX_CONF_UNSET;
     clcf->absolute_redirect = NGX_CONF_UNSET;
     clcf->server_name_in_redirect = NGX_CONF_UNSET;
     clcf->port_in_redirect = NGX_CONF_UNSET;
@@ -3668,6 +3718,14 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_value(conf->reset_timedout_connection,
                               prev->reset_timedout_connection, 0);
+    ngx_conf_merge_value(conf->request_pool_stat, prev->request_pool_stat, 0);
+
+    if (conf->request_pool_stat) {
+        if (ngx_http_core_add_pool_stat(cf, conf) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
     ngx_conf_merge_value(conf->absolute_redirect,
                               prev->absolute_redirect, 1);
     ngx_conf_merge_value(conf->server_name_in_redirect,
@@ -3965,6 +4023,21 @@ ngx_http_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[n].data, "reuseport=cpu") == 0) {
+#if (NGX_HAVE_REUSEPORT_CBPF)
+            lsopt.reuseport = 1;
+            lsopt.reuseport_cpu = 1;
+            lsopt.set = 1;
+            lsopt.bind = 1;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "reuseport=cpu is not supported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+            continue;
+        }
+
         if (ngx_strcmp(value[n].data, "ssl") == 0) {
 #if (NGX_HTTP_SSL)
             lsopt.ssl = 1;
@@ -5086,3 +5159,90 @@ ngx_http_core_pool_size(ngx_conf_t *cf, void *post, void *data)
 
     return NGX_CONF_OK;
 }
+
+
+static ngx_int_t
+ngx_http_core_add_pool_stat(ngx_conf_t *cf, ngx_http_core_loc_conf_t *clcf)
+{
+    ngx_str_t                   name;
+    ngx_http_pool_stat_name_t  *psn;
+    ngx_http_core_srv_conf_t   *cscf;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    if (cmcf->pool_stat_zone == NULL) {
+
+        if (ngx_array_init(&cmcf->pool_stat_names, cf->pool, 4,
+                           sizeof(ngx_http_pool_stat_name_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ngx_str_set(&name, "request_pool_stat");
+
+        cmcf->pool_stat_zone = ngx_shared_memory_add(cf, &name, 0,
+                                                     &ngx_http_core_module);
+        if (cmcf->pool_stat_zone == NULL) {
+            return NGX_ERROR;
+        }
+
+        cmcf->pool_stat_zone->init = ngx_http_core_init_pool_stat_zone;
+        cmcf->pool_stat_zone->data = cmcf;
+    }
+
+    /* the server configuration is merged before its locations */
+
+    cscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_core_module);
+
+    clcf->pool_stat_index = cmcf->pool_stat_names.nelts;
+
+    psn = ngx_array_push(&cmcf->pool_stat_names);
+    if (psn == NULL) {
+        return NGX_ERROR;
+    }
+
+    psn->server = &cscf->server_name;
+    psn->location = &clcf->name;
+
+    cmcf->pool_stat_zone->shm.size = 8 * ngx_pagesize
+                                     + ngx_align(cmcf->pool_stat_names.nelts
+                                                 * sizeof(ngx_http_pool_stat_t),
+                                                 ngx_pagesize);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_core_init_pool_stat_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_core_main_conf_t *cmcf = shm_zone->data;
+
+    size_t            size;
+    ngx_slab_pool_t  *shpool;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    size = cmcf->pool_stat_names.nelts * sizeof(ngx_http_pool_stat_t);
+
+    if (data || shm_zone->shm.exists) {
+
+        /* locations may have changed, the statistics start anew */
+
+        cmcf->pool_stats = shpool->data;
+        ngx_memzero(cmcf->pool_stats, size);
+
+        return NGX_OK;
+    }
+
+    cmcf->pool_stats = ngx_slab_calloc(shpool, size);
+    if (cmcf->pool_stats == NULL) {
+        return NGX_ERROR;
+    }
+
+    shpool->data = cmcf->pool_stats;
+
+    return NGX_OK;
+}
@@ -79,6 +79,7 @@ typedef struct {
 #endif
     unsigned                   deferred_accept:1;
     unsigned                   reuseport:1;
+    unsigned                   reuseport_cpu:1;
     unsigned                   so_keepalive:2;
     unsigned                   proxy_protocol:1;
 
@@ -150,6 +151,21 @@ typedef struct {
 } ngx_http_phase_t;
 
 
+typedef struct {
+    ngx_atomic_t               requests;
+    ngx_atomic_t               used;
+    ngx_atomic_t               peak;
+    ngx_atomic_t               blocks;
+    ngx_atomic_t               large;
+} ngx_http_pool_stat_t;
+
+
+typedef struct {
+    ngx_str_t                 *server;
+    ngx_str_t                 *location;
+} ngx_http_pool_stat_name_t;
+
+
 typedef struct {
     ngx_array_t                servers;         /* ngx_http_core_srv_conf_t */
 
@@ -174,6 +190,11 @@ typedef struct {
     ngx_array_t               *ports;
 
     ngx_http_phase_t           phases[NGX_HTTP_LOG_PHASE + 1];
+
+    /* the request pools of locations with "request_pool_stat" */
+    ngx_array_t                pool_stat_names; /* ngx_http_pool_stat_name_t */
+    ngx_http_pool_stat_t      *pool_stats;
+    ngx_shm_zone_t            *pool_stat_zone;
 } ngx_http_core_main_conf_t;
 
 
@@ -191,6 +212,11 @@ typedef struct {
 
     size_t                      connection_pool_size;
     size_t                      request_pool_size;
+    ngx_flag_t                  request_pool_adaptive;
+
+    /* the average memory used by requests, per worker */
+    size_t                      request_pool_used;
+
     size_t                      client_header_buffer_size;
 
     ngx_bufs_t                  large_client_header_buffers;
@@ -321,6 +347,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_regex_prefilter_t           *regex_prefilter;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -396,6 +423,9 @@ struct ngx_http_core_loc_conf_s {
     ngx_uint_t    server_tokens;           /* server_tokens */
     ngx_flag_t    chunked_transfer_encoding; /* chunked_transfer_encoding */
     ngx_flag_t    etag;                    /* etag */
+    ngx_flag_t    request_pool_stat;       /* request_pool_stat */
+
+    ngx_uint_t    pool_stat_index;
 
 #if (NGX_HTTP_GZIP)
     ngx_flag_t    gzip_vary;               /* gzip_vary */
@@ -466,6 +466,8 @@ ngx_http_header_filter(ngx_http_request_t *r)
     }
 
     if (r->headers_out.date == NULL) {
+        ngx_time_strings_update();
+
         b->last = ngx_cpymem(b->last, "Date: ", sizeof("Date: ") - 1);
         b->last = ngx_cpymem(b->last, ngx_cached_http_time.data,
                              ngx_cached_http_time.len);
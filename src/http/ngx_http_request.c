@@ -503,6 +503,7 @@ ngx_http_wait_request_handler(ngx_event_t *rev)
 ngx_http_request_t *
 ngx_http_create_request(ngx_connection_t *c)
 {
+    size_t                      size;
     ngx_pool_t                 *pool;
     ngx_time_t                 *tp;
     ngx_http_request_t         *r;
@@ -518,7 +519,18 @@ ngx_http_create_request(ngx_connection_t *c)
 
     cscf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_core_module);
 
-    pool = ngx_create_pool(cscf->request_pool_size, c->log);
+    size = cscf->request_pool_size;
+
+    if (cscf->request_pool_adaptive && cscf->request_pool_used > size) {
+
+        /* start with a pool large enough for a typical request */
+
+        size = ngx_max(size, ngx_min(ngx_align(cscf->request_pool_used,
+                                               ngx_pagesize),
+                                     NGX_POOL_CACHE_MAX_SIZE));
+    }
+
+    pool = ngx_create_pool(size, c->log);
     if (pool == NULL) {
         return NULL;
     }
@@ -899,6 +911,14 @@ ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg)
 
     c->ssl->buffer_size = sscf->buffer_size;
 
+    if (sscf->dynamic_records) {
+        c->ssl->dyn_rec_threshold = sscf->dynamic_records_threshold;
+        c->ssl->dyn_rec_timeout = sscf->dynamic_records_timeout;
+
+    } else {
+        c->ssl->dyn_rec_threshold = 0;
+    }
+
     if (sscf->ssl.ctx) {
         SSL_set_SSL_CTX(ssl_conn, sscf->ssl.ctx);
 
@@ -926,6 +946,148 @@ ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg)
 
 #endif
 
+
+#ifdef SSL_R_CERT_CB_ERROR
+
+int
+ngx_http_ssl_certificate(ngx_ssl_conn_t *ssl_conn, void *arg)
+{
+    ngx_str_t                   cert, key, host;
+    ngx_uint_t                  i, nelts;
+    ngx_pool_t                 *pool;
+    const char                 *servername;
+    ngx_connection_t           *c;
+    ngx_http_request_t         *r;
+    ngx_http_connection_t      *hc;
+    ngx_http_ssl_srv_conf_t    *sscf;
+    ngx_http_complex_value_t   *certs, *keys;
+    ngx_http_core_srv_conf_t   *cscf;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    if (c->ssl->handshaked) {
+        return 0;
+    }
+
+#if (NGX_THREADS)
+
+    if (c->ssl->handshake_offload) {
+
+        /* the handshake is resumed in a thread, certificates are set */
+
+        return 1;
+    }
+
+#endif
+
+    /* the name may be used as a part of file names, so it is validated */
+
+    servername = SSL_get_servername(ssl_conn, TLSEXT_NAMETYPE_host_name);
+
+    if (servername) {
+        host.len = ngx_strlen(servername);
+        host.data = (u_char *) servername;
+
+        if (ngx_http_validate_host(&host, c->pool, 0) != NGX_OK) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                          "client sent invalid server name");
+            return 0;
+        }
+    }
+
+    hc = c->data;
+    sscf = arg;
+
+    /*
+     * a lightweight request is only needed to evaluate variables,
+     * it is neither logged nor accounted
+     */
+
+    cscf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_core_module);
+
+    pool = ngx_create_pool(cscf->request_pool_size, c->log);
+    if (pool == NULL) {
+        return 0;
+    }
+
+    r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
+    if (r == NULL) {
+        goto failed;
+    }
+
+    r->pool = pool;
+
+    r->http_connection = hc;
+    r->signature = NGX_HTTP_MODULE;
+    r->connection = c;
+
+    r->main_conf = hc->conf_ctx->main_conf;
+    r->srv_conf = hc->conf_ctx->srv_conf;
+    r->loc_conf = hc->conf_ctx->loc_conf;
+
+    r->ctx = ngx_pcalloc(pool, sizeof(void *) * ngx_http_max_module);
+    if (r->ctx == NULL) {
+        goto failed;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    r->variables = ngx_pcalloc(pool, cmcf->variables.nelts
+                                     * sizeof(ngx_http_variable_value_t));
+    if (r->variables == NULL) {
+        goto failed;
+    }
+
+    r->main = r;
+    r->count = 1;
+
+    nelts = sscf->certificate_values->nelts;
+    certs = sscf->certificate_values->elts;
+    keys = sscf->certificate_key_values->elts;
+
+    for (i = 0; i < nelts; i++) {
+
+        if (ngx_http_complex_value(r, &certs[i], &cert) != NGX_OK) {
+            goto failed;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "ssl cert: \"%s\"", cert.data);
+
+        if (ngx_http_complex_value(r, &keys[i], &key) != NGX_OK) {
+            goto failed;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "ssl key: \"%s\"", key.data);
+
+        if (ngx_ssl_connection_certificate(c, pool, &cert, &key,
+                                           sscf->certificate_cache,
+                                           sscf->passwords)
+            != NGX_OK)
+        {
+            goto failed;
+        }
+    }
+
+    ngx_destroy_pool(pool);
+
+#if (NGX_THREADS)
+    return ngx_ssl_offload_handshake(ssl_conn, &sscf->ssl);
+#else
+    return 1;
+#endif
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return 0;
+}
+
+#endif
+
 #endif
 
 
@@ -3464,12 +3626,18 @@ ngx_http_close_request(ngx_http_request_t *r, ngx_int_t rc)
 void
 ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
 {
-    ngx_log_t                 *log;
-    ngx_pool_t                *pool;
-    struct linger              linger;
-    ngx_http_cleanup_t        *cln;
-    ngx_http_log_ctx_t        *ctx;
-    ngx_http_core_loc_conf_t  *clcf;
+    size_t                      used;
+    ngx_log_t                  *log;
+    ngx_pool_t                 *pool;
+    struct linger               linger;
+    ngx_pool_stat_t             stat;
+    ngx_atomic_uint_t           peak;
+    ngx_http_cleanup_t         *cln;
+    ngx_http_log_ctx_t         *ctx;
+    ngx_http_pool_stat_t       *ps;
+    ngx_http_core_srv_conf_t   *cscf;
+    ngx_http_core_loc_conf_t   *clcf;
+    ngx_http_core_main_conf_t  *cmcf;
 
     log = r->connection->log;
 
@@ -3529,6 +3697,53 @@ ngx_http_free_request(ngx_http_request_t *r, ngx_int_t rc)
         }
     }
 
+    /*
+     * the average is kept in the default server of the address,
+     * as the pool is created before the virtual server is known
+     */
+
+    cscf = ngx_http_get_module_srv_conf(r->http_connection->conf_ctx,
+                                        ngx_http_core_module);
+
+    if (cscf->request_pool_adaptive
+#if (NGX_HTTP_V2)
+        && r->stream == NULL
+#endif
+       )
+    {
+        ngx_pool_stat(r->pool, &stat);
+
+        if (stat.used > cscf->request_pool_used) {
+            cscf->request_pool_used += (stat.used - cscf->request_pool_used)
+                                       / 8;
+
+        } else {
+            cscf->request_pool_used -= (cscf->request_pool_used - stat.used)
+                                       / 8;
+        }
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->request_pool_stat) {
+        cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+        ps = &cmcf->pool_stats[clcf->pool_stat_index];
+
+        ngx_pool_stat(r->pool, &stat);
+
+        /* memory used in blocks and by large allocations */
+        used = stat.used + stat.large_size;
+
+        (void) ngx_atomic_fetch_add(&ps->requests, 1);
+        (void) ngx_atomic_fetch_add(&ps->used, used);
+        (void) ngx_atomic_fetch_add(&ps->blocks, stat.blocks);
+        (void) ngx_atomic_fetch_add(&ps->large, stat.large);
+
+        do {
+            peak = ps->peak;
+        } while (used > peak && !ngx_atomic_cmp_set(&ps->peak, peak, used));
+    }
+
     /* the various request strings were allocated from r->pool */
     ctx = log->data;
     ctx->request = NULL;
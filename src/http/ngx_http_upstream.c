@@ -10,6 +10,9 @@
 #include <ngx_http.h>
 
 
+#define NGX_HTTP_UPSTREAM_QUEUE_POLL  100
+
+
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
@@ -37,6 +40,14 @@ static void ngx_http_upstream_check_broken_connection(ngx_http_request_t *r,
     ngx_event_t *ev);
 static void ngx_http_upstream_connect(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
+static ngx_int_t ngx_http_upstream_queue_request(ngx_http_request_t *r,
+    ngx_http_upstream_t *u);
+static void ngx_http_upstream_queue_handler(ngx_event_t *ev);
+static void ngx_http_upstream_queue_remove(ngx_http_upstream_t *u);
+static void ngx_http_upstream_queue_wakeup(ngx_http_upstream_srv_conf_t *uscf);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static void ngx_http_upstream_queue_poll(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_upstream_reinit(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_send_request(ngx_http_request_t *r,
@@ -174,6 +185,12 @@ static ngx_int_t ngx_http_upstream_cookie_variable(ngx_http_request_t *r,
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_queue(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static char *ngx_http_upstream_state(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#endif
 
 static ngx_int_t ngx_http_upstream_set_local(ngx_http_request_t *r,
   ngx_http_upstream_t *u, ngx_http_upstream_local_t *local);
@@ -188,6 +205,8 @@ static void ngx_http_upstream_ssl_handshake_handler(ngx_connection_t *c);
 static void ngx_http_upstream_ssl_handshake(ngx_http_request_t *,
     ngx_http_upstream_t *u, ngx_connection_t *c);
 static void ngx_http_upstream_ssl_save_session(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_ssl_session_key(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_str_t *key);
 static ngx_int_t ngx_http_upstream_ssl_name(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_connection_t *c);
 #endif
@@ -344,6 +363,24 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+    { ngx_string("queue"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_queue,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    { ngx_string("state"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_state,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
       ngx_null_command
 };
 
@@ -401,6 +438,10 @@ static ngx_http_variable_t  ngx_http_upstream_vars[] = {
       ngx_http_upstream_response_time_variable, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("upstream_queue_time"), NULL,
+      ngx_http_upstream_response_time_variable, 3,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("upstream_response_length"), NULL,
       ngx_http_upstream_response_length_variable, 0,
       NGX_HTTP_VAR_NOCACHEABLE, 0 },
@@ -628,6 +669,10 @@ ngx_http_upstream_init_request(ngx_http_request_t *r)
         return;
     }
 
+    if (u->conf->fastopen) {
+        u->peer.fastopen = 1;
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     u->output.alignment = clcf->directio_alignment;
@@ -1518,6 +1563,11 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->state->connect_time = (ngx_msec_t) -1;
     u->state->header_time = (ngx_msec_t) -1;
 
+    if (u->waiter) {
+        u->state->queue_time = u->waiter->time;
+        u->waiter->time = 0;
+    }
+
     rc = ngx_event_connect_peer(&u->peer);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
@@ -1532,6 +1582,11 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->state->peer = u->peer.name;
 
     if (rc == NGX_BUSY) {
+
+        if (ngx_http_upstream_queue_request(r, u) == NGX_OK) {
+            return;
+        }
+
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
         return;
@@ -1643,6 +1698,226 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
+static ngx_int_t
+ngx_http_upstream_queue_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
+{
+    ngx_msec_t                     timer;
+    ngx_http_upstream_waiter_t    *w;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = u->upstream;
+
+    if (uscf == NULL || uscf->queue_size == 0) {
+        return NGX_DECLINED;
+    }
+
+    if ((uscf->flags & NGX_HTTP_UPSTREAM_MAX_CONNS)
+        && !ngx_http_upstream_rr_peers_limited(uscf->peer.data))
+    {
+        /* releasing a connection will not help, e.g. all peers are down */
+        return NGX_DECLINED;
+    }
+
+    if (uscf->queue_len >= uscf->queue_size) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "upstream queue is full");
+        return NGX_DECLINED;
+    }
+
+    w = u->waiter;
+
+    if (w == NULL) {
+        w = ngx_pcalloc(r->pool, sizeof(ngx_http_upstream_waiter_t));
+        if (w == NULL) {
+            return NGX_DECLINED;
+        }
+
+        w->start = ngx_current_msec;
+
+        w->event.handler = ngx_http_upstream_queue_handler;
+        w->event.data = r;
+        w->event.log = r->connection->log;
+
+        u->waiter = w;
+
+        timer = uscf->queue_timeout;
+
+        ngx_queue_insert_tail(&uscf->queue, &w->queue);
+
+    } else {
+
+        /*
+         * the request was woken up, but the released slot was taken
+         * by someone else, so it keeps its place in the queue
+         */
+
+        timer = ngx_current_msec - w->start;
+
+        if (timer >= uscf->queue_timeout) {
+            return NGX_DECLINED;
+        }
+
+        timer = uscf->queue_timeout - timer;
+
+        ngx_queue_insert_head(&uscf->queue, &w->queue);
+    }
+
+    uscf->queue_len++;
+
+    ngx_add_timer(&w->event, timer);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (uscf->shm_zone && !uscf->queue_poll.timer_set) {
+
+        /* peers may be released by other worker processes as well */
+
+        uscf->queue_poll.handler = ngx_http_upstream_queue_poll;
+        uscf->queue_poll.data = uscf;
+        uscf->queue_poll.log = ngx_cycle->log;
+        uscf->queue_poll.cancelable = 1;
+
+        ngx_add_timer(&uscf->queue_poll, NGX_HTTP_UPSTREAM_QUEUE_POLL);
+    }
+
+#endif
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http upstream queued, waiting: %ui, timer: %M",
+                   uscf->queue_len, timer);
+
+    /* the state of the attempt will be recreated when the request is woken */
+
+    r->upstream_states->nelts--;
+    u->state = NULL;
+
+    r->connection->log->action = "waiting in upstream queue";
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_queue_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                     len;
+    ngx_connection_t              *c;
+    ngx_http_request_t            *r;
+    ngx_http_upstream_t           *u;
+    ngx_http_upstream_waiter_t    *w;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    r = ev->data;
+    c = r->connection;
+    u = r->upstream;
+    w = u->waiter;
+    uscf = u->upstream;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream queue handler: \"%V?%V\"", &r->uri, &r->args);
+
+    if (ev->timedout) {
+        ev->timedout = 0;
+
+        ngx_queue_remove(&w->queue);
+        u->upstream->queue_len--;
+
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                      "upstream queue timed out");
+
+        w->time = ngx_current_msec - w->start;
+
+        ngx_http_upstream_connect(r, u);
+
+        ngx_http_run_posted_requests(c);
+        return;
+    }
+
+    w->time = ngx_current_msec - w->start;
+
+    len = uscf->queue_len;
+
+    ngx_http_upstream_connect(r, u);
+
+    if (uscf->queue_len == len) {
+
+        /*
+         * the request was not queued again, so the peer was free:
+         * there may be more of them, e.g. released by other workers
+         */
+
+        ngx_http_upstream_queue_wakeup(uscf);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_upstream_queue_remove(ngx_http_upstream_t *u)
+{
+    ngx_http_upstream_waiter_t  *w;
+
+    w = u->waiter;
+
+    if (w->event.timer_set) {
+        ngx_del_timer(&w->event);
+
+        ngx_queue_remove(&w->queue);
+        u->upstream->queue_len--;
+    }
+
+    if (w->event.posted) {
+        ngx_delete_posted_event(&w->event);
+    }
+}
+
+
+static void
+ngx_http_upstream_queue_wakeup(ngx_http_upstream_srv_conf_t *uscf)
+{
+    ngx_queue_t                 *q;
+    ngx_http_upstream_waiter_t  *w;
+
+    if (uscf == NULL || uscf->queue_len == 0) {
+        return;
+    }
+
+    /* a peer was released, pass the chance to the oldest waiting request */
+
+    q = ngx_queue_head(&uscf->queue);
+    ngx_queue_remove(q);
+    uscf->queue_len--;
+
+    w = ngx_queue_data(q, ngx_http_upstream_waiter_t, queue);
+
+    ngx_del_timer(&w->event);
+    ngx_post_event(&w->event, &ngx_posted_events);
+}
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static void
+ngx_http_upstream_queue_poll(ngx_event_t *ev)
+{
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ev->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http upstream queue poll, waiting: %ui", uscf->queue_len);
+
+    /* the woken request is queued again if the peers are still busy */
+
+    ngx_http_upstream_queue_wakeup(uscf);
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 static void
@@ -1650,6 +1925,7 @@ ngx_http_upstream_ssl_init_connection(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_connection_t *c)
 {
     ngx_int_t                  rc;
+    ngx_str_t                  key;
     ngx_http_core_loc_conf_t  *clcf;
 
     if (ngx_http_upstream_test_connect(c) != NGX_OK) {
@@ -1680,7 +1956,22 @@ ngx_http_upstream_ssl_init_connection(ngx_http_request_t *r,
     if (u->conf->ssl_session_reuse) {
         c->ssl->save_session = ngx_http_upstream_ssl_save_session;
 
-        if (u->peer.set_session(&u->peer, u->peer.data) != NGX_OK) {
+        if (u->conf->ssl_session_cache) {
+            if (ngx_http_upstream_ssl_session_key(r, u, &key) != NGX_OK) {
+                ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+                return;
+            }
+
+            rc = ngx_ssl_set_cached_client_session(c,
+                                                   u->conf->ssl_session_cache,
+                                                   &key);
+
+        } else {
+            rc = u->peer.set_session(&u->peer, u->peer.data);
+        }
+
+        if (rc == NGX_ERROR) {
             ngx_http_upstream_finalize_request(r, u,
                                                NGX_HTTP_INTERNAL_SERVER_ERROR);
             return;
@@ -1786,6 +2077,8 @@ failed:
 static void
 ngx_http_upstream_ssl_save_session(ngx_connection_t *c)
 {
+    ngx_str_t             key;
+    ngx_connection_t     *pc;
     ngx_http_request_t   *r;
     ngx_http_upstream_t  *u;
 
@@ -1796,11 +2089,44 @@ ngx_http_upstream_ssl_save_session(ngx_connection_t *c)
     r = c->data;
 
     u = r->upstream;
+    pc = c;
     c = r->connection;
 
     ngx_http_set_log_request(c->log, r);
 
-    u->peer.save_session(&u->peer, u->peer.data);
+    if (u->conf->ssl_session_cache == NULL) {
+        u->peer.save_session(&u->peer, u->peer.data);
+        return;
+    }
+
+    if (ngx_http_upstream_ssl_session_key(r, u, &key) != NGX_OK) {
+        return;
+    }
+
+    ngx_ssl_cache_client_session(pc, u->conf->ssl_session_cache, &key);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_ssl_session_key(ngx_http_request_t *r,
+    ngx_http_upstream_t *u, ngx_str_t *key)
+{
+    u_char  *p;
+
+    /* the context tag, the peer address, and the server name */
+
+    key->len = sizeof(uint32_t) + u->peer.socklen + u->ssl_name.len;
+
+    key->data = ngx_pnalloc(r->pool, key->len);
+    if (key->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(key->data, &u->conf->ssl->session_tag, sizeof(uint32_t));
+    p = ngx_cpymem(p, u->peer.sockaddr, u->peer.socklen);
+    ngx_memcpy(p, u->ssl_name.data, u->ssl_name.len);
+
+    return NGX_OK;
 }
 
 
@@ -4141,6 +4467,8 @@ ngx_http_upstream_next(ngx_http_request_t *r, ngx_http_upstream_t *u,
 
         u->peer.free(&u->peer, u->peer.data, state);
         u->peer.sockaddr = NULL;
+
+        ngx_http_upstream_queue_wakeup(u->upstream);
     }
 
     if (ft_type == NGX_HTTP_UPSTREAM_FT_TIMEOUT) {
@@ -4305,6 +4633,10 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         u->resolved->ctx = NULL;
     }
 
+    if (u->waiter) {
+        ngx_http_upstream_queue_remove(u);
+    }
+
     if (u->state && u->state->response_time) {
         u->state->response_time = ngx_current_msec - u->state->response_time;
 
@@ -4320,6 +4652,8 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     if (u->peer.free && u->peer.sockaddr) {
         u->peer.free(&u->peer, u->peer.data, 0);
         u->peer.sockaddr = NULL;
+
+        ngx_http_upstream_queue_wakeup(u->upstream);
     }
 
     if (u->peer.connection) {
@@ -5423,6 +5757,9 @@ ngx_http_upstream_response_time_variable(ngx_http_request_t *r,
             } else if (data == 2 && state[i].connect_time != (ngx_msec_t) -1) {
                 ms = state[i].connect_time;
 
+            } else if (data == 3) {
+                ms = state[i].queue_time;
+
             } else {
                 ms = state[i].response_time;
             }
@@ -5777,12 +6114,22 @@ ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy)
         return rv;
     }
 
-    if (uscf->servers->nelts == 0) {
+    if (uscf->servers->nelts == 0 && uscf->state.data == NULL) {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "no servers are inside upstream");
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (uscf->state.data && uscf->shm_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"state\" requires upstream \"zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
     return rv;
 }
 
@@ -5796,9 +6143,13 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                   *value, s;
     ngx_url_t                    u;
     ngx_int_t                    weight, max_conns, max_fails;
-    ngx_uint_t                   i;
+    ngx_uint_t                   i, resolve;
     ngx_http_upstream_server_t  *us;
 
+    if (uscf->state.data) {
+        return "conflicts with \"state\" directive";
+    }
+
     us = ngx_array_push(uscf->servers);
     if (us == NULL) {
         return NGX_CONF_ERROR;
@@ -5812,6 +6163,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    resolve = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -5900,6 +6252,27 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+            resolve = 1;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "service=", 8) == 0) {
+
+            us->service.len = value[i].len - 8;
+            us->service.data = &value[i].data[8];
+
+            if (us->service.len == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+#endif
+
         goto invalid;
     }
 
@@ -5907,6 +6280,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     u.url = value[1];
     u.default_port = 80;
+    u.no_resolve = resolve;
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
         if (u.err) {
@@ -5917,6 +6291,34 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (us->service.len && !resolve) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires "
+                           "\"resolve\" parameter", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    if (resolve && u.naddrs == 0) {
+
+        if (us->service.len && !u.no_port) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "service upstream \"%V\" may not have port",
+                               &u.url);
+            return NGX_CONF_ERROR;
+        }
+
+        /* the name is resolved at run time by the upstream zone module */
+
+        us->host = u.host;
+        us->port = u.port;
+
+    } else if (us->service.len) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "service upstream \"%V\" requires domain name",
+                           &u.url);
+        return NGX_CONF_ERROR;
+    }
+
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
@@ -5944,6 +6346,119 @@ not_supported:
 }
 
 
+static char *
+ngx_http_upstream_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value, s;
+    ngx_msec_t  timeout;
+
+    if (uscf->queue_size) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid queue size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    timeout = 60000;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "timeout=", 8) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[2].len - 8;
+        s.data = value[2].data + 8;
+
+        timeout = ngx_parse_time(&s, 0);
+
+        if (timeout == (ngx_msec_t) NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid timeout \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    uscf->queue_size = n;
+    uscf->queue_timeout = timeout;
+
+    ngx_queue_init(&uscf->queue);
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static char *
+ngx_http_upstream_state(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_srv_conf_t  *uscf = conf;
+
+    char             *rv;
+    ngx_str_t        *value, file;
+    ngx_file_info_t   fi;
+
+    if (uscf->state.data) {
+        return "is duplicate";
+    }
+
+    if (uscf->servers->nelts) {
+        return "conflicts with \"server\" directive";
+    }
+
+    value = cf->args->elts;
+    file = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &file, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * the state file contains "server" directives and is parsed
+     * in the context of the upstream block; it is created and rewritten
+     * on runtime changes of the peers list
+     */
+
+    if (ngx_file_info(file.data, &fi) == NGX_FILE_ERROR) {
+
+        if (ngx_errno != NGX_ENOENT) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                               ngx_file_info_n " \"%s\" failed", file.data);
+            return NGX_CONF_ERROR;
+        }
+
+    } else {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "state %s", file.data);
+
+        rv = ngx_conf_parse(cf, &file);
+
+        if (rv != NGX_CONF_OK) {
+            return rv;
+        }
+    }
+
+    uscf->state = file;
+
+    return NGX_CONF_OK;
+}
+
+#endif
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
@@ -6252,6 +6767,103 @@ ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 }
 
 
+#if (NGX_HTTP_SSL)
+
+/*
+ * the zone tag, distinct from &ngx_http_upstream_module used by
+ * upstream zones, so a name clash is reported at configuration time
+ */
+
+static ngx_uint_t  ngx_http_upstream_ssl_session_cache_tag;
+
+
+char *
+ngx_http_upstream_ssl_session_cache_set_slot(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf)
+{
+    char  *p = conf;
+
+    size_t                           len;
+    ssize_t                          size;
+    ngx_str_t                       *value, name, s;
+    ngx_shm_zone_t                 **zone;
+    ngx_ssl_client_session_cache_t  *cache;
+
+    zone = (ngx_shm_zone_t **) (p + cmd->offset);
+
+    if (*zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        *zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (value[1].len <= sizeof("shared:") - 1
+        || ngx_strncmp(value[1].data, "shared:", sizeof("shared:") - 1) != 0)
+    {
+        goto invalid;
+    }
+
+    name.data = value[1].data + sizeof("shared:") - 1;
+    name.len = value[1].len - (sizeof("shared:") - 1);
+
+    s.data = ngx_strlchr(name.data, name.data + name.len, ':');
+
+    if (s.data == NULL || s.data == name.data) {
+        goto invalid;
+    }
+
+    len = s.data - name.data;
+
+    s.data++;
+    s.len = name.len - len - 1;
+    name.len = len;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        goto invalid;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "session cache \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    *zone = ngx_shared_memory_add(cf, &name, size,
+                                  &ngx_http_upstream_ssl_session_cache_tag);
+    if (*zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if ((*zone)->data == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_client_session_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        (*zone)->init = ngx_ssl_client_session_cache_init;
+        (*zone)->data = cache;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid session cache \"%V\"", &value[1]);
+
+    return NGX_CONF_ERROR;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
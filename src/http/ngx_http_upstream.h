@@ -101,9 +101,13 @@ typedef struct {
     ngx_msec_t                       slow_start;
     ngx_uint_t                       down;
 
+    ngx_str_t                        host;
+    ngx_str_t                        service;
+    in_port_t                        port;
+
     unsigned                         backup:1;
 
-    NGX_COMPAT_BEGIN(6)
+    NGX_COMPAT_BEGIN(1)
     NGX_COMPAT_END
 } ngx_http_upstream_server_t;
 
@@ -130,12 +134,30 @@ struct ngx_http_upstream_srv_conf_s {
     in_port_t                        port;
     ngx_uint_t                       no_port;  /* unsigned no_port:1 */
 
+    ngx_str_t                        state;
+
+    ngx_uint_t                       queue_size;
+    ngx_msec_t                       queue_timeout;
+    ngx_uint_t                       queue_len;
+    ngx_queue_t                      queue;
+
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_resolver_t                  *resolver;
+    ngx_msec_t                       resolver_timeout;
+    ngx_event_t                      queue_poll;
 #endif
 };
 
 
+typedef struct {
+    ngx_queue_t                      queue;
+    ngx_event_t                      event;
+    ngx_msec_t                       start;
+    ngx_msec_t                       time;
+} ngx_http_upstream_waiter_t;
+
+
 typedef struct {
     ngx_addr_t                      *addr;
     ngx_http_complex_value_t        *value;
@@ -180,6 +202,7 @@ typedef struct {
     ngx_flag_t                       intercept_errors;
     ngx_flag_t                       cyclic_temp_file;
     ngx_flag_t                       force_ranges;
+    ngx_flag_t                       fastopen;
 
     ngx_path_t                      *temp_path;
 
@@ -228,6 +251,7 @@ typedef struct {
 #if (NGX_HTTP_SSL || NGX_COMPAT)
     ngx_ssl_t                       *ssl;
     ngx_flag_t                       ssl_session_reuse;
+    ngx_shm_zone_t                  *ssl_session_cache;
 
     ngx_http_complex_value_t        *ssl_name;
     ngx_flag_t                       ssl_server_name;
@@ -337,6 +361,8 @@ struct ngx_http_upstream_s {
 
     ngx_http_upstream_resolved_t    *resolved;
 
+    ngx_http_upstream_waiter_t      *waiter;
+
     ngx_buf_t                        from_client;
 
     ngx_buf_t                        buffer;
@@ -418,6 +444,10 @@ char *ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 char *ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HTTP_SSL)
+char *ngx_http_upstream_ssl_session_cache_set_slot(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+#endif
 ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
     ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash);
@@ -17,6 +17,14 @@
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t ngx_http_upstream_init_round_robin_hosts(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t backup);
+
+#endif
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t ngx_http_upstream_empty_set_session(ngx_peer_connection_t *pc,
@@ -32,10 +40,13 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w;
+    ngx_uint_t                     i, j, n, w, r;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_core_loc_conf_t      *clcf;
+#endif
 
     us->peer.init = ngx_http_upstream_init_round_robin_peer;
 
@@ -44,6 +55,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (server[i].backup) {
@@ -52,9 +64,54 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
+
+            if (server[i].host.len) {
+                r++;
+            }
         }
 
-        if (n == 0) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+        for (i = 0; i < us->servers->nelts; i++) {
+            if (server[i].host.len) {
+                break;
+            }
+        }
+
+        if (i < us->servers->nelts) {
+
+            if (us->shm_zone == NULL) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "resolving names at run time requires "
+                              "upstream \"%V\" in %s:%ui "
+                              "to be in shared memory",
+                              &us->host, us->file_name, us->line);
+                return NGX_ERROR;
+            }
+
+            clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+            if (clcf->resolver == NULL
+                || clcf->resolver->connections.nelts == 0)
+            {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "no resolver defined to resolve names "
+                              "at run time in upstream \"%V\" in %s:%ui",
+                              &us->host, us->file_name, us->line);
+                return NGX_ERROR;
+            }
+
+            /* the http{} level configuration is not merged */
+
+            ngx_conf_init_msec_value(clcf->resolver_timeout, 30000);
+
+            us->resolver = clcf->resolver;
+            us->resolver_timeout = clcf->resolver_timeout;
+        }
+
+#endif
+
+        if (n + r == 0 && us->state.data == NULL) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
@@ -106,10 +163,19 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         us->peer.data = peers;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && ngx_http_upstream_init_round_robin_hosts(cf, us, peers, 0)
+                 != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+#endif
+
         /* backup servers */
 
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (!server[i].backup) {
@@ -118,9 +184,13 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
+
+            if (server[i].host.len) {
+                r++;
+            }
         }
 
-        if (n == 0) {
+        if (n + r == 0) {
             return NGX_OK;
         }
 
@@ -170,6 +240,14 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         peers->next = backup;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && ngx_http_upstream_init_round_robin_hosts(cf, us, backup, 1)
+                 != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+#endif
+
         return NGX_OK;
     }
 
@@ -240,6 +318,67 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_init_round_robin_hosts(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us, ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t backup)
+{
+    ngx_uint_t                     i;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_server_t    *server;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+
+    /*
+     * servers resolved at run time are kept as templates in
+     * the peers->resolve list, peers are created from them
+     * once the names are resolved
+     */
+
+    server = us->servers->elts;
+    peerp = &peers->resolve;
+
+    for (i = 0; i < us->servers->nelts; i++) {
+        if (server[i].host.len == 0 || server[i].backup != backup) {
+            continue;
+        }
+
+        peer = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peer_t));
+        if (peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        host = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_host_t));
+        if (host == NULL) {
+            return NGX_ERROR;
+        }
+
+        host->name = server[i].host;
+        host->service = server[i].service;
+        host->port = server[i].port;
+        host->backup = backup;
+
+        peer->name = server[i].name;
+        peer->server = server[i].name;
+        peer->weight = server[i].weight;
+        peer->effective_weight = server[i].weight;
+        peer->max_conns = server[i].max_conns;
+        peer->max_fails = server[i].max_fails;
+        peer->fail_timeout = server[i].fail_timeout;
+        peer->down = server[i].down;
+        peer->host = host;
+
+        *peerp = peer;
+        peerp = &peer->next;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us)
@@ -262,15 +401,26 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->current = NULL;
     rrp->config = 0;
 
+    ngx_http_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (rrp->peers->config) {
+        rrp->config = *rrp->peers->config;
+    }
+#endif
+
     n = rrp->peers->number;
 
     if (rrp->peers->next && rrp->peers->next->number > n) {
         n = rrp->peers->next->number;
     }
 
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
+        n = 1;
 
     } else {
         n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
@@ -281,6 +431,11 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
         }
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rrp->ntried = n;
+    rrp->pool = r->pool;
+#endif
+
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
     r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
@@ -432,6 +587,17 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (peers->config && rrp->config != *peers->config) {
+        if (ngx_http_upstream_rr_peer_data_renew(rrp) != NGX_OK) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
     if (peers->single) {
         peer = peers->peer;
 
@@ -504,6 +670,52 @@ failed:
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+ngx_int_t
+ngx_http_upstream_rr_peer_data_renew(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    uintptr_t   *tried;
+    ngx_uint_t   i, n;
+
+    /*
+     * the peers list was changed since the request was started,
+     * positions of peers are not the same, so the tried bitmap
+     * is resized for the current list and cleared
+     */
+
+    n = rrp->peers->number;
+
+    if (rrp->peers->next && rrp->peers->next->number > n) {
+        n = rrp->peers->next->number;
+    }
+
+    n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
+
+    if (n > rrp->ntried) {
+        tried = ngx_pcalloc(rrp->pool, n * sizeof(uintptr_t));
+        if (tried == NULL) {
+            return NGX_ERROR;
+        }
+
+        rrp->tried = tried;
+        rrp->ntried = n;
+
+    } else {
+        for (i = 0; i < rrp->ntried; i++) {
+            rrp->tried[i] = 0;
+        }
+    }
+
+    rrp->current = NULL;
+    rrp->config = *rrp->peers->config;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
@@ -590,6 +802,9 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     time_t                       now;
     ngx_http_upstream_rr_peer_t  *peer;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                   zombie;
+#endif
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free rr peer %ui %ui", pc->tries, state);
@@ -605,7 +820,18 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
         peer->conns--;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        zombie = (peer->zombie && peer->conns == 0);
+#endif
+
         ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (zombie) {
+            ngx_http_upstream_zone_free_peer(rrp->peers, peer);
+        }
+#endif
+
         ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
         pc->tries = 0;
@@ -647,7 +873,22 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 
     peer->conns--;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /* the peer was removed from the list while it was in use */
+
+    zombie = (peer->zombie && peer->conns == 0);
+
+#endif
+
     ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (zombie) {
+        ngx_http_upstream_zone_free_peer(rrp->peers, peer);
+    }
+#endif
+
     ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
     if (pc->tries) {
@@ -656,6 +897,43 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
 }
 
 
+ngx_uint_t
+ngx_http_upstream_rr_peers_limited(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                     limited;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    /*
+     * tests if there is a peer which is only limited by max_conns,
+     * and thus may become available when a connection is released
+     */
+
+    limited = 0;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (list = peers; list && !limited; list = list->next) {
+
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (peer->down) {
+                continue;
+            }
+
+            if (peer->max_conns && peer->conns >= peer->max_conns) {
+                limited = 1;
+                break;
+            }
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return limited;
+}
+
+
 #if (NGX_HTTP_SSL)
 
 ngx_int_t
@@ -16,6 +16,22 @@
 
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+typedef struct {
+    ngx_str_t                       name;
+    ngx_str_t                       service;
+    in_port_t                       port;
+    unsigned                        backup:1;
+
+    /* used by the worker resolving the name */
+    ngx_http_upstream_srv_conf_t   *upstream;
+    ngx_event_t                     event;
+} ngx_http_upstream_host_t;
+
+#endif
+
 struct ngx_http_upstream_rr_peer_s {
     struct sockaddr                *sockaddr;
     socklen_t                       socklen;
@@ -47,11 +63,15 @@ struct ngx_http_upstream_rr_peer_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_atomic_t                    lock;
+    ngx_uint_t                      id;
+    ngx_http_upstream_host_t       *host;
+    unsigned                        drain:1;
+    unsigned                        zombie:1;
 #endif
 
     ngx_http_upstream_rr_peer_t    *next;
 
-    NGX_COMPAT_BEGIN(32)
+    NGX_COMPAT_BEGIN(29)
     NGX_COMPAT_END
 };
 
@@ -64,6 +84,10 @@ struct ngx_http_upstream_rr_peers_s {
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
+    ngx_uint_t                     *config;
+    ngx_uint_t                      changes;
+    ngx_uint_t                      saved;
+    ngx_http_upstream_rr_peer_t    *resolve;
     ngx_http_upstream_rr_peers_t   *zone_next;
 #endif
 
@@ -130,6 +154,10 @@ typedef struct {
     ngx_http_upstream_rr_peer_t    *current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                      ntried;
+    ngx_pool_t                     *pool;
+#endif
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -143,6 +171,23 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
     void *data);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+ngx_uint_t ngx_http_upstream_rr_peers_limited(
+    ngx_http_upstream_rr_peers_t *peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_int_t ngx_http_upstream_rr_peer_data_renew(
+    ngx_http_upstream_rr_peer_data_t *rrp);
+#endif
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+void ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer);
+void ngx_http_upstream_zone_remove_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peers_t *list, ngx_http_upstream_rr_peer_t **peerp);
+void ngx_http_upstream_zone_update_peers(ngx_http_upstream_rr_peers_t *peers);
+#endif
 
 #if (NGX_HTTP_SSL)
 ngx_int_t
@@ -105,6 +105,8 @@ static ngx_int_t ngx_http_variable_request_length(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_time(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_variable_request_pool(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_request_id(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_status(ngx_http_request_t *r,
@@ -286,6 +288,15 @@ static ngx_http_variable_t  ngx_http_core_variables[] = {
     { ngx_string("request_time"), NULL, ngx_http_variable_request_time,
       0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("request_pool_used"), NULL, ngx_http_variable_request_pool,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_pool_blocks"), NULL, ngx_http_variable_request_pool,
+      1, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("request_pool_large"), NULL, ngx_http_variable_request_pool,
+      2, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
     { ngx_string("request_id"), NULL,
       ngx_http_variable_request_id,
       0, 0, 0 },
@@ -2144,6 +2155,47 @@ ngx_http_variable_request_time(ngx_http_request_t *r,
 }
 
 
+static ngx_int_t
+ngx_http_variable_request_pool(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char           *p;
+    size_t            value;
+    ngx_pool_stat_t   stat;
+
+    p = ngx_pnalloc(r->pool, NGX_SIZE_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_pool_stat(r->main->pool, &stat);
+
+    switch (data) {
+
+    case 0:
+        /* memory used in blocks and by large allocations */
+        value = stat.used + stat.large_size;
+        break;
+
+    case 1:
+        value = stat.blocks;
+        break;
+
+    default: /* 2 */
+        value = stat.large;
+        break;
+    }
+
+    v->len = ngx_sprintf(p, "%uz", value) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_variable_request_id(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
@@ -2306,6 +2358,8 @@ ngx_http_variable_time_iso8601(ngx_http_request_t *r,
 {
     u_char  *p;
 
+    ngx_time_strings_update();
+
     p = ngx_pnalloc(r->pool, ngx_cached_http_log_iso8601.len);
     if (p == NULL) {
         return NGX_ERROR;
@@ -2330,6 +2384,8 @@ ngx_http_variable_time_local(ngx_http_request_t *r,
 {
     u_char  *p;
 
+    ngx_time_strings_update();
+
     p = ngx_pnalloc(r->pool, ngx_cached_http_log_time.len);
     if (p == NULL) {
         return NGX_ERROR;
@@ -2377,14 +2433,36 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 #if (NGX_PCRE)
 
     if (len && map->nregex) {
+        u_char                *candidates;
+        u_char                 buf[NGX_REGEX_PREFILTER_STACK];
         ngx_int_t              n;
         ngx_uint_t             i;
         ngx_http_map_regex_t  *reg;
 
+        candidates = NULL;
+
+        if (map->prefilter) {
+            if (map->prefilter->size <= NGX_REGEX_PREFILTER_STACK) {
+                candidates = buf;
+
+            } else {
+                /* all regexes are tested if allocation fails */
+                candidates = ngx_pnalloc(r->pool, map->prefilter->size);
+            }
+
+            if (candidates) {
+                ngx_regex_prefilter_exec(map->prefilter, match, candidates);
+            }
+        }
+
         reg = map->regex;
 
         for (i = 0; i < map->nregex; i++) {
 
+            if (candidates && !ngx_regex_prefilter_candidate(candidates, i)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
             if (n == NGX_OK) {
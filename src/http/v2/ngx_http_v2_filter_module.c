@@ -507,6 +507,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     }
 
     if (r->headers_out.date == NULL) {
+        ngx_time_strings_update();
+
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
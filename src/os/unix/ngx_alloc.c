@@ -12,6 +12,9 @@
 ngx_uint_t  ngx_pagesize;
 ngx_uint_t  ngx_pagesize_shift;
 ngx_uint_t  ngx_cacheline_size;
+#if (NGX_HAVE_MAP_HUGETLB)
+ngx_uint_t  ngx_huge_pagesize;
+#endif
 
 
 void *
@@ -88,3 +91,37 @@ ngx_memalign(size_t alignment, size_t size, ngx_log_t *log)
 }
 
 #endif
+
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+/*
+ * the memory is backed by huge pages if they are available;
+ * it is never freed, as it is used for the process lifetime
+ */
+
+void *
+ngx_alloc_huge(size_t size, ngx_log_t *log)
+{
+    void  *p;
+
+    if (ngx_huge_pagesize) {
+        p = mmap(NULL, ngx_align(size, ngx_huge_pagesize),
+                 PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_HUGETLB,
+                 -1, 0);
+
+        if (p != MAP_FAILED) {
+            ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                           "mmap(MAP_HUGETLB): %p:%uz", p, size);
+            return p;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, log, ngx_errno,
+                      "mmap(MAP_ANON|MAP_PRIVATE|MAP_HUGETLB, %uz) failed, "
+                      "using regular pages", size);
+    }
+
+    return ngx_alloc(size, log);
+}
+
+#endif
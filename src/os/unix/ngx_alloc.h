@@ -37,6 +37,19 @@ void *ngx_memalign(size_t alignment, size_t size, ngx_log_t *log);
 #endif
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+
+void *ngx_alloc_huge(size_t size, ngx_log_t *log);
+
+extern ngx_uint_t  ngx_huge_pagesize;
+
+#else
+
+#define ngx_alloc_huge(size, log)  ngx_alloc(size, log)
+
+#endif
+
+
 extern ngx_uint_t  ngx_pagesize;
 extern ngx_uint_t  ngx_pagesize_shift;
 extern ngx_uint_t  ngx_cacheline_size;
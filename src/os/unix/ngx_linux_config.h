@@ -104,6 +104,21 @@ typedef struct iocb  ngx_aiocb_t;
 #endif
 
 
+#if (NGX_HAVE_FUTEX)
+#include <linux/futex.h>
+#endif
+
+
+#if (NGX_HAVE_NUMA)
+#include <linux/mempolicy.h>
+#endif
+
+
+#if (NGX_HAVE_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#endif
+
+
 #define NGX_LISTEN_BACKLOG        511
 
 
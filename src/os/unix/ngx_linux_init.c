@@ -13,6 +13,11 @@ u_char  ngx_linux_kern_ostype[50];
 u_char  ngx_linux_kern_osrelease[50];
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+static void ngx_linux_huge_pagesize(ngx_log_t *log);
+#endif
+
+
 static ngx_os_io_t ngx_linux_io = {
     ngx_unix_recv,
     ngx_readv_chain,
@@ -48,10 +53,81 @@ ngx_os_specific_init(ngx_log_t *log)
 
     ngx_os_io = ngx_linux_io;
 
+#if (NGX_HAVE_MAP_HUGETLB)
+    ngx_linux_huge_pagesize(log);
+#endif
+
     return NGX_OK;
 }
 
 
+#if (NGX_HAVE_MAP_HUGETLB)
+
+static void
+ngx_linux_huge_pagesize(ngx_log_t *log)
+{
+    u_char     *p, *last;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   size;
+    u_char      buf[4096];
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_INFO, log, ngx_errno,
+                      ngx_open_file_n " \"/proc/meminfo\" failed");
+        return;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf));
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_INFO, log, ngx_errno,
+                      ngx_read_fd_n " \"/proc/meminfo\" failed");
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    if (n <= 0) {
+        return;
+    }
+
+    /* "Hugepagesize:       2048 kB" */
+
+    last = buf + n;
+
+    p = ngx_strlcasestrn(buf, last, (u_char *) "Hugepagesize:",
+                         sizeof("Hugepagesize:") - 1 - 1);
+    if (p == NULL) {
+        return;
+    }
+
+    p += sizeof("Hugepagesize:") - 1;
+
+    while (p < last && *p == ' ') {
+        p++;
+    }
+
+    for (n = 0; p + n < last && p[n] >= '0' && p[n] <= '9'; n++) {
+        /* void */
+    }
+
+    size = ngx_atoi(p, n);
+
+    if (size == NGX_ERROR || size == 0 || (size & (size - 1))) {
+        return;
+    }
+
+    ngx_huge_pagesize = (ngx_uint_t) size * 1024;
+}
+
+#endif
+
+
 void
 ngx_os_specific_status(ngx_log_t *log)
 {
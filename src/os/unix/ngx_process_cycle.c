@@ -885,6 +885,18 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         if (cpu_affinity) {
             ngx_setaffinity(cpu_affinity, cycle->log);
         }
+
+#if (NGX_HAVE_NUMA)
+
+        /* worker's own memory, connections included, comes from its node */
+
+        n = ngx_get_numa_node(worker);
+
+        if (n != NGX_DECLINED) {
+            ngx_numa_bind(n, cycle->log);
+        }
+
+#endif
     }
 
 #if (NGX_HAVE_PR_SET_DUMPABLE)
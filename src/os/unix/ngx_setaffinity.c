@@ -51,3 +51,155 @@ ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log)
 }
 
 #endif
+
+
+#if (NGX_HAVE_NUMA)
+
+ngx_int_t
+ngx_numa_node_cpus(ngx_uint_t node, ngx_cpuset_t *cpus, ngx_log_t *log)
+{
+    u_char     *p, *last;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_int_t   cpu, from;
+    u_char      buf[4096];
+    u_char      name[sizeof("/sys/devices/system/node/node/cpulist")
+                     + NGX_INT_T_LEN];
+
+    (void) ngx_sprintf(name, "/sys/devices/system/node/node%ui/cpulist%Z",
+                       node);
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        if (ngx_errno == NGX_ENOENT) {
+            return NGX_DECLINED;
+        }
+
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_ERROR;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf));
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" failed", name);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (n == -1) {
+        return NGX_ERROR;
+    }
+
+    /* "0-3,8-11" */
+
+    CPU_ZERO(cpus);
+
+    last = buf + n;
+    from = -1;
+    cpu = -1;
+
+    for (p = buf; p <= last; p++) {
+
+        if (p < last && *p >= '0' && *p <= '9') {
+            cpu = (cpu == -1 ? 0 : cpu * 10) + (*p - '0');
+
+            if (cpu >= CPU_SETSIZE) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (p < last && *p == '-') {
+            if (cpu == -1 || from != -1) {
+                goto invalid;
+            }
+
+            from = cpu;
+            cpu = -1;
+            continue;
+        }
+
+        if (p < last && *p != ',' && *p != LF) {
+            goto invalid;
+        }
+
+        if (cpu == -1) {
+            if (from != -1) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (from == -1) {
+            from = cpu;
+        }
+
+        if (from > cpu) {
+            goto invalid;
+        }
+
+        while (from <= cpu) {
+            CPU_SET(from, cpus);
+            from++;
+        }
+
+        from = -1;
+        cpu = -1;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ALERT, log, 0, "invalid cpu list in \"%s\"", name);
+
+    return NGX_ERROR;
+}
+
+
+void
+ngx_numa_bind(ngx_uint_t node, ngx_log_t *log)
+{
+    unsigned long  mask;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "set_mempolicy(): preferring numa node #%ui", node);
+
+    mask = 1UL << node;
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "set_mempolicy() failed");
+    }
+}
+
+
+void
+ngx_numa_interleave(void *addr, size_t size, ngx_uint_t nodes, ngx_log_t *log)
+{
+    unsigned long  mask;
+
+    /* only nodes worker processes run on are used */
+
+    mask = nodes;
+
+    if (syscall(SYS_mbind, addr, size, MPOL_INTERLEAVE, &mask,
+                sizeof(mask) * 8 + 1, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "mbind() failed");
+    }
+}
+
+#endif
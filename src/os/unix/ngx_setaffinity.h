@@ -25,6 +25,18 @@ typedef cpuset_t  ngx_cpuset_t;
 
 void ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log);
 
+#if (NGX_HAVE_NUMA)
+
+#define NGX_NUMA_MAX_NODES  (sizeof(ngx_uint_t) * 8)
+
+ngx_int_t ngx_numa_node_cpus(ngx_uint_t node, ngx_cpuset_t *cpus,
+    ngx_log_t *log);
+void ngx_numa_bind(ngx_uint_t node, ngx_log_t *log);
+void ngx_numa_interleave(void *addr, size_t size, ngx_uint_t nodes,
+    ngx_log_t *log);
+
+#endif
+
 #else
 
 #define ngx_setaffinity(cpu_affinity, log)
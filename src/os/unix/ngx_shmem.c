@@ -14,6 +14,37 @@
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    if (shm->huge) {
+
+        if (ngx_huge_pagesize) {
+            shm->addr = (u_char *) mmap(NULL,
+                                        ngx_align(shm->size, ngx_huge_pagesize),
+                                        PROT_READ|PROT_WRITE,
+                                        MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+            if (shm->addr != MAP_FAILED) {
+#if (NGX_HAVE_NUMA)
+                if (shm->numa) {
+                    ngx_numa_interleave(shm->addr,
+                                        ngx_align(shm->size, ngx_huge_pagesize),
+                                        shm->numa, shm->log);
+                }
+#endif
+                return NGX_OK;
+            }
+
+            ngx_log_error(NGX_LOG_NOTICE, shm->log, ngx_errno,
+                          "mmap(MAP_ANON|MAP_SHARED|MAP_HUGETLB, %uz) failed, "
+                          "using regular pages", shm->size);
+        }
+
+        shm->huge = 0;
+    }
+
+#endif
+
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
@@ -24,6 +55,16 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_NUMA)
+
+    /* pages are not touched yet, so they all follow the policy */
+
+    if (shm->numa) {
+        ngx_numa_interleave(shm->addr, shm->size, shm->numa, shm->log);
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -31,9 +72,23 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  size;
+
+    size = shm->size;
+
+#if (NGX_HAVE_MAP_HUGETLB)
+
+    /* huge page mappings are unmapped in whole pages */
+
+    if (shm->huge) {
+        size = ngx_align(size, ngx_huge_pagesize);
+    }
+
+#endif
+
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
     }
 }
 
@@ -19,6 +19,12 @@ typedef struct {
     ngx_str_t    name;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+#if (NGX_HAVE_MAP_HUGETLB)
+    ngx_uint_t   huge;     /* unsigned  huge:1;  */
+#endif
+#if (NGX_HAVE_NUMA)
+    ngx_uint_t   numa;     /* nodes to interleave on */
+#endif
 } ngx_shm_t;
 
 
@@ -828,6 +828,8 @@ ngx_stream_variable_time_iso8601(ngx_stream_session_t *s,
 {
     u_char  *p;
 
+    ngx_time_strings_update();
+
     p = ngx_pnalloc(s->connection->pool, ngx_cached_http_log_iso8601.len);
     if (p == NULL) {
         return NGX_ERROR;
@@ -852,6 +854,8 @@ ngx_stream_variable_time_local(ngx_stream_session_t *s,
 {
     u_char  *p;
 
+    ngx_time_strings_update();
+
     p = ngx_pnalloc(s->connection->pool, ngx_cached_http_log_time.len);
     if (p == NULL) {
         return NGX_ERROR;
@@ -914,14 +918,37 @@ ngx_stream_map_find(ngx_stream_session_t *s, ngx_stream_map_t *map,
 #if (NGX_PCRE)
 
     if (len && map->nregex) {
+        u_char                  *candidates;
+        u_char                   buf[NGX_REGEX_PREFILTER_STACK];
         ngx_int_t                n;
         ngx_uint_t               i;
         ngx_stream_map_regex_t  *reg;
 
+        candidates = NULL;
+
+        if (map->prefilter) {
+            if (map->prefilter->size <= NGX_REGEX_PREFILTER_STACK) {
+                candidates = buf;
+
+            } else {
+                /* all regexes are tested if allocation fails */
+                candidates = ngx_pnalloc(s->connection->pool,
+                                         map->prefilter->size);
+            }
+
+            if (candidates) {
+                ngx_regex_prefilter_exec(map->prefilter, match, candidates);
+            }
+        }
+
         reg = map->regex;
 
         for (i = 0; i < map->nregex; i++) {
 
+            if (candidates && !ngx_regex_prefilter_candidate(candidates, i)) {
+                continue;
+            }
+
             n = ngx_stream_regex_exec(s, reg[i].regex, match);
 
             if (n == NGX_OK) {
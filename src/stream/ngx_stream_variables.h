@@ -94,6 +94,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_stream_map_regex_t       *regex;
     ngx_uint_t                    nregex;
+    ngx_regex_prefilter_t        *prefilter;
 #endif
 } ngx_stream_map_t;
 